@@ -0,0 +1,34 @@
+#include "alloc.h"
+
+#ifdef M913_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> g_allocations{0};
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    for (;;) {
+        if (void* p = std::malloc(size)) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+// operator new[] and the nothrow forms call the one above.
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+bool   allocation_counting() { return true; }
+size_t allocation_count()    { return g_allocations.load(std::memory_order_relaxed); }
+
+#else
+
+bool   allocation_counting() { return false; }
+size_t allocation_count()    { return 0; }
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+// -----------------------------------------------------------------------
+// Heap allocation counter
+//
+// Configured with -DM913_COUNT_ALLOCATIONS=ON, the build replaces the
+// global operator new with one that counts calls, so a stretch of code
+// can be checked to allocate nothing once warmed up:
+//
+//   size_t before = allocation_count();
+//   batch.extend(build_dpi_packets(dpi, batch.tail(), batch.room()));
+//   assert(allocation_count() == before);
+//
+// --timings then reports the counts as well.  Without the option nothing
+// is replaced and allocation_count() is always 0.
+// -----------------------------------------------------------------------
+
+// True if this build counts allocations.
+bool allocation_counting();
+
+// Allocations so far, across all threads.
+size_t allocation_count();
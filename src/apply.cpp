@@ -0,0 +1,303 @@
+#include "apply.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+static void print_ack(const uint8_t* buf, int got) {
+    std::cout << "    <-- ";
+    std::cout << std::hex << std::setfill('0');
+    for (int b = 0; b < got; ++b)
+        std::cout << std::setw(2) << static_cast<int>(buf[b]) << " ";
+    std::cout << std::dec << "\n";
+}
+
+static std::string pkt_label(size_t i, size_t n) {
+    return "pkt " + std::to_string(i + 1) + "/" + std::to_string(n);
+}
+
+// Count consecutive unacknowledged writes; give up once the link is
+// clearly dead rather than waiting out every remaining packet.
+// first_unacked is the sequence's earliest packet without an ACK.
+static void check_link(bool acked, int& misses, size_t first_unacked) {
+    misses = acked ? 0 : misses + 1;
+    if (misses >= DEAD_LINK_MISSES) {
+        throw LinkDownError(
+            "no ACK for " + std::to_string(misses) +
+            " writes in a row — is the mouse awake and in range?",
+            PlanPosition{0, first_unacked});
+    }
+}
+
+// Give up once the caller's time limit has passed.  first_unacked is the
+// sequence's earliest packet not yet acknowledged.
+static void check_time(const SendOptions& opts, size_t first_unacked) {
+    if (Clock::now() >= opts.give_up)
+        throw LinkDownError("time limit reached before the plan was written",
+                            PlanPosition{0, first_unacked});
+}
+
+// -----------------------------------------------------------------------
+// Send one packet and read the ACK interrupt response.
+// The device always sends a 17-byte ACK on EP 0x82 after each config write.
+// Without a round-trip estimate we wait up to 1.5 s — if it times out we
+// warn and continue (wireless latency can be high).  With one, the wait
+// follows the measured round trip and a missed ACK is retried instead.
+// -----------------------------------------------------------------------
+bool send_cmd(Transport& mouse, const Packet& p, const std::string& label,
+              bool verbose, RttEstimator* rtt) {
+    if (verbose) {
+        if (!label.empty())
+            std::cout << "  " << label << "\n";
+        std::cout << "    --> ";
+        hexdump_packet(p);
+    }
+
+    uint8_t buf[M913_PACKET_SIZE] = {};
+    // A resent write can be acknowledged twice; drop anything left over so
+    // the second ACK is not taken for this packet's.
+    if (rtt)
+        while (mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, 0) > 0) {}
+
+    // The mouse responds within ~20 ms on native USB.  On WSL2/USB-IP the
+    // VHCI needs a URB already queued to catch interrupt data; the USB
+    // backends keep one permanently queued on EP 0x82 (hidraw buffers
+    // reports in the kernel), so a single wait per attempt is enough.
+    unsigned int deadline = rtt ? rtt->deadline_ms() : ACK_TIMEOUT_MS;
+    int          attempts = 1 + (rtt ? rtt->retries() : 0);
+    unsigned int waited   = 0;
+    int got = 0;
+    for (int a = 0; a < attempts && got == 0; ++a) {
+        auto t0 = Clock::now();
+        mouse.send(p.data());
+        got = mouse.try_recv(buf, M913_PACKET_SIZE, INTERRUPT_EP_IN, deadline);
+        // Only first attempts give unambiguous samples (Karn's rule).
+        if (got > 0 && rtt && a == 0)
+            rtt->observe(ms_since(t0));
+        if (got == 0 && a + 1 < attempts && verbose)
+            std::cout << "    (no ACK within " << deadline << " ms, resending)\n";
+        waited  += deadline;
+        deadline = std::min(deadline * 2, ACK_TIMEOUT_MS);
+    }
+
+    if (verbose) {
+        if (got > 0)
+            print_ack(buf, got);
+        else
+            std::cout << "    <-- (no ACK within " << waited << " ms)\n";
+    }
+    return got > 0;
+}
+
+// -----------------------------------------------------------------------
+// Pipelined path: keep up to `window` writes in flight and match each ACK
+// to its packet by address.  Returns normally once every packet has been
+// acknowledged — by the pipeline or by the lock-step fallback.
+// -----------------------------------------------------------------------
+static void send_pipelined(Transport& mouse, const Packet* pkts, size_t count,
+                           const SendOptions& opts, SendStats& stats) {
+    struct InFlight { size_t idx; Clock::time_point sent; };
+    std::deque<InFlight> inflight;
+    std::vector<bool>    acked(count, false);
+    const size_t         window = static_cast<size_t>(opts.window);
+    SendTracker          sends(mouse);
+    size_t               next = 0;
+    const char*          miss = nullptr;  // reason for falling back to lock-step
+
+    while (!miss && (next < count || !inflight.empty())) {
+        check_time(opts, inflight.empty() ? next : inflight.front().idx);
+        while (next < count && inflight.size() < window) {
+            if (opts.verbose) {
+                std::cout << "  " << pkt_label(next, count) << "\n    --> ";
+                hexdump_packet(pkts[next]);
+            }
+            sends.submit(pkts[next].data());
+            inflight.push_back({next++, Clock::now()});
+        }
+
+        // Wait for the next ACK, bounded by the oldest write's deadline.
+        double       waited   = ms_since(inflight.front().sent);
+        unsigned int deadline = opts.rtt ? opts.rtt->deadline_ms() : ACK_TIMEOUT_MS;
+        unsigned int remaining = waited >= deadline
+            ? 0 : static_cast<unsigned int>(deadline - waited);
+        uint8_t buf[M913_PACKET_SIZE] = {};
+        int got = mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, remaining);
+
+        if (sends.errors()) { miss = "control transfer failed"; break; }
+        if (got == 0)    { miss = "ACK timed out";           break; }
+
+        auto it = std::find_if(inflight.begin(), inflight.end(), [&](const InFlight& f) {
+            return ack_matches(pkts[f.idx], buf, got);
+        });
+        if (it == inflight.end()) { miss = "ACK did not match an in-flight packet"; break; }
+
+        if (opts.verbose) {
+            std::cout << "  ack " << pkt_label(it->idx, count) << "\n";
+            print_ack(buf, got);
+        }
+        double rtt_ms = ms_since(it->sent);
+        acked[it->idx] = true;
+        ++stats.acked;
+        stats.rtt_sum_ms += rtt_ms;
+        if (opts.rtt) opts.rtt->observe(rtt_ms);
+        if (opts.on_result) opts.on_result(pkts[it->idx], true, rtt_ms);
+        inflight.erase(it);
+    }
+
+    if (!miss) return;
+
+    // Let the abandoned window's control transfers finish and swallow any
+    // late ACKs so they are not mistaken for the resends' ACKs.
+    sends.drain();
+    uint8_t drain[M913_PACKET_SIZE];
+    while (mouse.try_recv(drain, sizeof(drain), INTERRUPT_EP_IN, 50) > 0) {}
+
+    if (opts.verbose)
+        std::cout << "    (pipelining: " << miss
+                  << " — resending unacknowledged packets lock-step)\n";
+    int    misses = 0;
+    size_t first_unacked = count;
+    for (size_t i = 0; i < count; ++i) {
+        if (acked[i]) continue;
+        check_time(opts, std::min(first_unacked, i));
+        auto t0 = Clock::now();
+        bool ok = send_cmd(mouse, pkts[i], pkt_label(i, count) + " (resend)",
+                           opts.verbose, opts.rtt);
+        double rtt_ms = ms_since(t0);
+        ++stats.resent;
+        if (ok) {
+            ++stats.acked;
+            stats.rtt_sum_ms += rtt_ms;
+        } else if (first_unacked == count) {
+            first_unacked = i;
+        }
+        if (opts.on_result) opts.on_result(pkts[i], ok, rtt_ms);
+        check_link(ok, misses, first_unacked);
+    }
+}
+
+void send_sequence(Transport& mouse,
+                   const Packet* pkts, size_t count,
+                   std::string_view heading,
+                   const SendOptions& opts,
+                   SendStats* stats) {
+    if (count == 0) return;
+    if (opts.verbose)
+        std::cout << "=== " << heading << " (" << count << " packets) ===\n";
+
+    SendStats local;
+    SendStats& st = stats ? *stats : local;
+    auto t0 = Clock::now();
+    st.packets += static_cast<int>(count);
+
+    if (opts.window > 1 && count > 1) {
+        send_pipelined(mouse, pkts, count, opts, st);
+    } else {
+        int    misses = 0;
+        size_t first_unacked = count;
+        for (size_t i = 0; i < count; ++i) {
+            check_time(opts, std::min(first_unacked, i));
+            auto t = Clock::now();
+            bool ok = send_cmd(mouse, pkts[i], pkt_label(i, count), opts.verbose,
+                               opts.rtt);
+            double rtt_ms = ms_since(t);
+            if (ok) {
+                ++st.acked;
+                st.rtt_sum_ms += rtt_ms;
+            } else if (first_unacked == count) {
+                first_unacked = i;
+            }
+            if (opts.on_result) opts.on_result(pkts[i], ok, rtt_ms);
+            check_link(ok, misses, first_unacked);
+        }
+    }
+
+    st.elapsed_ms += ms_since(t0);
+}
+
+void send_plan(Transport& mouse,
+               const PacketPlan& plan,
+               const SendOptions& opts,
+               SendStats* stats,
+               PlanPosition from) {
+    for (size_t s = from.section; s < plan.size(); ++s) {
+        const PlanSection& section = plan[s];
+        SendOptions o = opts;
+        if (section.lock_step) o.window = 1;
+
+        // Resuming mid-section: send only the rest of it.
+        size_t skip = (s == from.section) ? std::min(from.packet, section.packets.size()) : 0;
+        try {
+            if (skip == 0) {
+                send_sequence(mouse, section.packets, section.heading, o, stats);
+            } else {
+                send_sequence(mouse, section.packets.data() + skip,
+                              section.packets.size() - skip,
+                              section.heading + " (resumed)", o, stats);
+            }
+        } catch (LinkDownError& e) {
+            e.resume.section = s;
+            e.resume.packet += skip;
+            throw;
+        }
+    }
+}
+
+bool probe_link(Transport& mouse, const Packet& probe, unsigned int wait_ms,
+                double* rtt_ms) {
+    uint8_t buf[64];
+    while (mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, 0) > 0) {}
+    auto t0 = Clock::now();
+    mouse.send(probe.data());
+    if (mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, wait_ms) <= 0) return false;
+    if (rtt_ms) *rtt_ms = ms_since(t0);
+    return true;
+}
+
+bool wait_for_wake(Transport& mouse, const Packet& probe, unsigned int timeout_ms,
+                   const volatile bool& stop) {
+    auto deadline   = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    auto next_probe = Clock::now() + std::chrono::seconds(1);
+    uint8_t buf[64];
+    const uint8_t eps[] = { INTERRUPT_EP_MOUSE, INTERRUPT_EP_IN };
+
+    while (!stop && Clock::now() < deadline) {
+        // EP 0x81 only delivers where the pointer interface is readable
+        // (hidraw, or a full claim); EP 0x82 always does.
+        mouse.poll_events(100);
+        for (uint8_t ep : eps)
+            if (mouse.try_recv(buf, sizeof(buf), ep, 0) > 0) return true;
+
+        if (Clock::now() >= next_probe) {
+            try {
+                mouse.send(probe.data());
+            } catch (const std::exception&) {
+                // A receiver whose mouse is away may stall the write; keep listening.
+            }
+            next_probe = Clock::now() + std::chrono::seconds(1);
+        }
+    }
+    return false;
+}
+
+void print_send_stats(const SendStats& stats, int window) {
+    std::cout << std::fixed << std::setprecision(1)
+              << "Pipelining (window " << window << "): " << stats.packets
+              << " packets in " << stats.elapsed_ms << " ms, "
+              << stats.acked << " acknowledged, " << stats.resent << " resent lock-step.\n"
+              << "Lock-step estimate: " << stats.rtt_sum_ms << " ms";
+    if (stats.elapsed_ms > 0 && stats.rtt_sum_ms > 0)
+        std::cout << " (" << std::setprecision(2)
+                  << stats.rtt_sum_ms / stats.elapsed_ms << "x speedup)";
+    std::cout << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "plan.h"
+#include "protocol.h"
+#include "rtt.h"
+#include "transport.h"
+
+// Pacing options for send_sequence().
+struct SendOptions {
+    // Number of config writes kept in flight.  1 = lock-step (send one
+    // packet, wait for its ACK, send the next).
+    int  window  = 1;
+    // Print section headings and hex-dump every packet and its ACK to
+    // stdout.  Off for worker threads that report results separately.
+    bool verbose = true;
+    // Round-trip estimate for the device being written.  ACK deadlines and
+    // resends are derived from it, and every clean round trip updates it.
+    // nullptr = fixed ACK_TIMEOUT_MS per write, no resends.
+    RttEstimator* rtt = nullptr;
+    // Called once per packet when its fate is settled: acknowledged (with
+    // the send→ACK time) or given up on.  Pipelined packets are reported in
+    // the order their ACKs arrive.
+    std::function<void(const Packet& p, bool acked, double rtt_ms)> on_result;
+    // Abandon the send with a LinkDownError once this time has passed.
+    // Checked before each write, so it can be overrun by one ACK wait.
+    std::chrono::steady_clock::time_point give_up =
+        std::chrono::steady_clock::time_point::max();
+};
+
+// Writes in a row without an ACK after which the link is taken to be down
+// and the rest of the plan is abandoned.
+static constexpr int DEAD_LINK_MISSES = 3;
+
+// Port resets tried during one apply after a transfer stalled or the
+// device dropped off the bus (see Transport::reset()).
+static constexpr int MAX_RESETS = 2;
+
+// Thrown by send_sequence()/send_plan() after DEAD_LINK_MISSES unacknowledged
+// writes in a row, or once opts.give_up has passed.  `resume` is the first packet that was never
+// acknowledged (relative to the sequence for send_sequence(), to the plan
+// for send_plan()); everything before it has been written.
+class LinkDownError : public std::runtime_error {
+public:
+    LinkDownError(const std::string& what, PlanPosition resume)
+        : std::runtime_error(what), resume(resume) {}
+
+    PlanPosition resume;
+};
+
+// Running totals across send_sequence() calls, used to report how the
+// pipelined path compares with lock-step.
+struct SendStats {
+    int    packets    = 0;  // packets handed to send_sequence
+    int    acked      = 0;  // packets whose ACK was received and verified
+    int    resent     = 0;  // packets re-sent lock-step after a pipelining miss
+    double elapsed_ms = 0;  // wall time spent inside send_sequence
+    double rtt_sum_ms = 0;  // sum of per-packet send→ACK times (≈ lock-step cost)
+};
+
+// Send one packet and wait for its ACK on EP 0x82 (lock-step).
+// Without an estimate the wait is ACK_TIMEOUT_MS; with one it is
+// rtt->deadline_ms(), and the packet is resent up to rtt->retries() times
+// with doubling deadlines.  Returns true if an ACK arrived.
+bool send_cmd(Transport& mouse, const Packet& p, const std::string& label,
+              bool verbose = true, RttEstimator* rtt = nullptr);
+
+// Send an entire packet sequence (keyboard-key sub-packets + config packets).
+//
+// With opts.window > 1 up to `window` writes are in flight at once and each
+// ACK is matched to its packet by address (see ack_matches()).  Any ACK that
+// fails to match or verify, and any write whose ACK does not arrive in time,
+// drops the rest of the sequence back to lock-step resends.
+//
+// Throws LinkDownError once DEAD_LINK_MISSES writes in a row get no ACK.
+void send_sequence(Transport& mouse,
+                   const Packet* pkts, size_t count,
+                   std::string_view heading,
+                   const SendOptions& opts = {},
+                   SendStats* stats = nullptr);
+
+inline void send_sequence(Transport& mouse,
+                          const std::vector<Packet>& pkts,
+                          std::string_view heading,
+                          const SendOptions& opts = {},
+                          SendStats* stats = nullptr) {
+    send_sequence(mouse, pkts.data(), pkts.size(), heading, opts, stats);
+}
+
+// Send every section of a plan in order, starting at `from` (to resume
+// after a LinkDownError).  Sections marked lock_step (the commit) are
+// never pipelined.
+void send_plan(Transport& mouse,
+               const PacketPlan& plan,
+               const SendOptions& opts = {},
+               SendStats* stats = nullptr,
+               PlanPosition from = {});
+
+// Check that the mouse answers before streaming a plan: send `probe` (a
+// packet of the plan, so writing it is harmless) and wait up to wait_ms
+// for any report on EP 0x82.  A sleeping or out-of-range wireless mouse
+// fails this in one short wait instead of a timeout per packet.  The
+// round trip is stored in *rtt_ms when the mouse answers.
+bool probe_link(Transport& mouse, const Packet& probe, unsigned int wait_ms,
+                double* rtt_ms = nullptr);
+
+// Wait up to timeout_ms for a sleeping mouse to wake: any report on EP
+// 0x81/0x82 (moving it or pressing a button), or an ACK to `probe`, which
+// is re-sent every second.  Returns false on timeout or Ctrl+C (`stop`).
+bool wait_for_wake(Transport& mouse, const Packet& probe, unsigned int timeout_ms,
+                   const volatile bool& stop);
+
+// Print a one-line summary of `stats` comparing the measured time with the
+// lock-step estimate (sum of individual round trips).
+void print_send_stats(const SendStats& stats, int window);
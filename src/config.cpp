@@ -112,7 +112,10 @@ Config parse_config_file(const std::string& path) {
     std::ifstream f(path);
     if (!f.is_open())
         throw std::runtime_error("Cannot open config file: " + path);
+    return parse_config_stream(f);
+}
 
+Config parse_config_stream(std::istream& f) {
     Config cfg;
     std::string section;
     int lineno = 0;
@@ -262,8 +265,8 @@ void validate_config(const Config& cfg) {
         if (!parse_button_name(key, btn))
             throw std::runtime_error("Unknown button name: " + key);
 
-        ActionBytes ab;
-        if (!parse_action(action, ab))
+        ButtonAction ba;
+        if (!parse_action(action, ba))
             throw std::runtime_error(
                 "Unknown action '" + action + "' for button " + key);
     }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <istream>
 #include <map>
 #include <string>
 #include <vector>
@@ -42,6 +43,10 @@ struct Config {
 // Throws std::runtime_error if the file cannot be read or has syntax errors.
 Config parse_config_file(const std::string& path);
 
+// Parse INI text from a stream (same syntax as parse_config_file).
+// Throws std::runtime_error on syntax errors.
+Config parse_config_stream(std::istream& in);
+
 // Validate a parsed Config and throw std::runtime_error if any value is out of range.
 void validate_config(const Config& cfg);
 
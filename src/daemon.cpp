@@ -0,0 +1,256 @@
+#include "daemon.h"
+#include "config.h"
+#include "discovery.h"
+#include "shadow.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// A full config is well under 4 KiB; anything much larger is not a request.
+constexpr size_t MAX_REQUEST_BYTES = 64 * 1024;
+
+struct Client {
+    int         fd = -1;
+    std::string in;    // received bytes not yet split into lines
+    std::string body;  // lines of the request being collected
+};
+
+double ms_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+std::string errno_text(const char* what) {
+    return std::string(what) + ": " + std::strerror(errno);
+}
+
+sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("socket path too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+// Listen on `path`.  A socket file left behind by a daemon that died is
+// replaced; one that still accepts connections belongs to a live daemon.
+int listen_on(const std::string& path) {
+    sockaddr_un addr = socket_address(path);
+    auto* sa = reinterpret_cast<sockaddr*>(&addr);
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) throw std::runtime_error(errno_text("socket"));
+    bool live = connect(probe, sa, sizeof(addr)) == 0;
+    ::close(probe);
+    if (live)
+        throw std::runtime_error("another daemon is already listening on " + path);
+    unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error(errno_text("socket"));
+    mode_t old_mask = umask(0077);
+    int rc = bind(fd, sa, sizeof(addr));
+    umask(old_mask);
+    if (rc < 0 || listen(fd, 8) < 0) {
+        std::string err = errno_text(rc < 0 ? "bind" : "listen");
+        ::close(fd);
+        throw std::runtime_error(err + " (" + path + ")");
+    }
+    return fd;
+}
+
+bool write_all(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+std::string addr_hex(const Packet& p) {
+    char s[8];
+    std::snprintf(s, sizeof(s), "%02x%02x", p[3], p[4]);
+    return s;
+}
+
+// Build and send the plan for one request and format the reply.  Sets
+// `device_lost` when the transport itself failed (unplugged, revoked), as
+// opposed to the mouse not answering.
+std::string apply_request(Transport& mouse, DeviceModel model, const std::string& body,
+                          const DaemonOptions& opts, bool& device_lost) {
+    auto t0 = Clock::now();
+    std::ostringstream reply;
+    reply << std::fixed << std::setprecision(2);
+
+    PacketPlan plan;
+    try {
+        std::istringstream in(body);
+        Config cfg = parse_config_stream(in);
+        validate_config(cfg);
+        plan = build_plan(&cfg, InlineSettings{}, model);
+    } catch (const std::exception& e) {
+        reply << "error " << e.what() << "\n";
+        return reply.str();
+    }
+    // Re-read for every request: a one-off m913-ctl run may have written
+    // the mouse since.
+    ShadowImage shadow;
+    shadow.load(opts.shadow_key);
+    if (opts.use_shadow) {
+        size_t skipped = 0;
+        plan = diff_plan(plan, shadow, skipped);
+    }
+
+    std::vector<std::pair<Packet, bool>> results;
+    SendOptions send = opts.send;
+    send.verbose   = false;
+    send.on_result = [&](const Packet& p, bool acked, double ms) {
+        results.push_back({p, acked});
+        if (acked) reply << "ack " << addr_hex(p) << " " << ms << "\n";
+        else       reply << "miss " << addr_hex(p) << "\n";
+    };
+
+    // Drop ACKs and hello reports that arrived while idle.
+    uint8_t stale[64];
+    while (mouse.try_recv(stale, sizeof(stale), INTERRUPT_EP_IN, 0) > 0) {}
+
+    SendStats st;
+    try {
+        send_plan(mouse, plan, send, &st);
+    } catch (const std::exception& e) {
+        // Whatever the plan touched is no longer known.
+        shadow.forget(plan);
+        shadow.save(opts.shadow_key);
+        device_lost = dynamic_cast<const LinkDownError*>(&e) == nullptr;
+        reply << "error " << e.what() << "\n";
+        return reply.str();
+    }
+    if (!plan.empty()) {
+        for (auto& [p, acked] : results) {
+            if (acked) shadow.record(p);
+            else       shadow.forget(p);
+        }
+        shadow.save(opts.shadow_key);
+    }
+    reply << "ok " << st.acked << "/" << st.packets << " " << ms_since(t0) << "\n";
+    return reply.str();
+}
+
+}  // namespace
+
+std::string default_socket_path() {
+    std::string dir = runtime_cache_dir();
+    return dir.empty() ? "" : dir + "/daemon.sock";
+}
+
+int run_daemon(Transport& mouse, DeviceModel model, const DaemonOptions& opts,
+               const volatile bool& stop) {
+    std::string path = opts.socket_path.empty() ? default_socket_path() : opts.socket_path;
+    if (path.empty())
+        throw std::runtime_error("XDG_RUNTIME_DIR is not set; pass --socket PATH");
+    int listen_fd = listen_on(path);
+    std::cout << "Listening on " << path << " (Ctrl+C to stop).\n" << std::flush;
+
+    std::vector<Client> clients;
+    bool device_lost = false;
+    int  served = 0;
+
+    while (!stop && !device_lost) {
+        std::vector<pollfd> fds;
+        fds.push_back({listen_fd, POLLIN, 0});
+        for (auto& c : clients) fds.push_back({c.fd, POLLIN, 0});
+        // Wake up now and then to notice `stop`.
+        if (poll(fds.data(), fds.size(), 500) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: " << errno_text("poll") << "\n";
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) clients.push_back(Client{fd, {}, {}});
+        }
+
+        // Clients in poll order; new ones are picked up on the next pass.
+        for (size_t i = 1; i < fds.size() && !device_lost; ++i) {
+            if (!fds[i].revents) continue;
+            Client& c = clients[i - 1];
+
+            char buf[4096];
+            ssize_t n = read(c.fd, buf, sizeof(buf));
+            bool eof = n <= 0;
+            if (n > 0) c.in.append(buf, static_cast<size_t>(n));
+
+            // A request ends at a "." line, or at EOF if anything was sent.
+            std::vector<std::string> requests;
+            size_t nl;
+            while ((nl = c.in.find('\n')) != std::string::npos) {
+                std::string line = c.in.substr(0, nl);
+                c.in.erase(0, nl + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line == ".") {
+                    requests.push_back(std::move(c.body));
+                    c.body.clear();
+                } else {
+                    c.body += line + "\n";
+                }
+            }
+            if (eof && !(c.body.empty() && c.in.empty()))
+                requests.push_back(c.body + c.in);
+
+            bool too_large = !eof && c.body.size() + c.in.size() > MAX_REQUEST_BYTES;
+            bool drop      = eof || too_large;
+            for (auto& body : requests) {
+                std::string reply = apply_request(mouse, model, body, opts, device_lost);
+                ++served;
+                // The last line says how the request went.
+                std::string status = reply.substr(reply.rfind('\n', reply.size() - 2) + 1);
+                std::cout << "request " << served << ": " << status << std::flush;
+                if (!write_all(c.fd, reply)) { drop = true; break; }
+                if (device_lost) break;
+            }
+            if (drop) {
+                // The rest of an oversized request is not read; say why
+                // the connection closes.
+                if (too_large)
+                    write_all(c.fd, "error request larger than " +
+                                        std::to_string(MAX_REQUEST_BYTES / 1024) + " KiB\n");
+                ::close(c.fd);
+                c.fd = -1;
+            }
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                     [](const Client& c) { return c.fd < 0; }),
+                      clients.end());
+    }
+
+    for (auto& c : clients) ::close(c.fd);
+    ::close(listen_fd);
+    unlink(path.c_str());
+    if (device_lost) {
+        std::cerr << "Error: the device stopped accepting writes; daemon exiting\n";
+        return 1;
+    }
+    std::cout << "Stopped after " << served << " request(s).\n";
+    return 0;
+}
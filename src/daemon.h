@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+
+#include "apply.h"
+#include "plan.h"
+#include "transport.h"
+
+// -----------------------------------------------------------------------
+// Apply daemon
+//
+// Keeps one opened, drained mouse and applies settings sent over a Unix
+// stream socket, so a frontend pays for discovery, the interface claim and
+// the hello drain once instead of on every change.
+//
+// Protocol (line-based text; any number of requests per connection):
+//
+//   request  The body of an INI config file -- the same sections and keys
+//            as --config -- ended by a line holding a single "." or by the
+//            end of the stream.  An empty request is a ping.
+//
+//   reply    One line per written packet, in the order its fate settled:
+//              ack <addr> <ms>     acknowledged, send->ACK time in ms
+//              miss <addr>         no ACK after all resends
+//            (<addr> is bytes 3-4 of the packet in hex), then one of:
+//              ok <acked>/<total> <ms>   the whole plan was written
+//                                        (writes the mouse already
+//                                        held are not sent or counted)
+//              error <message>           bad request, or the mouse
+//                                        stopped answering
+//            where <ms> is the time from the end of the request to the
+//            reply.
+// -----------------------------------------------------------------------
+
+// Options for run_daemon().
+struct DaemonOptions {
+    std::string socket_path;  // "" = default_socket_path()
+    SendOptions send;         // pacing per request; output is always quiet
+    // Device shadow (see shadow.h): writes the mouse already holds are
+    // left out of each request unless use_shadow is false.  "" = none.
+    std::string shadow_key;
+    bool        use_shadow = true;
+};
+
+// $XDG_RUNTIME_DIR/m913-ctl/daemon.sock, or "" when XDG_RUNTIME_DIR is unset.
+std::string default_socket_path();
+
+// Serve requests for `mouse` (already opened, drained and set up for
+// `model`) until `stop` is set or the device stops accepting writes.
+// The socket is created with mode 0600 and removed on return.
+// Returns 0 on a clean stop, 1 if the device was lost.
+// Throws std::runtime_error if the socket cannot be set up.
+int run_daemon(Transport& mouse, DeviceModel model, const DaemonOptions& opts,
+               const volatile bool& stop);
@@ -165,8 +165,9 @@ static std::string to_lower(std::string s) {
     return s;
 }
 
-bool parse_action(const std::string& action_raw, ActionBytes& out) {
+bool parse_action(const std::string& action_raw, ButtonAction& out) {
     std::string action = to_lower(action_raw);
+    out = ButtonAction{};
 
     // 1. Check for fire button with parameters: "fire:speed:times"
     if (action.substr(0, 5) == "fire:") {
@@ -177,7 +178,7 @@ bool parse_action(const std::string& action_raw, ActionBytes& out) {
                 int times = std::stoi(parts[2]);
                 if (speed >= 3 && speed <= 255 && times >= 0 && times <= 3) {
                     uint8_t checksum = (0x55u - (0x04u + speed + times)) & 0xFF;
-                    out = {0x04, static_cast<uint8_t>(speed), static_cast<uint8_t>(times), checksum};
+                    out.bytes = {0x04, static_cast<uint8_t>(speed), static_cast<uint8_t>(times), checksum};
                     return true;
                 }
             } catch (...) {}
@@ -188,7 +189,7 @@ bool parse_action(const std::string& action_raw, ActionBytes& out) {
     // 2. Try direct mouse/special action lookup
     auto it = mouse_actions.find(action);
     if (it != mouse_actions.end()) {
-        out = it->second;
+        out.bytes = it->second;
         return true;
     }
 
@@ -197,57 +198,26 @@ bool parse_action(const std::string& action_raw, ActionBytes& out) {
     auto parts = split(action, '+');
     if (parts.empty()) return false;
     
-    uint8_t mods = 0x00;
-    std::vector<uint8_t> keys;
-
     for (auto& part : parts) {
         auto mit = modifier_bits.find(part);
         if (mit != modifier_bits.end()) {
-            mods |= mit->second;
+            out.mods |= mit->second;
         } else {
             // Must be a key
             auto kit = key_codes.find(part);
             if (kit == key_codes.end()) return false;
-            keys.push_back(kit->second);
+            if (out.n_keys == MAX_BINDING_KEYS) return false;
+            out.keys[out.n_keys++] = kit->second;
         }
     }
 
-    // Handle different cases:
-    if (keys.empty()) {
-        // Modifier-only binding (e.g. just "ctrl_l")
-        out = {0x90, mods, 0x00, 0x00};
-        return true;
-    } else if (keys.size() == 1) {
-        // Single key with optional modifiers
-        out = {0x90, mods, keys[0], 0x00};
-        return true;
-    } else {
-        // Multi-key combination - encode key count in byte 3
-        // Protocol.cpp will detect this and generate proper multi-key events
-        if (keys.size() > 255) return false;  // too many keys
-        out = {0x90, mods, keys[0], static_cast<uint8_t>(keys.size())};
-        return true;
-    }
-}
-
-bool parse_multikey(const std::string& action, uint8_t& mods, std::vector<uint8_t>& keys) {
-    std::string lower_action = to_lower(action);
-    auto parts = split(lower_action, '+');
-    if (parts.empty()) return false;
-
-    mods = 0x00;
-    keys.clear();
+    size_t n_mods = 0;
+    for (uint8_t m = out.mods; m; m &= static_cast<uint8_t>(m - 1)) ++n_mods;
+    if (out.n_keys + n_mods > MAX_BINDING_KEYS) return false;
 
-    for (auto& part : parts) {
-        auto mit = modifier_bits.find(part);
-        if (mit != modifier_bits.end()) {
-            mods |= mit->second;
-        } else {
-            auto kit = key_codes.find(part);
-            if (kit == key_codes.end()) return false;
-            keys.push_back(kit->second);
-        }
-    }
+    // Byte [1] mirrors the modifiers and byte [2] the first key; the
+    // mapping slot itself always gets the keyboard-key marker.
+    out.bytes = {0x90, out.mods, out.keys[0], 0x00};
     return true;
 }
 
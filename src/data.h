@@ -14,7 +14,23 @@
 //   [3]: reserved / extra
 using ActionBytes = std::array<uint8_t, 4>;
 
-// Returns the 4-byte action code for a given action name string.
+// Keys plus modifiers in one keyboard binding.  Each is pressed and
+// released (two events of 3 bytes), and the events, their count and a
+// checksum must fit the button's 32-byte macro slot.
+static constexpr size_t MAX_BINDING_KEYS = 5;
+
+// A parsed button action.  `bytes` is what the button's mapping slot
+// gets ({0x92, extra, consumer code, extra} for multimedia keys).  For
+// keyboard keys (bytes[0] == 0x90) `mods` and `keys` hold the whole
+// binding, from which build_button_mapping() writes the key events.
+struct ButtonAction {
+    ActionBytes                           bytes  = {};
+    uint8_t                               mods   = 0;   // modifier bits
+    std::array<uint8_t, MAX_BINDING_KEYS> keys   = {};  // scan codes, in the order given
+    uint8_t                               n_keys = 0;
+};
+
+// Parses an action name string.
 // Supports:
 //   - Mouse buttons: "left", "right", "middle", "forward", "backward"
 //   - DPI controls:  "dpi+", "dpi-", "dpi-cycle"
@@ -23,13 +39,10 @@ using ActionBytes = std::array<uint8_t, 4>;
 //   - Multimedia:    "media_play", "media_next", "media_vol_up", etc.
 //   - Keyboard keys: "a"-"z", "f1"-"f24", "0"-"9", "ctrl_l", "shift_l", etc.
 //   - Combos:        "ctrl_l+c", "ctrl_l+shift_l+z", "a+b+c", etc.
+//                    (at most MAX_BINDING_KEYS keys and modifiers)
 //
 // Returns false if the action string is not recognized.
-bool parse_action(const std::string& action, ActionBytes& out);
-
-// Helper function to parse multi-key combinations for protocol.cpp
-// Returns list of key codes for a multi-key combination like "a+b+c"
-bool parse_multikey(const std::string& action, uint8_t& mods, std::vector<uint8_t>& keys);
+bool parse_action(const std::string& action, ButtonAction& out);
 
 // Print all recognized action names to stdout (for --list-actions)
 void list_actions();
\ No newline at end of file
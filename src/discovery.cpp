@@ -0,0 +1,258 @@
+#include "discovery.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char* SYSFS_USB_DEVICES = "/sys/bus/usb/devices/";
+
+std::string read_attr(const std::string& path) {
+    std::ifstream f(path);
+    std::string v;
+    std::getline(f, v);
+    return v;
+}
+
+// Index of a VID/PID pair in M913_SUPPORTED_IDS, or -1.
+int supported_rank(uint16_t vid, uint16_t pid) {
+    int rank = 0;
+    for (auto& s : M913_SUPPORTED_IDS) {
+        if (s.vid == vid && s.pid == pid) return rank;
+        ++rank;
+    }
+    return -1;
+}
+
+// USB/IP devices hang off the vhci_hcd platform device; otherwise the
+// PID tells a cable from a receiver.  Depends on where the mouse is
+// plugged in, so it is never taken from the cache.
+LinkKind detect_link(const UsbDeviceId& id) {
+    char real[PATH_MAX];
+    std::string dir = SYSFS_USB_DEVICES + id.port_path;
+    if (realpath(dir.c_str(), real) && std::strstr(real, "vhci_hcd"))
+        return LinkKind::UsbIp;
+    if (id.pid == M913_PID_WIRED || id.pid == COMPX_PID_WIRED)
+        return LinkKind::Wired;
+    return LinkKind::Wireless;
+}
+
+LinkKind parse_link(const std::string& s) {
+    if (s == "wired") return LinkKind::Wired;
+    if (s == "usbip") return LinkKind::UsbIp;
+    return LinkKind::Wireless;
+}
+
+// ---- traits cache ----
+//
+// One line per device:
+//   <key> <model> <ctrl value> <interface count> <link> <hello ms> <hello misses>
+// keyed by device_key(), so a mouse keeps its entry when it is re-plugged.
+
+std::map<std::string, DeviceTraits> load_cache(const std::string& path) {
+    std::map<std::string, DeviceTraits> cache;
+    std::ifstream f(path);
+    std::string line;
+    while (std::getline(f, line)) {
+        std::istringstream ls(line);
+        std::string key, model, link;
+        unsigned int ctrl = 0;
+        int ifaces = 0;
+        DeviceTraits t;
+        if (!(ls >> key >> model >> std::hex >> ctrl >> std::dec >> ifaces >> link
+                 >> t.hello_ms >> t.hello_misses))
+            continue;
+        if (ifaces <= 0 || ifaces > 32) continue;
+
+        t.model          = model == "Compx" ? DeviceModel::Compx : DeviceModel::Areson;
+        t.ctrl_value     = static_cast<uint16_t>(ctrl);
+        t.num_interfaces = ifaces;
+        t.link           = parse_link(link);
+        cache[key] = t;
+    }
+    return cache;
+}
+
+// Temporary for rewriting `path`, per process: udev runs for two
+// receivers, the daemon and a CLI run, or fleet workers may rewrite the
+// same file at once (as in write_plan_file()).
+std::string temp_path(const std::string& path) {
+    return path + "." + std::to_string(getpid()) + ".tmp";
+}
+
+// Move a finished temporary into place; the temporary is removed if that
+// fails.  Best-effort, like the caches themselves.
+void replace_file(const std::string& tmp, const std::string& path) {
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+        std::remove(tmp.c_str());
+}
+
+// Rewrite the whole file; written to a temporary and renamed so a
+// concurrent reader never sees half a file.
+void save_cache(const std::string& dir, const std::map<std::string, DeviceTraits>& cache) {
+    std::string path = dir + "/devices";
+    std::string tmp  = temp_path(path);
+    {
+        std::ofstream f(tmp, std::ios::trunc);
+        if (!f) return;
+        for (auto& [key, t] : cache) {
+            f << key << " " << model_name(t.model) << " " << std::hex << std::setw(4)
+              << std::setfill('0') << t.ctrl_value << std::dec << " "
+              << t.num_interfaces << " " << link_name(t.link) << " "
+              << t.hello_ms << " " << t.hello_misses << "\n";
+        }
+        if (!f) {
+            f.close();
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+    replace_file(tmp, path);
+}
+
+}  // namespace
+
+std::string runtime_cache_dir() {
+    const char* rt = std::getenv("XDG_RUNTIME_DIR");
+    if (!rt || !*rt) return "";
+    std::string dir = std::string(rt) + "/m913-ctl";
+    mkdir(dir.c_str(), 0700);
+    return dir;
+}
+
+std::map<std::string, std::string> load_cache_lines(const std::string& path) {
+    std::map<std::string, std::string> lines;
+    std::ifstream f(path);
+    std::string line;
+    while (std::getline(f, line)) {
+        auto sp = line.find(' ');
+        if (sp != std::string::npos) lines[line.substr(0, sp)] = line.substr(sp + 1);
+    }
+    return lines;
+}
+
+void save_cache_lines(const std::string& path, const std::map<std::string, std::string>& lines) {
+    std::string tmp = temp_path(path);
+    {
+        std::ofstream f(tmp, std::ios::trunc);
+        if (!f) return;
+        for (auto& [k, v] : lines)
+            f << k << " " << v << "\n";
+        if (!f) {
+            f.close();
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+    replace_file(tmp, path);
+}
+
+std::string device_key(const UsbDeviceId& id) {
+    std::ostringstream ss;
+    ss << std::hex << std::setfill('0') << std::setw(4) << id.vid << ":"
+       << std::setw(4) << id.pid;
+    std::string key = ss.str();
+    if (!id.serial.empty()) key += "/" + id.serial;
+    else                    key += "@" + id.port_path;
+    std::replace_if(key.begin(), key.end(), [](char c) { return c <= ' '; }, '_');
+    return key;
+}
+
+const char* link_name(LinkKind k) {
+    switch (k) {
+        case LinkKind::Wired: return "wired";
+        case LinkKind::UsbIp: return "usbip";
+        default:              return "wireless";
+    }
+}
+
+std::vector<UsbDeviceId> discover_devices() {
+    std::vector<UsbDeviceId> found;
+    DIR* d = opendir(SYSFS_USB_DEVICES);
+    if (!d) return found;
+
+    // Entries are devices ("1-2.3", named after the port path) and their
+    // interfaces ("1-2.3:1.0"); only devices carry idVendor.
+    while (dirent* e = readdir(d)) {
+        if (e->d_name[0] == '.' || std::strchr(e->d_name, ':')) continue;
+        UsbDeviceId id;
+        if (read_device(e->d_name, id))
+            found.push_back(std::move(id));
+    }
+    closedir(d);
+
+    std::sort(found.begin(), found.end(), [](const UsbDeviceId& a, const UsbDeviceId& b) {
+        int ra = supported_rank(a.vid, a.pid), rb = supported_rank(b.vid, b.pid);
+        if (ra != rb) return ra < rb;
+        return a.port_path < b.port_path;
+    });
+    return found;
+}
+
+bool read_device(const std::string& port_path, UsbDeviceId& out) {
+    std::string dir = SYSFS_USB_DEVICES + port_path;
+    UsbDeviceId id;
+    try {
+        id.vid = static_cast<uint16_t>(std::stoul(read_attr(dir + "/idVendor"), nullptr, 16));
+        id.pid = static_cast<uint16_t>(std::stoul(read_attr(dir + "/idProduct"), nullptr, 16));
+        if (supported_rank(id.vid, id.pid) < 0) return false;
+        id.bus     = static_cast<uint8_t>(std::stoul(read_attr(dir + "/busnum")));
+        id.address = static_cast<uint8_t>(std::stoul(read_attr(dir + "/devnum")));
+    } catch (...) {
+        return false;
+    }
+    id.port_path = port_path;
+    id.serial    = read_attr(dir + "/serial");
+    out = std::move(id);
+    return true;
+}
+
+DeviceTraits lookup_traits(const UsbDeviceId& id) {
+    std::string dir = runtime_cache_dir();
+    std::string key = device_key(id);
+    std::map<std::string, DeviceTraits> cache;
+    if (!dir.empty()) {
+        cache = load_cache(dir + "/devices");
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            it->second.link = detect_link(id);
+            return it->second;
+        }
+    }
+
+    DeviceTraits t;
+    t.model      = model_for_vid(id.vid);
+    t.ctrl_value = ctrl_value_for(t.model);
+    t.link       = detect_link(id);
+    try {
+        t.num_interfaces = std::stoi(
+            read_attr(SYSFS_USB_DEVICES + id.port_path + "/bNumInterfaces"));
+    } catch (...) {
+        return t;  // unknown: let the transport read the descriptors, don't cache
+    }
+
+    if (!dir.empty()) {
+        cache[key] = t;
+        save_cache(dir, cache);
+    }
+    return t;
+}
+
+void store_traits(const UsbDeviceId& id, const DeviceTraits& traits) {
+    std::string dir = runtime_cache_dir();
+    if (dir.empty() || traits.num_interfaces <= 0) return;
+    auto cache = load_cache(dir + "/devices");
+    cache[device_key(id)] = traits;
+    save_cache(dir, cache);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "plan.h"
+#include "transport.h"
+
+// -----------------------------------------------------------------------
+// Device discovery
+//
+// One pass over /sys/bus/usb/devices finds every attached Areson/Compx
+// device with its bus address, port path and serial number, without
+// opening anything or initialising libusb.  Every transport can open the
+// result directly, so startup never walks the bus once per VID/PID.
+//
+// Per-device traits (interface count, SET_REPORT type, button layout, and
+// what earlier runs learned about its hello packet) are kept in
+// $XDG_RUNTIME_DIR/m913-ctl/devices so later runs can skip descriptor
+// probing.  The file lives on tmpfs and is dropped at logout.
+// -----------------------------------------------------------------------
+
+// How the mouse reaches the host.  Decides whether a hello packet can
+// arrive after open and how long it may take.
+enum class LinkKind : uint8_t {
+    Wired,     // cable (wired PIDs): never sends a hello
+    Wireless,  // 2.4G receiver
+    UsbIp,     // any of the above behind a USB/IP virtual host controller
+};
+
+const char* link_name(LinkKind k);
+
+// What a transport needs to know about a device before talking to it.
+struct DeviceTraits {
+    DeviceModel model          = DeviceModel::Areson;  // selects the button layout
+    uint16_t    ctrl_value     = CTRL_VALUE;           // SET_REPORT wValue
+    int         num_interfaces = 0;                    // 0 = unknown, probe descriptors
+    LinkKind    link           = LinkKind::Wireless;
+
+    // Learned from earlier runs (see drain_hello()).
+    int hello_ms     = -1;  // open → hello latency last time one came, -1 = never seen
+    int hello_misses = 0;   // consecutive runs that waited and saw none
+};
+
+// Every attached supported device, most preferred VID/PID first (in
+// M913_SUPPORTED_IDS order), then by port path.
+std::vector<UsbDeviceId> discover_devices();
+
+// Read one device by its sysfs name (the port path, e.g. "1-2.3").
+// Returns false if it is gone or not a supported VID/PID.
+bool read_device(const std::string& port_path, UsbDeviceId& out);
+
+// Traits for a discovered device: from the runtime cache when present,
+// otherwise derived from its VID and sysfs attributes and cached.
+DeviceTraits lookup_traits(const UsbDeviceId& id);
+
+// Write updated (learned) traits back to the runtime cache.
+void store_traits(const UsbDeviceId& id, const DeviceTraits& traits);
+
+// $XDG_RUNTIME_DIR/m913-ctl, created on demand; "" without XDG_RUNTIME_DIR.
+std::string runtime_cache_dir();
+
+// Runtime cache files keyed per device: one "<key> <value>" line each.
+// A missing file reads as empty.  Saving rewrites the whole file through
+// a temporary and a rename, so a concurrent reader never sees half of it.
+std::map<std::string, std::string> load_cache_lines(const std::string& path);
+void save_cache_lines(const std::string& path, const std::map<std::string, std::string>& lines);
+
+// Stable name for a device across re-plugs: vid:pid plus the serial
+// number, or plus the port path for devices without one.  No whitespace.
+std::string device_key(const UsbDeviceId& id);
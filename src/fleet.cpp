@@ -0,0 +1,182 @@
+#include "fleet.h"
+#include "discovery.h"
+#include "hello.h"
+
+#ifdef M913_HAVE_LIBUSB
+#include "usb.h"
+#else
+#include "usbfs.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+#ifdef M913_HAVE_LIBUSB
+using FleetMouse = UsbMouse;
+#else
+using FleetMouse = UsbfsMouse;
+#endif
+
+struct FleetResult {
+    bool        ok      = false;
+    int         packets = 0;
+    int         acked   = 0;
+    double      ms      = 0;  // open → commit ACK
+    std::string error;
+};
+
+double ms_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+// Open one device, stream its plan and record the outcome.
+// Each worker owns its FleetMouse (and so, with libusb, its own context).
+void apply_one(const UsbDeviceId& id, const DeviceTraits& traits, const PacketPlan& plan,
+               const SendOptions& send, FleetResult& res) {
+    auto t0 = Clock::now();
+    try {
+        FleetMouse mouse;
+        mouse.open_device(id, ClaimScope::Config, traits.num_interfaces);
+        mouse.set_ctrl_value(traits.ctrl_value);
+
+        // Drain any spontaneous init/hello packet from the wireless device.
+        // What is learned here is not stored: workers would race on the cache.
+        DeviceTraits learned = traits;
+        uint8_t init_buf[64];
+        drain_hello(mouse, learned, init_buf, sizeof(init_buf));
+
+        SendStats st;
+        send_plan(mouse, plan, send, &st);
+        res.packets = st.packets;
+        res.acked   = st.acked;
+        res.ok      = (st.acked == st.packets);
+        if (!res.ok) res.error = "missing ACKs";
+        mouse.close();
+    } catch (const std::exception& e) {
+        res.error = e.what();
+    }
+    res.ms = ms_since(t0);
+}
+
+std::string id_hex(const UsbDeviceId& id) {
+    std::ostringstream ss;
+    ss << std::hex << std::setfill('0') << std::setw(4) << id.vid << ":"
+       << std::setw(4) << id.pid;
+    return ss.str();
+}
+
+}  // namespace
+
+int run_fleet(const std::map<DeviceModel, PacketPlan>& plans, const FleetOptions& opts) {
+    std::vector<UsbDeviceId>  ids;
+    std::vector<DeviceTraits> traits;
+    // Devices the settings do not suit (no plan for their hardware) stay
+    // in the list and are reported as failed.
+    for (auto& id : discover_devices()) {
+        ids.push_back(id);
+        traits.push_back(lookup_traits(id));
+    }
+    if (ids.empty()) {
+        std::cerr << "No supported M913 devices found.\n";
+        return 1;
+    }
+
+    SendOptions send = opts.send;
+    send.verbose = false;
+
+    std::vector<FleetResult> results(ids.size());
+    std::vector<bool>        started(ids.size(), false);
+    std::map<uint8_t, int>   bus_active;
+    size_t                   unstarted = ids.size();
+    std::mutex               m;
+    std::condition_variable  cv;
+
+    // Each worker takes the next device whose bus is below the per-bus cap.
+    auto worker = [&] {
+        for (;;) {
+            size_t idx = 0;
+            {
+                std::unique_lock<std::mutex> lk(m);
+                bool found = false;
+                cv.wait(lk, [&] {
+                    if (unstarted == 0) return true;
+                    for (size_t i = 0; i < ids.size(); ++i) {
+                        if (!started[i] && bus_active[ids[i].bus] < opts.per_bus) {
+                            idx = i;
+                            found = true;
+                            return true;
+                        }
+                    }
+                    return false;
+                });
+                if (!found) return;
+                started[idx] = true;
+                --unstarted;
+                ++bus_active[ids[idx].bus];
+            }
+
+            // No plan: failed without opening the device.
+            auto plan = plans.find(traits[idx].model);
+            if (plan != plans.end())
+                apply_one(ids[idx], traits[idx], plan->second, send, results[idx]);
+            else
+                results[idx].error = std::string("settings not supported on ") +
+                                     model_name(traits[idx].model) + " hardware";
+
+            {
+                std::lock_guard<std::mutex> lk(m);
+                --bus_active[ids[idx].bus];
+            }
+            cv.notify_all();
+        }
+    };
+
+    std::cout << "=== Applying to " << ids.size() << " device(s), "
+              << opts.jobs << " worker(s), at most " << opts.per_bus << " per bus ===\n";
+    auto t0 = Clock::now();
+    std::vector<std::thread> pool;
+    int n_threads = std::min<int>(opts.jobs, static_cast<int>(ids.size()));
+    for (int i = 0; i < n_threads; ++i)
+        pool.emplace_back(worker);
+    for (auto& t : pool)
+        t.join();
+    double total_ms = ms_since(t0);
+
+    // ---- per-device table ----
+    int failed = 0;
+    std::cout << "\n" << std::left
+              << std::setw(14) << "DEVICE" << std::setw(5) << "BUS"
+              << std::setw(11) << "ID" << std::setw(8) << "MODEL"
+              << std::setw(8) << "RESULT" << std::setw(9) << "ACKED" << "TIME\n";
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const auto& id = ids[i];
+        const auto& r  = results[i];
+        if (!r.ok) ++failed;
+        std::cout << std::left
+                  << std::setw(14) << id.port_path
+                  << std::setw(5)  << static_cast<int>(id.bus)
+                  << std::setw(11) << id_hex(id)
+                  << std::setw(8)  << model_name(traits[i].model)
+                  << std::setw(8)  << (r.ok ? "ok" : "FAILED")
+                  << std::setw(9)  << (std::to_string(r.acked) + "/" + std::to_string(r.packets))
+                  << std::right << std::fixed << std::setprecision(0) << r.ms << " ms";
+        if (!r.error.empty())
+            std::cout << "  (" << r.error << ")";
+        std::cout << "\n";
+    }
+    std::cout << "\n" << (ids.size() - failed) << " ok, " << failed << " failed in "
+              << total_ms << " ms.\n";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+    return failed;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <map>
+
+#include "apply.h"
+#include "plan.h"
+
+// Options for run_fleet().
+struct FleetOptions {
+    int         jobs    = 8;  // worker threads
+    int         per_bus = 4;  // devices configured at once on one USB bus
+    SendOptions send;         // pacing per device; output is always quiet
+};
+
+// Apply a plan to every attached M913 concurrently.
+//
+// All supported devices are discovered in one sysfs pass; each one is
+// opened by its bus address and receives the plan for its hardware revision
+// (Compx devices get the COMPX_LAYOUT button mapping and the 0x0208
+// SET_REPORT type).  Devices whose revision has no entry in `plans` are
+// not opened and are listed as failed.
+//
+// Prints a per-device success/latency table and returns the number of
+// devices that failed.
+int run_fleet(const std::map<DeviceModel, PacketPlan>& plans, const FleetOptions& opts);
@@ -0,0 +1,36 @@
+#include "hello.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Wait caps while a device's hello latency is unknown.  USB/IP adds a
+// network round trip to every interrupt transfer.
+static constexpr unsigned int HELLO_CAP_WIRELESS_MS = 800;
+static constexpr unsigned int HELLO_CAP_USBIP_MS    = 1500;
+static constexpr unsigned int HELLO_MARGIN_MS       = 50;
+
+unsigned int hello_wait_ms(const DeviceTraits& t) {
+    if (t.link == LinkKind::Wired) return 0;
+    if (t.hello_misses >= HELLO_MISS_LIMIT) return 0;
+
+    unsigned int cap = (t.link == LinkKind::UsbIp) ? HELLO_CAP_USBIP_MS : HELLO_CAP_WIRELESS_MS;
+    if (t.hello_ms < 0) return cap;
+    return std::min(cap, 2 * static_cast<unsigned int>(t.hello_ms) + HELLO_MARGIN_MS);
+}
+
+int drain_hello(Transport& mouse, DeviceTraits& traits, uint8_t* buf, int buf_size) {
+    auto t0 = std::chrono::steady_clock::now();
+    unsigned int wait = hello_wait_ms(traits);
+    int got = mouse.try_recv(buf, buf_size, INTERRUPT_EP_IN, wait);
+
+    if (got > 0) {
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - t0).count();
+        traits.hello_ms     = static_cast<int>(std::ceil(ms));
+        traits.hello_misses = 0;
+    } else if (wait > 0) {
+        ++traits.hello_misses;
+    }
+    return got;
+}
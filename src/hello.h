@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#include "discovery.h"
+#include "transport.h"
+
+// -----------------------------------------------------------------------
+// Hello drain
+//
+// A wireless receiver may send a spontaneous report on EP 0x82 right after
+// it is opened.  It has to be consumed before the first config write, or
+// it would be taken for that write's ACK.  Rather than a fixed 800 ms
+// wait, the wait follows the link kind and what earlier runs of the same
+// device saw:
+//
+//   wired               no wait; only a report already buffered is taken
+//   wireless, USB/IP    until the hello arrives, at most twice the learned
+//                       latency (plus a margin), or the link's cap while
+//                       nothing has been learned; no wait once
+//                       HELLO_MISS_LIMIT runs in a row saw none
+//
+// The wait is event-driven (the interrupt-IN transfer is already queued),
+// so it ends the moment the report lands.
+// -----------------------------------------------------------------------
+
+// Runs without a hello after which a device is assumed never to send one.
+static constexpr int HELLO_MISS_LIMIT = 3;
+
+// Upper bound on the hello wait for a device, in milliseconds.
+unsigned int hello_wait_ms(const DeviceTraits& traits);
+
+// Consume a pending hello from EP 0x82 into buf.  Updates the learned
+// fields of `traits` (the caller persists them with store_traits()) and
+// returns the number of bytes received, 0 if no hello came.
+int drain_hello(Transport& mouse, DeviceTraits& traits, uint8_t* buf, int buf_size);
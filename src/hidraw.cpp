@@ -0,0 +1,148 @@
+#include "hidraw.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// A hidraw node and the USB interface it belongs to.
+struct HidrawNode {
+    std::string devnode;  // /dev/hidrawN
+    std::string port_path;  // name of the USB device's sysfs directory, e.g. "1-2.3"
+    int         iface = -1;
+};
+
+std::string parent_dir(const std::string& path) {
+    auto slash = path.find_last_of('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash);
+}
+
+// Walk /sys/class/hidraw once.  Each node's device link resolves to
+//   .../<usb device>/<usb device>:<config>.<iface>/<hid device>
+// so the interface number and the USB device's port path are two and
+// three levels up.
+std::vector<HidrawNode> scan_hidraw_nodes() {
+    std::vector<HidrawNode> nodes;
+    DIR* d = opendir("/sys/class/hidraw");
+    if (!d) return nodes;
+
+    while (dirent* e = readdir(d)) {
+        if (std::strncmp(e->d_name, "hidraw", 6) != 0) continue;
+
+        std::string link = std::string("/sys/class/hidraw/") + e->d_name + "/device";
+        char real[PATH_MAX];
+        if (!realpath(link.c_str(), real)) continue;
+
+        std::string iface_dir = parent_dir(real);
+        std::string usb_dir   = parent_dir(iface_dir);
+        auto dot = iface_dir.find_last_of('.');
+        auto colon = iface_dir.find_last_of(':');
+        if (dot == std::string::npos || colon == std::string::npos || dot < colon) continue;
+
+        HidrawNode n;
+        n.devnode = std::string("/dev/") + e->d_name;
+        n.port_path = usb_dir.substr(usb_dir.find_last_of('/') + 1);
+        try {
+            n.iface = std::stoi(iface_dir.substr(dot + 1));
+        } catch (...) {
+            continue;
+        }
+        nodes.push_back(std::move(n));
+    }
+    closedir(d);
+    return nodes;
+}
+
+}  // namespace
+
+HidrawMouse::~HidrawMouse() {
+    close();
+}
+
+bool HidrawMouse::open_device(const UsbDeviceId& id) {
+    auto nodes = scan_hidraw_nodes();
+
+    for (auto& cfg_node : nodes) {
+        if (cfg_node.port_path != id.port_path || cfg_node.iface != 1) continue;
+        int fd = ::open(cfg_node.devnode.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) return false;  // no permission
+
+        _fds[INTERRUPT_EP_IN] = fd;
+        // The pointer interface is optional; it only serves reads on EP 0x81.
+        for (auto& n : nodes) {
+            if (n.port_path == id.port_path && n.iface == 0) {
+                int fd0 = ::open(n.devnode.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd0 >= 0) _fds[INTERRUPT_EP_MOUSE] = fd0;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+void HidrawMouse::close() {
+    for (auto& [ep, fd] : _fds)
+        ::close(fd);
+    _fds.clear();
+}
+
+void HidrawMouse::send(const uint8_t data[M913_PACKET_SIZE]) {
+    auto it = _fds.find(INTERRUPT_EP_IN);
+    if (it == _fds.end())
+        throw std::runtime_error("hidraw send: device is not open");
+
+    // byte[0] of every config packet is the report ID (0x08), which is what
+    // hidraw expects as the first byte of the buffer.
+    uint8_t buf[M913_PACKET_SIZE];
+    std::memcpy(buf, data, M913_PACKET_SIZE);
+
+    int r;
+    if ((_ctrl_value >> 8) == 0x03)
+        r = ioctl(it->second, HIDIOCSFEATURE(M913_PACKET_SIZE), buf);
+    else
+        r = static_cast<int>(::write(it->second, buf, M913_PACKET_SIZE));
+
+    if (r < 0) {
+        throw std::runtime_error(
+            std::string("hidraw send failed: ") + std::strerror(errno));
+    }
+}
+
+int HidrawMouse::try_recv(uint8_t* buf, int buf_size, uint8_t endpoint,
+                          unsigned int timeout_ms) {
+    auto it = _fds.find(endpoint);
+    if (it == _fds.end()) return 0;
+
+    pollfd pfd{it->second, POLLIN, 0};
+    int r = ::poll(&pfd, 1, static_cast<int>(timeout_ms));
+    if (r < 0 && errno != EINTR)
+        throw std::runtime_error(std::string("hidraw poll failed: ") + std::strerror(errno));
+    if (r <= 0) return 0;
+
+    ssize_t n = ::read(it->second, buf, static_cast<size_t>(buf_size));
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR) return 0;
+        throw std::runtime_error(std::string("hidraw read failed: ") + std::strerror(errno));
+    }
+    return static_cast<int>(n);
+}
+
+bool HidrawMouse::poll_events(unsigned int timeout_ms) {
+    std::vector<pollfd> pfds;
+    for (auto& [ep, fd] : _fds)
+        pfds.push_back({fd, POLLIN, 0});
+    if (pfds.empty()) return false;
+    return ::poll(pfds.data(), pfds.size(), static_cast<int>(timeout_ms)) > 0;
+}
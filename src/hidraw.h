@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "transport.h"
+
+// -----------------------------------------------------------------------
+// hidraw transport
+//
+// Sends the same 17-byte SET_REPORT packets through /dev/hidrawN instead of
+// claiming the USB interfaces, so the kernel HID driver stays bound and the
+// mouse keeps moving while it is configured (and nothing has to be
+// reattached afterwards).
+//
+//   Areson (ctrl value 0x0308): HIDIOCSFEATURE on the interface-1 node
+//   Compx  (ctrl value 0x0208): write() of an output report
+//
+// ACKs are read from the interface-1 node.  Reads on EP 0x81 come from the
+// interface-0 node when it can be opened.  The kernel buffers input reports
+// from the moment a node is opened, the same role the permanently queued
+// transfers play in the libusb backend.
+// -----------------------------------------------------------------------
+class HidrawMouse : public Transport {
+public:
+    HidrawMouse() = default;
+    ~HidrawMouse() override;
+
+    // Non-copyable
+    HidrawMouse(const HidrawMouse&) = delete;
+    HidrawMouse& operator=(const HidrawMouse&) = delete;
+
+    const char* name() const override { return "hidraw"; }
+
+    // Open the config-interface hidraw node of a device returned by
+    // discover_devices().  Returns false — without throwing — if it has no
+    // node the caller may open read/write, so the caller can fall back to a
+    // USB-level backend.
+    bool open_device(const UsbDeviceId& id);
+
+    void close() override;
+    bool is_open() const override { return !_fds.empty(); }
+    void set_ctrl_value(uint16_t v) override { _ctrl_value = v; }
+
+    void send(const uint8_t data[M913_PACKET_SIZE]) override;
+    int  try_recv(uint8_t* buf, int buf_size, uint8_t endpoint = INTERRUPT_EP_IN,
+                  unsigned int timeout_ms = 500) override;
+    bool poll_events(unsigned int timeout_ms) override;
+
+private:
+    std::map<uint8_t, int> _fds;  // endpoint → open hidraw fd
+    uint16_t               _ctrl_value = CTRL_VALUE;
+};
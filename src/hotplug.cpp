@@ -0,0 +1,180 @@
+#include "hotplug.h"
+#include "hello.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+double ms_between(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+// Kernel uevents: "ACTION@DEVPATH\0KEY=VALUE\0KEY=VALUE\0...".
+std::map<std::string, std::string> parse_uevent(const char* buf, size_t len) {
+    std::map<std::string, std::string> props;
+    size_t i = 0;
+    while (i < len) {
+        size_t n = strnlen(buf + i, len - i);
+        std::string kv(buf + i, n);
+        auto eq = kv.find('=');
+        if (eq != std::string::npos)
+            props[kv.substr(0, eq)] = kv.substr(eq + 1);
+        i += n + 1;
+    }
+    return props;
+}
+
+int open_uevent_socket() {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        throw std::runtime_error(std::string("uevent socket: ") + std::strerror(errno));
+    sockaddr_nl addr{};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;  // kernel events (udev rebroadcasts on group 2)
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        std::string err = std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("uevent socket: " + err);
+    }
+    return fd;
+}
+
+// PRODUCT=<vid>/<pid>/<bcdDevice> in hex without leading zeros.
+bool product_supported(const std::string& product) {
+    unsigned int vid = 0, pid = 0;
+    if (std::sscanf(product.c_str(), "%x/%x", &vid, &pid) != 2) return false;
+    for (auto& s : M913_SUPPORTED_IDS)
+        if (s.vid == vid && s.pid == pid) return true;
+    return false;
+}
+
+std::string device_label(const UsbDeviceId& id, DeviceModel model) {
+    std::ostringstream ss;
+    ss << "[" << id.port_path << "] " << std::hex << std::setfill('0') << std::setw(4)
+       << id.vid << ":" << std::setw(4) << id.pid << std::dec << " " << model_name(model);
+    return ss.str();
+}
+
+// Open the new device (retrying until udev has set it up), stream its plan
+// and print the outcome.
+void apply_arrival(const UsbDeviceId& id, Clock::time_point t_plug, const PacketPlan& plan,
+                   const DeviceOpener& open, const HotplugOptions& opts,
+                   const volatile bool& stop) {
+    DeviceTraits traits = lookup_traits(id);
+    std::string  label  = device_label(id, traits.model);
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1) << label << ": ";
+
+    std::unique_ptr<Transport> mouse;
+    std::string error;
+    auto settle = t_plug + std::chrono::milliseconds(opts.settle_ms);
+    while (!(mouse = open(id, traits, error)) && !stop && Clock::now() < settle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(25));
+    if (!mouse) {
+        line << "FAILED to open (" << error << ") after "
+             << ms_between(t_plug, Clock::now()) << " ms\n";
+        std::cout << line.str() << std::flush;
+        return;
+    }
+    auto t_open = Clock::now();
+
+    RttEstimator rtt;
+    std::string  rtt_key = device_key(id) + "/" + mouse->name();
+    try {
+        mouse->set_ctrl_value(traits.ctrl_value);
+        uint8_t init_buf[64];
+        drain_hello(*mouse, traits, init_buf, sizeof(init_buf));
+        if (traits.link != LinkKind::Wired)
+            store_traits(id, traits);
+        auto t_hello = Clock::now();
+
+        rtt.load(rtt_key);
+        SendOptions send = opts.send;
+        send.verbose = false;
+        send.rtt     = &rtt;
+
+        // A receiver often comes back before its mouse has woken up.
+        PlanPosition first;
+        const Packet* probe = plan_packet(plan, first);
+        if (probe && traits.link != LinkKind::Wired &&
+            !probe_link(*mouse, *probe, rtt.known() ? 2 * rtt.deadline_ms() : ACK_TIMEOUT_MS))
+            throw std::runtime_error("the mouse does not answer — is it asleep or out of range?");
+
+        SendStats st;
+        send_plan(*mouse, plan, send, &st);
+        auto t_commit = Clock::now();
+
+        line << st.acked << "/" << st.packets << " acked, plug->commit "
+             << ms_between(t_plug, t_commit) << " ms (open " << ms_between(t_plug, t_open)
+             << ", hello " << ms_between(t_open, t_hello) << ", send "
+             << ms_between(t_hello, t_commit) << ")\n";
+    } catch (const std::exception& e) {
+        line << "FAILED (" << e.what() << ") after "
+             << ms_between(t_plug, Clock::now()) << " ms\n";
+    }
+    rtt.save(rtt_key);
+    mouse->close();
+    std::cout << line.str() << std::flush;
+}
+
+}  // namespace
+
+void run_hotplug(const std::map<DeviceModel, PacketPlan>& plans, const DeviceOpener& open,
+                 const HotplugOptions& opts, const volatile bool& stop) {
+    int fd = open_uevent_socket();
+
+    std::cout << "Watching for M913 devices (Ctrl+C to stop). Plans:";
+    const char* sep = " ";
+    for (auto& [model, plan] : plans) {
+        std::cout << sep << model_name(model) << " " << plan_packet_count(plan) << " packets";
+        sep = ", ";
+    }
+    std::cout << ".\n" << std::flush;
+
+    char buf[8192];
+    while (!stop) {
+        pollfd pfd{fd, POLLIN, 0};
+        // Wake up now and then to notice `stop`.
+        if (poll(&pfd, 1, 500) <= 0) continue;
+
+        sockaddr_nl src{};
+        socklen_t   src_len = sizeof(src);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&src), &src_len);
+        auto t_plug = Clock::now();
+        if (n <= 0 || src.nl_pid != 0) continue;  // only trust the kernel
+
+        auto ev = parse_uevent(buf, static_cast<size_t>(n));
+        if (ev["SUBSYSTEM"] != "usb" || ev["DEVTYPE"] != "usb_device" ||
+            !product_supported(ev["PRODUCT"]))
+            continue;
+
+        const std::string& devpath = ev["DEVPATH"];
+        std::string port_path = devpath.substr(devpath.rfind('/') + 1);
+        if (ev["ACTION"] == "remove") {
+            std::cout << "[" << port_path << "] removed\n" << std::flush;
+            continue;
+        }
+        if (ev["ACTION"] != "add") continue;
+
+        UsbDeviceId id;
+        if (!read_device(port_path, id)) continue;  // already gone again
+        auto it = plans.find(model_for_vid(id.vid));
+        if (it == plans.end()) continue;
+        apply_arrival(id, t_plug, it->second, open, opts, stop);
+    }
+    ::close(fd);
+}
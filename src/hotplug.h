@@ -0,0 +1,47 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "apply.h"
+#include "discovery.h"
+#include "plan.h"
+#include "transport.h"
+
+// -----------------------------------------------------------------------
+// Hotplug auto-apply
+//
+// Listens for USB device arrivals and applies a stored configuration to
+// every supported device that appears: a receiver plugged back in, or a
+// tri-mode mouse switched to its cable.  Plans are built once at startup,
+// one per hardware revision, so an arrival costs only the open, the hello
+// drain and the writes.
+//
+// Arrivals are read from the kernel's uevent netlink socket -- the same
+// source libusb's hotplug support uses on Linux -- so the mode also works
+// in builds without libusb.
+// -----------------------------------------------------------------------
+
+// Opens a device for config writes.  Returns nullptr and sets `error` if
+// it cannot be opened (yet).
+using DeviceOpener = std::function<std::unique_ptr<Transport>(
+    const UsbDeviceId& id, const DeviceTraits& traits, std::string& error)>;
+
+// Options for run_hotplug().
+struct HotplugOptions {
+    SendOptions  send;  // pacing per device; output is always quiet
+    // How long to keep retrying the open after an arrival: the device node
+    // gets its permissions, and the hidraw node appears, only once udev has
+    // processed the same event.
+    unsigned int settle_ms = 3000;
+};
+
+// Apply plans[model] to each supported device that arrives until `stop` is
+// set.  Prints one line per arrival with the outcome and the plug→commit
+// time (event received → commit acknowledged), split into open, hello
+// drain and send.  Devices whose revision has no plan are skipped.
+// Throws std::runtime_error if the uevent socket cannot be opened.
+void run_hotplug(const std::map<DeviceModel, PacketPlan>& plans, const DeviceOpener& open,
+                 const HotplugOptions& opts, const volatile bool& stop);
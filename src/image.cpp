@@ -0,0 +1,100 @@
+#include "image.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+static constexpr uint8_t CMD_WRITE = 0x07;
+
+void ConfigImage::write(uint16_t addr, const uint8_t* data, size_t len,
+                        const std::string& heading) {
+    if (len == 0) return;
+    if (addr >= SIZE || len > static_cast<size_t>(SIZE - addr)) {
+        char msg[64];
+        std::snprintf(msg, sizeof(msg), "config write 0x%03x+%zu is outside the image",
+                      addr, len);
+        throw std::runtime_error(msg);
+    }
+
+    auto h = std::find(_headings.begin(), _headings.end(), heading);
+    if (h == _headings.end()) h = _headings.insert(_headings.end(), heading);
+    uint8_t section = static_cast<uint8_t>(h - _headings.begin());
+
+    uint32_t seq = _next_seq++;
+    for (size_t i = 0; i < len; ++i) {
+        _bytes[addr + i] = data[i];
+        if (_first[addr + i] == 0) {
+            _first[addr + i]   = seq;
+            _section[addr + i] = section;
+        }
+    }
+}
+
+void ConfigImage::write_packet(const Packet& p, const std::string& heading) {
+    if (p[0] != 0x08 || p[1] != CMD_WRITE)
+        throw std::runtime_error("not a config write packet");
+    size_t len = p[5];
+    if (len > M913_PACKET_SIZE - 7)  // payload is bytes 6..15
+        throw std::runtime_error("config write packet with bad length");
+    write(static_cast<uint16_t>((p[3] << 8) | p[4]), p.data() + 6, len, heading);
+}
+
+void ConfigImage::write_packets(const Packet* packets, size_t count, const std::string& heading) {
+    for (size_t i = 0; i < count; ++i)
+        write_packet(packets[i], heading);
+}
+
+// -----------------------------------------------------------------------
+// Planner
+// -----------------------------------------------------------------------
+
+PacketPlan plan_writes(const ConfigImage& image) {
+    struct Run {
+        uint16_t addr, len;
+        uint32_t first;  // earliest write to any byte of the run
+    };
+    std::vector<Run> runs;
+    for (uint16_t a = 0; a < ConfigImage::SIZE;) {
+        if (image._first[a] == 0) { ++a; continue; }
+        Run r{a, 0, image._first[a]};
+        // A write never crosses from the low block into the macros, nor
+        // from one button's macro slot into the next.
+        uint16_t end = a < 0x100 ? 0x100 : static_cast<uint16_t>((a & ~0x1f) + 0x20);
+        while (a < end && image._first[a] != 0) {
+            r.first = std::min(r.first, image._first[a]);
+            ++a;
+            ++r.len;
+        }
+        runs.push_back(r);
+    }
+    std::stable_sort(runs.begin(), runs.end(),
+                     [](const Run& x, const Run& y) { return x.first < y.first; });
+
+    PacketPlan plan;
+    for (auto& r : runs) {
+        // The heading of the byte written first.
+        uint16_t lead = r.addr;
+        for (uint16_t a = r.addr; a < r.addr + r.len; ++a)
+            if (image._first[a] < image._first[lead]) lead = a;
+        const std::string& heading = image._headings[image._section[lead]];
+        if (plan.empty() || plan.back().heading != heading)
+            plan.push_back({heading, {}});
+
+        size_t max = r.addr < 0x100 ? MAX_WRITE_LOW : MAX_WRITE_MACRO;
+        for (uint16_t off = 0; off < r.len;) {
+            uint16_t a = static_cast<uint16_t>(r.addr + off);
+            uint8_t  n = static_cast<uint8_t>(std::min<size_t>(max, r.len - off));
+            Packet p{};
+            p[0] = 0x08;
+            p[1] = CMD_WRITE;
+            p[3] = static_cast<uint8_t>(a >> 8);
+            p[4] = static_cast<uint8_t>(a & 0xFF);
+            p[5] = n;
+            std::copy_n(image._bytes.begin() + a, n, p.begin() + 6);
+            p[16] = compute_checksum(p);
+            plan.back().packets.push_back(p);
+            off = static_cast<uint16_t>(off + n);
+        }
+    }
+    return plan;
+}
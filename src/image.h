@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "plan.h"
+#include "protocol.h"
+
+// -----------------------------------------------------------------------
+// Config image
+//
+// Config writes (08 07 00 <hi> <lo> <len> <data...>) are plain memory
+// writes into one small address space per profile:
+//
+//   Address      | Contents
+//   -------------|-----------------------------------------------------
+//   0x000-0x001  | polling rate
+//   0x002-0x003  | active DPI stage count
+//   0x00c-0x01f  | DPI slots (Areson 4 bytes per slot, Compx likewise)
+//   0x02c-0x03f  | Areson: unknown block sent with DPI; Compx: slot colors
+//   0x054-0x05d  | LED mode, color, brightness / speed
+//   0x060-0x09f  | button mapping, 4 bytes per button
+//   0x100-0x2ff  | keyboard-key macros, 0x20 per button
+//
+// Builders still produce packets; ConfigImage replays them into a byte
+// image, so the final contents are exactly what sending them in order
+// would have left in the mouse.  plan_writes() then emits each written
+// range once, in as few packets as the write length allows.  Inner
+// checksums are ordinary data bytes and come along unchanged.
+// -----------------------------------------------------------------------
+
+class ConfigImage {
+public:
+    static constexpr uint16_t SIZE = 0x300;
+
+    // Write `len` bytes at `addr`, listed under `heading` in the plan if
+    // this is the first write to any of them.  Throws std::runtime_error
+    // if the range is outside the image.
+    void write(uint16_t addr, const uint8_t* data, size_t len, const std::string& heading);
+
+    // Replay config writes (sub-command 0x07).  Throws std::runtime_error
+    // on any other packet.
+    void write_packet(const Packet& p, const std::string& heading);
+    void write_packets(const Packet* packets, size_t count, const std::string& heading);
+    void write_packets(const std::vector<Packet>& packets, const std::string& heading) {
+        write_packets(packets.data(), packets.size(), heading);
+    }
+    void write_packets(const PacketBatch& batch, const std::string& heading) {
+        write_packets(batch.data(), batch.size(), heading);
+    }
+
+    bool empty() const { return _next_seq == 1; }
+
+private:
+    friend PacketPlan plan_writes(const ConfigImage& image);
+
+    std::array<uint8_t, SIZE>  _bytes{};
+    std::array<uint32_t, SIZE> _first{};    // sequence of first write, 0 = unwritten
+    std::array<uint8_t, SIZE>  _section{};  // index into _headings
+    std::vector<std::string>   _headings;
+    uint32_t                   _next_seq = 1;
+};
+
+// Longest payload of one write.  The vendor software never writes more
+// than 8 bytes below 0x100 and splits key macros at 10; the planner keeps
+// to the same limits.
+static constexpr size_t MAX_WRITE_LOW   = 8;
+static constexpr size_t MAX_WRITE_MACRO = 10;
+
+// The smallest ordered set of writes that leaves the mouse holding
+// `image`: every maximal run of written bytes, split at the write limits.
+// Runs go out in the order they were first written (key macros before the
+// mapping that refers to them, as the builders emit them), grouped into
+// sections under the heading of their first write.  No commit is added.
+PacketPlan plan_writes(const ConfigImage& image);
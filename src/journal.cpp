@@ -0,0 +1,110 @@
+#include "journal.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "discovery.h"
+
+static std::string journal_path() {
+    std::string dir = runtime_cache_dir();
+    return dir.empty() ? "" : dir + "/journal";
+}
+
+// ---- persistence ----
+//
+// One line per device: <key> <acked> <packet>... with each packet as 34
+// hex digits.
+
+bool ApplyJournal::load(const std::string& key) {
+    _key = key;
+    _packets.clear();
+    _acked.clear();
+    _prefix = 0;
+    _saved  = 0;
+
+    std::string path = journal_path();
+    if (path.empty()) return false;
+    auto lines = load_cache_lines(path);
+    auto it = lines.find(key);
+    if (it == lines.end()) return false;
+
+    std::istringstream ls(it->second);
+    size_t acked = 0;
+    std::string hex;
+    Packet p;
+    if (!(ls >> acked)) return false;
+    while (ls >> hex) {
+        // A damaged entry cannot be resumed from.
+        if (!packet_from_hex(hex, p)) {
+            _packets.clear();
+            return false;
+        }
+        _packets.push_back(p);
+    }
+    if (_packets.empty()) return false;
+    _prefix = std::min(acked, _packets.size());
+    _saved  = _prefix;
+    _acked.assign(_packets.size(), false);
+    for (size_t i = 0; i < _prefix; ++i) _acked[i] = true;
+    return true;
+}
+
+void ApplyJournal::save() {
+    _saved = _prefix;
+    std::string path = journal_path();
+    if (path.empty() || _key.empty()) return;
+    auto lines = load_cache_lines(path);
+    std::string v = std::to_string(_prefix);
+    for (auto& p : _packets) {
+        v += ' ';
+        v += packet_hex(p);
+    }
+    lines[_key] = v;
+    save_cache_lines(path, lines);
+}
+
+bool ApplyJournal::matches(const PacketPlan& plan) const {
+    size_t i = 0;
+    for (auto& section : plan)
+        for (auto& p : section.packets)
+            if (i >= _packets.size() || _packets[i++] != p) return false;
+    return i == _packets.size();
+}
+
+void ApplyJournal::begin(const std::string& key, const PacketPlan& plan, size_t acked) {
+    _key = key;
+    _packets.clear();
+    for (auto& section : plan)
+        _packets.insert(_packets.end(), section.packets.begin(), section.packets.end());
+    _prefix = std::min(acked, _packets.size());
+    _acked.assign(_packets.size(), false);
+    for (size_t i = 0; i < _prefix; ++i) _acked[i] = true;
+    save();
+}
+
+void ApplyJournal::ack(const Packet& p) {
+    for (size_t i = _prefix; i < _packets.size(); ++i) {
+        if (_acked[i] || _packets[i] != p) continue;
+        _acked[i] = true;
+        if (i != _prefix) return;
+        while (_prefix < _packets.size() && _acked[_prefix]) ++_prefix;
+        if (_prefix - _saved >= JOURNAL_SAVE_EVERY) save();
+        return;
+    }
+}
+
+void ApplyJournal::flush() {
+    if (_prefix != _saved) save();
+}
+
+void ApplyJournal::finish() {
+    std::string path = journal_path();
+    _packets.clear();
+    _acked.clear();
+    _prefix = 0;
+    _saved  = 0;
+    if (path.empty() || _key.empty()) return;
+    auto lines = load_cache_lines(path);
+    if (lines.erase(_key))
+        save_cache_lines(path, lines);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "plan.h"
+#include "protocol.h"
+
+// -----------------------------------------------------------------------
+// Apply journal
+//
+// An apply that stops part-way (killed, Ctrl+C, receiver dropped out)
+// leaves the mouse half-written and uncommitted.  The journal records, per
+// device, the packets of the plan being sent and how many of them from
+// the start have been acknowledged.  It is saved every JOURNAL_SAVE_EVERY
+// acknowledged packets and whenever the send stops short, and removed once
+// the plan has gone through, so an entry that is still there on the next
+// run marks an interrupted apply: its writes are uncertain, and a re-run of
+// the same plan continues from the first unacknowledged packet instead of
+// starting over.  A recorded count that lags behind only means a few
+// packets are sent again.
+//
+// Kept in $XDG_RUNTIME_DIR/m913-ctl/journal under device_key().
+// -----------------------------------------------------------------------
+
+// Growth of the acknowledged prefix between saves.  Each save rewrites the
+// whole file, too slow to do for every ACK of a pipelined send.
+static constexpr size_t JOURNAL_SAVE_EVERY = 16;
+
+class ApplyJournal {
+public:
+    // Load the interrupted apply recorded for `key`.  Returns false if
+    // there is none (or XDG_RUNTIME_DIR is unset).
+    bool load(const std::string& key);
+
+    // The recorded plan, flattened, and how many of its packets were
+    // acknowledged in a row from the start.
+    const std::vector<Packet>& packets() const { return _packets; }
+    size_t acked() const { return _prefix; }
+
+    // True if `plan` sends exactly the recorded packets.
+    bool matches(const PacketPlan& plan) const;
+
+    // Start recording `plan` for `key`, the first `acked` packets already
+    // acknowledged (when resuming).  Written immediately.
+    void begin(const std::string& key, const PacketPlan& plan, size_t acked = 0);
+
+    // Note that the mouse acknowledged `p`, the earliest unacknowledged
+    // packet with these bytes.  Pipelined ACKs may arrive out of order;
+    // the journal is saved once the acknowledged prefix has grown by
+    // JOURNAL_SAVE_EVERY.
+    void ack(const Packet& p);
+
+    // Save the acknowledged prefix if it grew since the last save.  Call
+    // when the send stops short of the end of the plan.
+    void flush();
+
+    // The first unacknowledged packet of `plan` (the recorded plan).
+    PlanPosition resume(const PacketPlan& plan) const { return plan_position(plan, _prefix); }
+
+    // The plan went through: drop the entry.
+    void finish();
+
+private:
+    void save();
+
+    std::string         _key;
+    std::vector<Packet> _packets;
+    std::vector<bool>   _acked;
+    size_t              _prefix = 0;
+    size_t              _saved  = 0;  // _prefix as last saved
+};
@@ -1,18 +1,43 @@
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <cstdlib>
 #include <cstring>
+#include <future>
 #include <getopt.h>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "alloc.h"
+#include "apply.h"
 #include "config.h"
+#include "daemon.h"
 #include "data.h"
+#include "discovery.h"
+#include "fleet.h"
+#include "hello.h"
+#include "hidraw.h"
+#include "hotplug.h"
+#include "journal.h"
+#include "plan.h"
+#include "planfile.h"
+#include "plancache.h"
 #include "protocol.h"
+#include "readback.h"
+#include "rtt.h"
+#include "shadow.h"
+#include "timings.h"
+#include "usbfs.h"
+
+#ifdef M913_HAVE_LIBUSB
 #include "usb.h"
+#endif
 
 static volatile bool g_stop = false;
 static void handle_sigint(int) { g_stop = true; }
@@ -41,6 +66,9 @@ Options:
                            Press mouse buttons to see raw packets.
 
   --probe                  Show USB interfaces and endpoints for the device
+  --probe-commands         Send each command byte and each 08 XX
+                           sub-command and print the replies (looks for
+                           the read command --verify and --dump need)
 
   -c, --config FILE        Apply settings from an INI config file
 
@@ -53,6 +81,76 @@ Options:
 
   --list-actions           Print all valid button action names and exit
 
+  --pipeline N             Keep up to N config writes in flight (1-16,
+                           default 1 = lock-step).  ACKs are matched by
+                           address; any miss falls back to lock-step resends.
+                           Prints the speedup over lock-step at the end.
+
+  --all                    Apply the settings to every attached M913 at once
+                           and print a per-device result table
+  --jobs N                 Worker threads for --all (default: 8)
+  --per-bus N              Devices configured at once per USB bus with --all
+                           (default: 4)
+
+  --udev-apply DEVNODE     Apply the settings, or the plan file given with
+                           --apply-plan, to exactly this usbfs node
+                           (/dev/bus/usb/BBB/DDD) for a udev RUN+= rule:
+                           no discovery, no hello drain, no output.  Exit
+                           status: 0 ok, 2 bad config or plan file,
+                           3 open failed,
+                           4 not an M913, 5 mouse did not answer,
+                           6 write failed, 7 some ACKs missing
+
+  --watch                  Stay running and apply the settings to every
+                           M913 that is plugged in (receiver re-plugged,
+                           mouse switched to its cable); prints the
+                           plug-to-commit time for each
+
+  --wait-wake[=SECONDS]    If the wireless mouse does not answer (asleep or
+                           out of range), wait for it to wake (default 60 s)
+                           and resume from the first unacknowledged packet
+                           instead of failing
+
+  --daemon                 Keep the mouse open and apply settings sent over
+                           a Unix socket (see README); --config and inline
+                           settings given with it are applied first
+  --socket PATH            Socket for --daemon (default:
+                           $XDG_RUNTIME_DIR/m913-ctl/daemon.sock)
+
+  --timings                Print how long each phase took and how long the
+                           pointer was unusable (its interface detached)
+  --full-claim             Claim every USB interface for config writes too
+                           (default: only the config interface, so the
+                           pointer keeps working; for comparison)
+
+  --transport NAME         auto (default), hidraw, usbfs or libusb.  hidraw
+                           keeps the kernel driver bound so the mouse stays
+                           usable while it is configured; auto uses it
+                           whenever a matching /dev/hidraw node is
+                           accessible, then libusb (if built in), then usbfs.
+
+  --diff                   Show which packets the settings would write to
+                           the first mouse found, leaving out what it
+                           already holds, without opening it
+  --no-shadow              Write every packet, even those the mouse is
+                           known to hold already, and refresh that record
+                           (use after configuring it elsewhere)
+  --verify                 Read the mouse's config memory back and compare
+                           it with what --config / settings would write,
+                           instead of writing; exits 1 on any difference
+                           (experimental, needs --experimental-read)
+  --dump                   Read back and print the whole config memory
+                           (experimental, needs --experimental-read)
+  --experimental-read      Allow --verify and --dump to send the read
+                           command, which is not confirmed on hardware yet
+
+  --compile FILE           Build the plans for both hardware revisions from
+                           an INI file (plus any inline settings) and write
+                           them, ready to send, to the file given with -o
+  -o, --output PATH        Output file for --compile
+  --apply-plan FILE        Send a plan file made by --compile, with no
+                           config parsing or packet building
+
   --profile N              Target profile 1 or 2 (default: 1; note: the
                            M913 only fully supports profile 1 via USB)
 
@@ -80,138 +178,236 @@ Note: Run as root or install the udev rule for non-root access:
 }
 
 // -----------------------------------------------------------------------
-// Send one packet and read the ACK interrupt response.
-// The device always sends a 17-byte ACK on EP 0x82 after each config write.
-// We wait up to 1000 ms — if it times out we warn and continue
-// (wireless latency can be high).
+// Open one discovered device with the requested transport ("auto" tries
+// hidraw, then libusb, then usbfs).  usb_only skips hidraw; `scope` says
+// which interfaces the USB-level backends claim.  Returns nullptr and sets
+// `error` if no transport could open it.
 // -----------------------------------------------------------------------
-static void send_cmd(UsbMouse& mouse, const Packet& p, const std::string& label) {
-    if (!label.empty())
-        std::cout << "  " << label << "\n";
-    std::cout << "    --> ";
-    hexdump_packet(p);
-    mouse.send(p.data());
-
-    // Poll for the 17-byte ACK on EP 0x82.
-    // The mouse responds within ~20 ms on native USB.  On WSL2/USB-IP the
-    // VHCI may need a fresh URB already queued to catch interrupt data, so
-    // submit 15 × 100 ms reads (1.5 s total) instead of one big wait.
-    uint8_t buf[M913_PACKET_SIZE] = {};
-    int got = 0;
-    for (int attempt = 0; attempt < 15 && got == 0; ++attempt)
-        got = mouse.try_recv(buf, M913_PACKET_SIZE, INTERRUPT_EP_IN, 100);
-
-    if (got > 0) {
-        std::cout << "    <-- ";
-        std::cout << std::hex << std::setfill('0');
-        for (int b = 0; b < got; ++b)
-            std::cout << std::setw(2) << static_cast<int>(buf[b]) << " ";
-        std::cout << std::dec << "\n";
-    } else {
-        std::cout << "    <-- (no ACK within 1.5s)\n";
+static std::unique_ptr<Transport> open_transport(const UsbDeviceId& dev,
+                                                 const DeviceTraits& traits,
+                                                 const std::string& name,
+                                                 bool usb_only, ClaimScope scope,
+                                                 std::string& error) {
+    if (name != "libusb" && name != "usbfs" && !usb_only) {
+        auto hid = std::make_unique<HidrawMouse>();
+        if (hid->open_device(dev)) return hid;
+        if (name == "hidraw") {
+            error = "No accessible hidraw node for the M913 at " + dev.port_path +
+                    " — try running with sudo or install the udev rule.";
+            return nullptr;
+        }
     }
-}
 
-// Send an entire packet sequence (keyboard-key sub-packets + config packets).
-static void send_sequence(UsbMouse& mouse,
-                          const std::vector<Packet>& pkts,
-                          const std::string& heading) {
-    if (pkts.empty()) return;
-    std::cout << "=== " << heading << " (" << pkts.size() << " packets) ===\n";
-    for (size_t i = 0; i < pkts.size(); ++i)
-        send_cmd(mouse, pkts[i], "pkt " + std::to_string(i + 1) + "/" +
-                                  std::to_string(pkts.size()));
+#ifdef M913_HAVE_LIBUSB
+    if (name != "usbfs") {
+        try {
+            auto usb = std::make_unique<UsbMouse>();
+            usb->open_device(dev, scope, traits.num_interfaces);
+            return usb;
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        if (name == "libusb") return nullptr;
+    }
+#endif
+
+    try {
+        auto fs = std::make_unique<UsbfsMouse>();
+        fs->open_device(dev, scope, traits.num_interfaces);
+        return fs;
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    return nullptr;
 }
 
 // -----------------------------------------------------------------------
-// Apply a full config to the mouse
+// --udev-apply DEVNODE: meant for a udev RUN+= rule.  Opens exactly the
+// usbfs node udev passed in -- no discovery, no caches, no hello drain --
+// writes the plan and prints nothing; the outcome is the exit status.
 // -----------------------------------------------------------------------
-static void apply_config(UsbMouse& mouse, const Config& cfg,
-                         const uint8_t* btn_layout = nullptr,
-                         bool is_compx = false) {
-
-    // ---- Buttons ----
-    std::map<uint8_t, ActionBytes> btn_changes;
-    for (auto& [key, action_str] : cfg.buttons) {
-        Button btn;
-        if (!parse_button_name(key, btn)) {
-            std::cerr << "  Warning: unknown button '" << key << "', skipping\n";
-            continue;
-        }
-        ActionBytes ab;
-        if (!parse_action(action_str, ab)) {
-            std::cerr << "  Warning: unknown action '" << action_str
-                      << "' for " << key << ", skipping\n";
-            continue;
-        }
-        btn_changes[static_cast<uint8_t>(btn)] = ab;
-        // Register multi-key actions for complex parsing
-        if (ab[0] == 0x90 && ab[3] > 1) {
-            register_multikey_action(static_cast<uint8_t>(btn), action_str);
-        }
-    }
-    if (!btn_changes.empty())
-        send_sequence(mouse, build_button_mapping(btn_changes, btn_layout), "Button mapping");
-
-    // ---- DPI ----
-    bool any_dpi = false;
-    for (int i = 0; i < 5; ++i)
-        if (cfg.dpi[i].value != 0) { any_dpi = true; break; }
-
-    if (any_dpi) {
-        DpiSettings dpi;
-        for (int i = 0; i < 5; ++i) {
-            dpi.values[i]  = cfg.dpi[i].value;
-            dpi.enabled[i] = cfg.dpi[i].enabled;
-        }
-        if (is_compx)
-            send_sequence(mouse, build_compx_dpi_packets(dpi), "DPI config");
+enum UdevStatus : int {
+    UDEV_OK           = 0,
+    UDEV_BAD_CONFIG   = 2,  // config file or settings rejected
+    UDEV_OPEN_FAILED  = 3,  // node could not be opened or claimed
+    UDEV_UNSUPPORTED  = 4,  // not a supported VID/PID
+    UDEV_NO_ANSWER    = 5,  // mouse asleep, out of range, link dropped or too slow
+    UDEV_WRITE_FAILED = 6,  // a transfer failed
+    UDEV_PARTIAL      = 7,  // plan written, but some ACKs missing
+};
+
+// udev runs RUN+= programs synchronously, so nothing here waits long.  The
+// interfaces can lag the add event slightly; a wireless mouse that does not
+// answer the probe in a few round trips is not waited for.  ACK deadlines
+// follow the probe's round trip (UDEV_WIRED_RTT_MS stands in for it on a
+// wired mouse, which is not probed) instead of ACK_TIMEOUT_MS, and the
+// whole send is abandoned after UDEV_SEND_MS.
+static constexpr unsigned int UDEV_OPEN_RETRY_MS = 50;
+static constexpr unsigned int UDEV_PROBE_MS      = 60;
+static constexpr double       UDEV_WIRED_RTT_MS  = 20;
+static constexpr unsigned int UDEV_SEND_MS       = 5000;
+
+static int udev_apply(const std::string& devnode, const std::string& plan_file_path,
+                      const std::string& config_file, Profile profile,
+                      const InlineSettings& args, SendOptions send) {
+    // Both revisions' plans are ready before the device is touched: mapped
+    // from a compiled plan file (no parsing or building at all), or built
+    // from the settings.  No cache I/O and nothing on stderr: a revision
+    // the settings do not suit just has no plan, which is UDEV_BAD_CONFIG
+    // if it is plugged in.
+    std::unique_ptr<PlanFile>          file;
+    std::map<DeviceModel, PacketPlan>  plans;
+    std::map<DeviceModel, std::string> unsuited;
+    try {
+        if (!plan_file_path.empty())
+            file = std::make_unique<PlanFile>(plan_file_path);
         else
-            send_sequence(mouse, build_dpi_packets(dpi), "DPI config");
+            plans = load_plans(config_file, profile, args, false, &unsuited);
+    } catch (const std::exception&) {
+        return UDEV_BAD_CONFIG;
     }
 
-    // ---- LED ----
-    if (is_compx) {
-        // Compx has per-slot RGB colors, no global LED modes.
-        //   [led] section    → applies one color to every active slot
-        //                       (mode=off → black)
-        //   dpiN_color keys  → override individual slots, take precedence
-        bool any_color = cfg.led.set;
-        for (int i = 0; i < 5; ++i)
-            if (cfg.dpi[i].color != 0xFFFFFFFF) any_color = true;
-
-        if (any_color) {
-            int n_slots = 1;
-            for (int i = 0; i < 5; ++i)
-                if (cfg.dpi[i].enabled) n_slots = i + 1;
-
-            uint32_t colors[5];
-            uint32_t global = cfg.led.set
-                ? ((cfg.led.mode == LedMode::Off) ? 0x000000 : cfg.led.color)
-                : 0xFFFFFFFF;
-            for (int i = 0; i < 5; ++i)
-                colors[i] = (cfg.dpi[i].color != 0xFFFFFFFF) ? cfg.dpi[i].color : global;
-
-            send_sequence(mouse, build_compx_color_packets(colors, n_slots), "LED color");
-        }
-    } else if (cfg.led.set) {
-        send_sequence(mouse,
-                      build_led_packets(cfg.led.mode, cfg.led.color, cfg.led.brightness, cfg.led.speed),
-                      "LED mode");
+    UsbfsMouse mouse;
+    auto open_deadline = std::chrono::steady_clock::now() +
+                         std::chrono::milliseconds(UDEV_OPEN_RETRY_MS);
+    for (;;) {
+        try {
+            mouse.open_path(devnode, ClaimScope::Config);
+            break;
+        } catch (const std::exception&) {
+            if (std::chrono::steady_clock::now() >= open_deadline) return UDEV_OPEN_FAILED;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+    uint16_t vid = mouse.vendor_id(), pid = mouse.product_id();
+    bool supported = std::any_of(std::begin(M913_SUPPORTED_IDS), std::end(M913_SUPPORTED_IDS),
+                                 [&](const auto& s) { return s.vid == vid && s.pid == pid; });
+    if (!supported) {
+        mouse.close();
+        return UDEV_UNSUPPORTED;
+    }
+    DeviceModel model = model_for_vid(vid);
+    mouse.set_ctrl_value(ctrl_value_for(model));
+
+    // The plan for this revision and its first packet, for the probe.
+    const PacketPlan* plan  = nullptr;
+    const Packet*     probe = nullptr;
+    if (file) {
+        if (file->sections(model) == 0) {
+            mouse.close();
+            return UDEV_BAD_CONFIG;
+        }
+        PlanFile::Section first = file->section(model, 0);
+        if (first.count) probe = first.packets;
+    } else {
+        auto found = plans.find(model);
+        if (found == plans.end()) {
+            mouse.close();
+            return UDEV_BAD_CONFIG;
+        }
+        plan = &found->second;
+        PlanPosition first;
+        probe = plan_packet(*plan, first);
     }
 
-    // ---- Polling rate ----
-    if (cfg.mouse.set)
-        send_sequence(mouse,
-                      {build_polling_rate_packet(cfg.mouse.polling_rate)},
-                      "Polling rate");
+    int status = UDEV_OK;
+    try {
+        bool   wired  = pid == M913_PID_WIRED || pid == COMPX_PID_WIRED;
+        double rtt_ms = UDEV_WIRED_RTT_MS;
+        if (probe && !wired && !probe_link(mouse, *probe, UDEV_PROBE_MS, &rtt_ms)) {
+            status = UDEV_NO_ANSWER;
+        } else {
+            RttEstimator rtt;
+            rtt.seed(rtt_ms);
+            SendStats st;
+            send.verbose = false;
+            send.rtt     = &rtt;
+            send.give_up = std::chrono::steady_clock::now() +
+                           std::chrono::milliseconds(UDEV_SEND_MS);
+            if (file) send_plan_file(mouse, *file, model, send, &st);
+            else      send_plan(mouse, *plan, send, &st);
+            if (st.acked != st.packets) status = UDEV_PARTIAL;
+        }
+    } catch (const LinkDownError&) {
+        status = UDEV_NO_ANSWER;
+    } catch (const std::exception&) {
+        status = UDEV_WRITE_FAILED;
+    }
+    mouse.close();
+    return status;
 }
 
 // -----------------------------------------------------------------------
 // Main
 // -----------------------------------------------------------------------
 
+// -----------------------------------------------------------------------
+// --verify: read back every range the plan writes and compare.  Writes the
+// mouse already holds are recorded in its shadow and differing ones are
+// forgotten, so a following apply sends exactly the difference.  Returns
+// true if nothing read back differs and at least one read was answered;
+// writes that could not be read are reported but not failed, as the read
+// command is not confirmed on every mouse.
+// -----------------------------------------------------------------------
+static void print_bytes(const char* label, const uint8_t* b, size_t n) {
+    std::cout << "    " << label << std::hex << std::setfill('0');
+    for (size_t i = 0; i < n; ++i)
+        std::cout << " " << std::setw(2) << static_cast<int>(b[i]);
+    std::cout << std::dec << "\n";
+}
+
+static bool verify_plan(Transport& mouse, const PacketPlan& plan,
+                        const std::string& shadow_key, RttEstimator& rtt) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<ReadRange> ranges = plan_ranges(plan);
+    MemoryDump mem;
+    size_t n_read = read_ranges(mouse, ranges, mem, READ_WINDOW, &rtt);
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+
+    ShadowImage shadow;
+    shadow.load(shadow_key);
+    size_t held = 0, differ = 0, unread = 0;
+    for (auto& section : plan)
+        for (auto& p : section.packets) {
+            if (p[1] != 0x07) continue;  // the commit
+            uint16_t addr = static_cast<uint16_t>((p[3] << 8) | p[4]);
+            switch (compare_write(p, mem)) {
+            case WriteState::Held:
+                ++held;
+                shadow.record(p);
+                break;
+            case WriteState::Differs:
+                ++differ;
+                shadow.forget(p);
+                std::cout << section.heading << ": 0x" << std::hex << std::setw(3)
+                          << std::setfill('0') << addr << std::dec << " differs\n";
+                print_bytes("want", p.data() + 6, p[5]);
+                print_bytes("have", mem.bytes.data() + addr, p[5]);
+                break;
+            case WriteState::Unread:
+                ++unread;
+                break;
+            }
+        }
+    shadow.save(shadow_key);
+
+    std::cout << std::fixed << std::setprecision(1) << "Read " << n_read << "/"
+              << ranges.size() << " blocks in " << ms << " ms: " << held << " write(s) match, "
+              << differ << " differ, " << unread << " unread.\n";
+    std::cout.unsetf(std::ios::floatfield);
+    if (n_read == 0)
+        std::cerr << "Error: the mouse answered none of the reads; the read command may not "
+                  << "be right for this hardware (see --probe-commands)\n";
+    else if (unread)
+        std::cerr << "Warning: " << unread << " write(s) could not be read back and were "
+                  << "not checked\n";
+    return differ == 0 && n_read > 0;
+}
+
 int main(int argc, char* argv[]) {
+    Timings timings;
     if (argc < 2) {
         print_help(argv[0]);
         return 0;
@@ -232,6 +428,26 @@ int main(int argc, char* argv[]) {
         {"list-actions",  no_argument,       nullptr, 1004},
         {"profile",       required_argument, nullptr, 1005},
         {"polling-rate",  required_argument, nullptr, 1011},
+        {"pipeline",      required_argument, nullptr, 1012},
+        {"all",           no_argument,       nullptr, 1013},
+        {"jobs",          required_argument, nullptr, 1014},
+        {"per-bus",       required_argument, nullptr, 1015},
+        {"transport",     required_argument, nullptr, 1016},
+        {"timings",       no_argument,       nullptr, 1017},
+        {"full-claim",    no_argument,       nullptr, 1018},
+        {"wait-wake",     optional_argument, nullptr, 1019},
+        {"daemon",        no_argument,       nullptr, 1020},
+        {"socket",        required_argument, nullptr, 1021},
+        {"watch",         no_argument,       nullptr, 1022},
+        {"udev-apply",    required_argument, nullptr, 1023},
+        {"diff",          no_argument,       nullptr, 1024},
+        {"no-shadow",     no_argument,       nullptr, 1025},
+        {"dump",          no_argument,       nullptr, 1026},
+        {"verify",        no_argument,       nullptr, 1027},
+        {"compile",       required_argument, nullptr, 1028},
+        {"output",        required_argument, nullptr, 'o'},
+        {"apply-plan",    required_argument, nullptr, 1029},
+        {"experimental-read", no_argument,   nullptr, 1030},
         {nullptr, 0, nullptr, 0}
     };
 
@@ -244,16 +460,30 @@ int main(int argc, char* argv[]) {
     std::string raw_send_hex;
     Profile     profile      = Profile::P1;
 
-    struct DpiArg  { int slot; uint16_t value; };
-    struct BtnArg  { std::string name; std::string action; };
-
-    std::vector<DpiArg>   dpi_args;
-    std::vector<BtnArg>   btn_args;
-    std::string           led_arg;
-    uint16_t              polling_rate_arg = 0;  // 0 = not set
+    InlineSettings        inline_args;
+    bool                  do_all = false;
+    FleetOptions          fleet_opts;
+    std::string           transport_name = "auto";
+    SendOptions           send_opts;
+    SendStats             send_stats;
+    bool                  do_timings = false;
+    bool                  full_claim = false;
+    unsigned int          wait_wake_s = 0;  // 0 = fail when the mouse does not answer
+    bool                  do_daemon = false;
+    DaemonOptions         daemon_opts;
+    bool                  do_watch = false;
+    std::string           udev_devnode;
+    bool                  do_diff    = false;
+    bool                  use_shadow = true;
+    bool                  do_dump    = false;
+    bool                  do_verify  = false;
+    bool                  experimental_read = false;
+    std::string           compile_file;
+    std::string           output_file;
+    std::string           plan_file_path;
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "hVc:", long_opts, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hVc:o:", long_opts, nullptr)) != -1) {
         switch (opt) {
         case 'h':
             print_help(argv[0]);
@@ -267,6 +497,10 @@ int main(int argc, char* argv[]) {
             config_file = optarg;
             break;
 
+        case 'o':
+            output_file = optarg;
+            break;
+
         case 1001: {  // --dpi SLOT=VALUE
             std::string arg = optarg;
             auto eq = arg.find('=');
@@ -285,7 +519,7 @@ int main(int argc, char* argv[]) {
                     std::cerr << "Error: DPI value must be 100-16000 in steps of 100\n";
                     return 1;
                 }
-                dpi_args.push_back({slot, static_cast<uint16_t>(val)});
+                inline_args.dpi.push_back({slot, static_cast<uint16_t>(val)});
             } catch (...) {
                 std::cerr << "Error: invalid --dpi argument: " << arg << "\n";
                 return 1;
@@ -294,7 +528,7 @@ int main(int argc, char* argv[]) {
         }
 
         case 1002:  // --led MODE
-            led_arg = optarg;
+            inline_args.led_mode = optarg;
             break;
 
         case 1003: {  // --button NAME=ACTION
@@ -309,7 +543,7 @@ int main(int argc, char* argv[]) {
             std::string bname = arg.substr(0, eq);
             if (bname.rfind("button_", 0) != 0)
                 bname = "button_" + bname;
-            btn_args.push_back({bname, arg.substr(eq + 1)});
+            inline_args.buttons.push_back({bname, arg.substr(eq + 1)});
             break;
         }
 
@@ -349,7 +583,7 @@ int main(int argc, char* argv[]) {
                     std::cerr << "Error: --polling-rate must be 125, 250, 500, or 1000\n";
                     return 1;
                 }
-                polling_rate_arg = static_cast<uint16_t>(r);
+                inline_args.polling_rate = static_cast<uint16_t>(r);
             } catch (...) {
                 std::cerr << "Error: invalid --polling-rate argument\n";
                 return 1;
@@ -357,6 +591,119 @@ int main(int argc, char* argv[]) {
             break;
         }
 
+        case 1012:  // --pipeline N
+            try {
+                int n = std::stoi(optarg);
+                if (n < 1 || n > 16) {
+                    std::cerr << "Error: --pipeline must be 1-16\n";
+                    return 1;
+                }
+                send_opts.window = n;
+            } catch (...) {
+                std::cerr << "Error: invalid --pipeline argument\n";
+                return 1;
+            }
+            break;
+
+        case 1013:  // --all
+            do_all = true;
+            break;
+
+        case 1014:    // --jobs N
+        case 1015: {  // --per-bus N
+            const char* name = (opt == 1014) ? "--jobs" : "--per-bus";
+            try {
+                int n = std::stoi(optarg);
+                if (n < 1 || n > 64) {
+                    std::cerr << "Error: " << name << " must be 1-64\n";
+                    return 1;
+                }
+                (opt == 1014 ? fleet_opts.jobs : fleet_opts.per_bus) = n;
+            } catch (...) {
+                std::cerr << "Error: invalid " << name << " argument\n";
+                return 1;
+            }
+            break;
+        }
+
+        case 1016:  // --transport NAME
+            transport_name = optarg;
+            if (transport_name != "auto" && transport_name != "hidraw" &&
+                transport_name != "usbfs" && transport_name != "libusb") {
+                std::cerr << "Error: --transport must be auto, hidraw, usbfs or libusb\n";
+                return 1;
+            }
+            break;
+
+        case 1017:  // --timings
+            do_timings = true;
+            break;
+
+        case 1018:  // --full-claim
+            full_claim = true;
+            break;
+
+        case 1019:  // --wait-wake[=SECONDS]
+            wait_wake_s = 60;
+            if (optarg) {
+                try {
+                    int n = std::stoi(optarg);
+                    if (n < 1 || n > 3600) {
+                        std::cerr << "Error: --wait-wake must be 1-3600 seconds\n";
+                        return 1;
+                    }
+                    wait_wake_s = static_cast<unsigned int>(n);
+                } catch (...) {
+                    std::cerr << "Error: invalid --wait-wake argument\n";
+                    return 1;
+                }
+            }
+            break;
+
+        case 1020:  // --daemon
+            do_daemon = true;
+            break;
+
+        case 1021:  // --socket PATH
+            daemon_opts.socket_path = optarg;
+            break;
+
+        case 1022:  // --watch
+            do_watch = true;
+            break;
+
+        case 1023:  // --udev-apply DEVNODE
+            udev_devnode = optarg;
+            break;
+
+        case 1024:  // --diff
+            do_diff = true;
+            break;
+
+        case 1025:  // --no-shadow
+            use_shadow = false;
+            break;
+
+        case 1026:  // --dump
+            do_dump = true;
+            break;
+
+        case 1027:  // --verify
+            do_verify = true;
+            break;
+
+        case 1028:  // --compile FILE
+            compile_file = optarg;
+            break;
+
+        case 1029:  // --apply-plan FILE
+            plan_file_path = optarg;
+            break;
+
+        case 1030:  // --experimental-read
+            experimental_read = true;
+            break;
+
         case 1005:  // --profile N
             try {
                 int p = std::stoi(optarg);
@@ -379,52 +726,289 @@ int main(int argc, char* argv[]) {
     }
 
     // ---- validate that there's something to do ----
-    bool has_work = do_probe || do_probe_commands || do_listen ||
+    bool has_work = do_probe || do_probe_commands || do_listen || do_daemon || do_watch ||
+                    do_dump || !compile_file.empty() || !plan_file_path.empty() ||
+                    !udev_devnode.empty() ||
                     !raw_send_hex.empty() ||
                     !config_file.empty() ||
-                    !dpi_args.empty() || !led_arg.empty() || !btn_args.empty() ||
-                    polling_rate_arg != 0;
+                    !inline_args.empty();
     if (!has_work) {
         print_help(argv[0]);
         return 0;
     }
 
+    if (do_daemon && (do_all || do_probe || do_probe_commands || do_listen ||
+                      !raw_send_hex.empty())) {
+        std::cerr << "Error: --daemon cannot be combined with --all, --probe, "
+                  << "--probe-commands, --listen or --raw-send\n";
+        return 1;
+    }
+
+    // ---- --compile FILE -o PATH ----
+    if (!compile_file.empty()) {
+        if (output_file.empty()) {
+            std::cerr << "Error: --compile needs -o PATH for the plan file\n";
+            return 1;
+        }
+        try {
+            std::map<DeviceModel, PacketPlan> plans = load_plans(compile_file, profile, inline_args);
+            write_plan_file(output_file, plans);
+            std::cout << "Wrote " << output_file << ":";
+            const char* sep = " ";
+            for (auto& [model, plan] : plans) {
+                std::cout << sep << model_name(model) << " " << plan_packet_count(plan) << " packets";
+                sep = ", ";
+            }
+            std::cout << ".\n";
+            return 0;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    // Mapped (and checked) before the device is opened.
+    std::unique_ptr<PlanFile> plan_file;
+    if (!plan_file_path.empty()) {
+        if (!config_file.empty() || !inline_args.empty() || do_all || do_watch || do_daemon ||
+            do_diff || do_verify) {
+            std::cerr << "Error: --apply-plan sends a compiled plan to one mouse; it cannot be "
+                      << "combined with --config, settings, --all, --watch, --daemon, --diff "
+                      << "or --verify\n";
+            return 1;
+        }
+        // --udev-apply maps it itself and reports a bad file by exit status.
+        if (udev_devnode.empty()) try {
+            plan_file = std::make_unique<PlanFile>(plan_file_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (do_dump || do_verify) {
+        if (do_all || do_watch || do_daemon || do_diff || !udev_devnode.empty()) {
+            std::cerr << "Error: --dump and --verify read one opened mouse; they cannot be "
+                      << "combined with --all, --watch, --daemon, --diff or --udev-apply\n";
+            return 1;
+        }
+        if (!experimental_read) {
+            std::cerr << "Error: --dump and --verify send a read command (08 08) that has not "
+                      << "been confirmed on M913 hardware; add --experimental-read to send "
+                      << "it anyway (see README)\n";
+            return 1;
+        }
+        if (do_verify && config_file.empty() && inline_args.empty()) {
+            std::cerr << "Error: --verify needs --config or settings to compare\n";
+            return 1;
+        }
+    }
+
+    // ---- --udev-apply DEVNODE ----
+    if (!udev_devnode.empty()) {
+        if (do_all || do_watch || do_daemon || do_probe || do_probe_commands || do_listen ||
+            !raw_send_hex.empty()) {
+            std::cerr << "Error: --udev-apply only applies settings or a plan; it cannot be combined with "
+                      << "--all, --watch, --daemon, --probe, --probe-commands, --listen or --raw-send\n";
+            return 1;
+        }
+        if (config_file.empty() && inline_args.empty() && plan_file_path.empty()) {
+            std::cerr << "Error: --udev-apply needs --apply-plan, --config or settings to apply\n";
+            return 1;
+        }
+        return udev_apply(udev_devnode, plan_file_path, config_file, profile, inline_args,
+                          send_opts);
+    }
+
+    // ---- --all / --watch: apply to every attached or arriving device ----
+    if (do_all || do_watch) {
+        const char* mode = do_all ? "--all" : "--watch";
+        if (do_probe || do_probe_commands || do_listen || !raw_send_hex.empty() ||
+            do_daemon || (do_all && do_watch)) {
+            std::cerr << "Error: " << mode << " only applies settings; it cannot be combined with "
+                      << "--probe, --probe-commands, --listen, --raw-send, --daemon, "
+                      << (do_all ? "--watch" : "--all") << "\n";
+            return 1;
+        }
+        if (config_file.empty() && inline_args.empty()) {
+            std::cerr << "Error: " << mode << " needs --config or settings to apply\n";
+            return 1;
+        }
+        try {
+            std::map<DeviceModel, PacketPlan> plans =
+                load_plans(config_file, profile, inline_args);
+            if (do_all) {
+                fleet_opts.send = send_opts;
+                return run_fleet(plans, fleet_opts) == 0 ? 0 : 1;
+            }
+
+#ifndef M913_HAVE_LIBUSB
+            if (transport_name == "libusb")
+                throw std::runtime_error("this build has no libusb support; use --transport usbfs");
+#endif
+            ClaimScope scope = full_claim ? ClaimScope::All : ClaimScope::Config;
+            DeviceOpener open = [&](const UsbDeviceId& dev, const DeviceTraits& traits,
+                                    std::string& error) {
+                return open_transport(dev, traits, transport_name, false, scope, error);
+            };
+            HotplugOptions hotplug_opts;
+            hotplug_opts.send = send_opts;
+            std::signal(SIGINT, handle_sigint);
+            std::signal(SIGTERM, handle_sigint);
+            run_hotplug(plans, open, hotplug_opts, g_stop);
+            return 0;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    // ---- --diff: dry run against the device shadow ----
+    if (do_diff) {
+        if (do_probe || do_probe_commands || do_listen || !raw_send_hex.empty() || do_daemon) {
+            std::cerr << "Error: --diff cannot be combined with --probe, --probe-commands, "
+                      << "--listen, --raw-send or --daemon\n";
+            return 1;
+        }
+        if (config_file.empty() && inline_args.empty()) {
+            std::cerr << "Error: --diff needs --config or settings to compare\n";
+            return 1;
+        }
+        try {
+            std::vector<UsbDeviceId> devices = discover_devices();
+            if (devices.empty())
+                throw std::runtime_error("Could not find any supported M913 variant — is the mouse plugged in?");
+            const UsbDeviceId& dev = devices.front();
+            DeviceTraits traits = lookup_traits(dev);
+
+            PacketPlan full = load_plan(config_file, profile, inline_args, traits.model);
+
+            ShadowImage shadow;
+            shadow.load(device_key(dev));
+            size_t skipped = 0;
+            PacketPlan plan = diff_plan(full, shadow, skipped);
+
+            std::cout << std::hex << std::setfill('0') << std::setw(4) << dev.vid << ":"
+                      << std::setw(4) << dev.pid << std::dec << " at " << dev.port_path
+                      << " (" << model_name(traits.model) << "): shadow holds "
+                      << shadow.size() << " write(s).\n";
+            for (auto& section : plan) {
+                std::cout << "=== " << section.heading << " (" << section.packets.size()
+                          << " packets) ===\n";
+                for (auto& p : section.packets) {
+                    std::cout << "    ";
+                    hexdump_packet(p);
+                }
+            }
+            if (plan.empty())
+                std::cout << "Nothing to write — the mouse already holds these settings.\n";
+            else
+                std::cout << "Would write " << plan_packet_count(plan) << " of "
+                          << plan_packet_count(full) << " packets (" << skipped
+                          << " already on the mouse).\n";
+            return 0;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
     // ---- open mouse ----
-    UsbMouse mouse;
-    const uint8_t* btn_layout = nullptr;
-    bool           is_compx   = false;
+    // Devices are found in one sysfs pass.  hidraw leaves the kernel HID
+    // driver bound, so the mouse keeps working while it is configured; it
+    // is used whenever a matching node can be opened.  --probe,
+    // --probe-commands and --listen work at the USB level and use libusb
+    // when it is built in, usbfs otherwise.  The USB-level backends claim
+    // only the config interface for plain config writes, so the pointer
+    // keeps moving there too; everything that reads EP 0x81 claims all.
+    std::unique_ptr<Transport> transport;
+    DeviceModel model = DeviceModel::Areson;
+    LinkKind    link  = LinkKind::Wireless;
+
+    // The plan only depends on the hardware revision, which discovery knows
+    // before anything is opened, so it is built on a worker thread while
+    // the device is opened and drained.  Parse and validation errors are
+    // rethrown by get().
+    bool do_apply = !config_file.empty() || !inline_args.empty();
+    struct BuiltPlan {
+        PacketPlan     plan;
+        DeviceModel    model;
+        double         start_ms, end_ms;
+        PlanCacheStats cache;
+    };
+    auto make_plan = [&](DeviceModel m) {
+        BuiltPlan b{{}, m, timings.now_ms(), 0, {}};
+        b.plan   = load_plan(config_file, profile, inline_args, m, &b.cache);
+        b.end_ms = timings.now_ms();
+        return b;
+    };
+    std::future<BuiltPlan> plan_future;
+    double t_open_start = 0, t_ready = 0;
+
+    // ACK round-trip estimate for this device and transport, persisted
+    // between runs (see rtt.h).
+    RttEstimator rtt;
+    std::string  rtt_key;
+    // Key of the device's shadow (see shadow.h).
+    std::string  shadow_key;
+
     try {
-        uint16_t vid = M913_VID, pid = M913_PID;
-        const std::vector<std::pair<uint16_t,uint16_t>> candidates = {
-            {M913_VID,  M913_PID},
-            {M913_VID,  M913_PID_WIRED},
-            {COMPX_VID, COMPX_PID},
-            {COMPX_VID, COMPX_PID_WIRED},
-        };
-        bool opened = false;
-        for (auto [v, p] : candidates) {
-            try {
-                mouse.open_all_interfaces(v, p);
-                vid = v; pid = p; opened = true;
-                break;
-            } catch (...) {}
+        bool usb_only = do_probe || do_probe_commands || do_listen;
+        ClaimScope scope = (usb_only || !raw_send_hex.empty() || full_claim)
+                               ? ClaimScope::All : ClaimScope::Config;
+        if (transport_name == "hidraw" && usb_only)
+            throw std::runtime_error("--probe, --probe-commands and --listen need --transport usbfs or libusb");
+#ifndef M913_HAVE_LIBUSB
+        if (transport_name == "libusb")
+            throw std::runtime_error("this build has no libusb support; use --transport usbfs");
+#endif
+
+        double t_discover = timings.now_ms();
+        std::vector<UsbDeviceId> devices = discover_devices();
+        if (devices.empty())
+            throw std::runtime_error("Could not find any supported M913 variant — is the mouse plugged in?");
+        if (do_apply)
+            plan_future = std::async(std::launch::async, make_plan,
+                                     model_for_vid(devices.front().vid));
+        t_open_start = timings.now_ms();
+
+        UsbDeviceId  dev;
+        DeviceTraits traits;
+        std::string  open_error;
+        for (auto& d : devices) {
+            traits    = lookup_traits(d);
+            transport = open_transport(d, traits, transport_name, usb_only, scope, open_error);
+            if (transport) { dev = d; break; }
         }
-        if (!opened)
-            throw std::runtime_error("Could not find any supported M913 variant — is the mouse plugged in? Try running with sudo or install the udev rule.");
+        if (!transport)
+            throw std::runtime_error(open_error);
+        timings.end("discover+open", t_discover);
+        Transport& mouse = *transport;
+
+        shadow_key = device_key(dev);
+        rtt_key    = shadow_key + "/" + mouse.name();
+        rtt.load(rtt_key);
+        send_opts.rtt = &rtt;
 
-        is_compx   = (vid == COMPX_VID);
-        btn_layout = is_compx ? COMPX_LAYOUT : nullptr;
-        if (is_compx)
-            mouse.set_ctrl_value(0x0208);  // Compx uses output report, not feature report
+        model = traits.model;
+        link  = traits.link;
+        // Compx uses output report, not feature report
+        mouse.set_ctrl_value(traits.ctrl_value);
 
         std::cout << "Connected (" << std::hex
-                  << std::setw(4) << std::setfill('0') << vid << ":"
-                  << std::setw(4) << std::setfill('0') << pid
-                  << std::dec << ").\n";
+                  << std::setw(4) << std::setfill('0') << dev.vid << ":"
+                  << std::setw(4) << std::setfill('0') << dev.pid
+                  << std::dec << " at " << dev.port_path << " via " << mouse.name() << ").\n";
 
         // Drain any spontaneous init/hello packet from the wireless device.
+        // How long to wait depends on the link and on earlier runs.
+        double t_drain = timings.now_ms();
         uint8_t init_buf[64] = {};
-        int init_got = mouse.try_recv(init_buf, sizeof(init_buf), INTERRUPT_EP_IN, 800);
+        int init_got = drain_hello(mouse, traits, init_buf, sizeof(init_buf));
+        timings.end("hello drain", t_drain);
+        t_ready = timings.now_ms();
+        if (traits.link != LinkKind::Wired)
+            store_traits(dev, traits);
         if (init_got > 0) {
             std::cout << "[init packet (" << init_got << "B)]: ";
             std::cout << std::hex << std::setfill('0');
@@ -438,6 +1022,7 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    Transport& mouse = *transport;
     int exit_code = 0;
 
     try {
@@ -453,6 +1038,17 @@ int main(int argc, char* argv[]) {
             std::cout << "Sending feature report #8 with varying byte 0...\n\n";
 
             uint8_t buf[17] = {};
+            auto print_reply = [&](int got, const char* note) {
+                if (got > 0) {
+                    std::cout << "RESPONSE (" << got << "B): ";
+                    std::cout << std::hex << std::setfill('0');
+                    for (int b = 0; b < got; ++b)
+                        std::cout << std::setw(2) << static_cast<int>(buf[b]) << " ";
+                    std::cout << std::dec << note << "\n";
+                } else {
+                    std::cout << "no response\n";
+                }
+            };
             for (int cmd = 0x01; cmd <= 0x20; ++cmd) {
                 Packet pkt{};
                 pkt[0] = static_cast<uint8_t>(cmd);
@@ -470,15 +1066,39 @@ int main(int argc, char* argv[]) {
                 }
 
                 int got = mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, 300);
-                if (got > 0) {
-                    std::cout << "RESPONSE (" << got << "B): ";
-                    std::cout << std::hex << std::setfill('0');
-                    for (int b = 0; b < got; ++b)
-                        std::cout << std::setw(2) << static_cast<int>(buf[b]) << " ";
-                    std::cout << std::dec << "  *** HIT ***\n";
-                } else {
-                    std::cout << "no response\n";
+                print_reply(got, "  *** HIT ***");
+            }
+
+            // Config commands are report 0x08 with a sub-command in byte 1
+            // (07 = write, 04 = commit).  Ask every other sub-command for
+            // the button mapping at 0x060 and flag replies shaped like a
+            // read (see readback.h): same sub-command, address and length
+            // under a valid checksum.
+            std::cout << "\n=== Probing sub-commands (08 XX 00 00 60 08) ===\n";
+            for (int sub = 0x01; sub <= 0x10; ++sub) {
+                if (sub == 0x04 || sub == 0x07) continue;  // these change the config
+                Packet pkt{};
+                pkt[0] = 0x08;
+                pkt[1] = static_cast<uint8_t>(sub);
+                pkt[4] = 0x60;
+                pkt[5] = 0x08;
+                pkt[16] = compute_checksum(pkt);
+
+                std::cout << "sub=0x" << std::hex << std::setw(2) << std::setfill('0')
+                          << sub << std::dec << "  ";
+                std::cout.flush();
+                while (mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, 0) > 0) {}
+
+                try {
+                    mouse.send(pkt.data());
+                } catch (const std::exception& e) {
+                    std::cout << "SEND ERROR: " << e.what() << "\n";
+                    continue;
                 }
+
+                int got = mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, 300);
+                bool read_like = ack_matches(pkt, buf, got) && buf[1] == sub && buf[5] == 0x08;
+                print_reply(got, read_like ? "  *** looks like a read ***" : "");
             }
             std::cout << "\nDone.\n";
         }
@@ -505,6 +1125,13 @@ int main(int argc, char* argv[]) {
             std::cout << "Sending: ";
             hexdump_packet(pkt);
             mouse.send(pkt.data());
+            {
+                // Whatever this wrote is no longer known.
+                ShadowImage shadow;
+                shadow.load(shadow_key);
+                shadow.forget(pkt);
+                shadow.save(shadow_key);
+            }
 
             {
                 uint8_t buf[64] = {};
@@ -526,17 +1153,19 @@ int main(int argc, char* argv[]) {
             // needing a second terminal.
             std::signal(SIGINT, handle_sigint);
             std::cout << "\nPacket sent. Press buttons to verify effect. Ctrl+C to stop.\n\n";
-            struct EpInfo { uint8_t addr; int maxpkt; };
-            const EpInfo verify_eps[] = { {0x81, 7}, {0x82, 17} };
+            // Both endpoints have permanently queued transfers, so one event
+            // loop services them; drain whatever each one has buffered.
+            const uint8_t verify_eps[] = { INTERRUPT_EP_MOUSE, INTERRUPT_EP_IN };
             int vpkt = 0;
             uint8_t vbuf[64] = {};
             while (!g_stop) {
-                for (auto& ep_info : verify_eps) {
-                    int got = mouse.try_recv(vbuf, sizeof(vbuf), ep_info.addr, 200);
-                    if (got > 0) {
+                mouse.poll_events(200);
+                for (uint8_t ep : verify_eps) {
+                    int got;
+                    while ((got = mouse.try_recv(vbuf, sizeof(vbuf), ep, 0)) > 0) {
                         std::cout << "[pkt " << ++vpkt << " | EP 0x"
                                   << std::hex << std::setw(2) << std::setfill('0')
-                                  << static_cast<int>(ep_info.addr) << " | "
+                                  << static_cast<int>(ep) << " | "
                                   << std::dec << got << "B]  ";
                         std::cout << std::hex << std::setfill('0');
                         for (int b = 0; b < got; ++b)
@@ -544,7 +1173,6 @@ int main(int argc, char* argv[]) {
                         std::cout << std::dec << "\n";
                         std::cout.flush();
                     }
-                    if (g_stop) break;
                 }
             }
             std::cout << "Stopped.\n";
@@ -554,9 +1182,11 @@ int main(int argc, char* argv[]) {
         if (do_listen) {
             std::signal(SIGINT, handle_sigint);
 
-            struct EpInfo { uint8_t addr; int maxpkt; };
-            const EpInfo known_eps[] = { {0x81, 7}, {0x82, 17} };
-            const int n_eps = (listen_ep >= 0) ? 1 : 2;
+            std::vector<uint8_t> eps = { INTERRUPT_EP_MOUSE, INTERRUPT_EP_IN };
+            if (listen_ep >= 0) {
+                eps = { static_cast<uint8_t>(listen_ep) };
+                mouse.queue_interrupt_in(eps[0]);
+            }
 
             uint8_t buf[64] = {};
 
@@ -569,13 +1199,10 @@ int main(int argc, char* argv[]) {
 
             int pkt_count = 0;
             while (!g_stop) {
-                for (int i = 0; i < n_eps && !g_stop; ++i) {
-                    uint8_t ep  = (listen_ep >= 0)
-                                    ? static_cast<uint8_t>(listen_ep)
-                                    : known_eps[i].addr;
-                    int bufsz   = (listen_ep >= 0) ? 64 : known_eps[i].maxpkt;
-                    int got = mouse.try_recv(buf, bufsz, ep, 200);
-                    if (got > 0) {
+                mouse.poll_events(200);
+                for (uint8_t ep : eps) {
+                    int got;
+                    while ((got = mouse.try_recv(buf, sizeof(buf), ep, 0)) > 0) {
                         std::cout << "[pkt " << ++pkt_count << " | EP 0x"
                                   << std::hex << std::setw(2) << std::setfill('0')
                                   << static_cast<int>(ep) << " | " << std::dec
@@ -591,105 +1218,216 @@ int main(int argc, char* argv[]) {
             std::cout << "\nStopped.\n";
         }
 
-        // ---- --config FILE ----
-        bool did_config = false;
+        // ---- --dump ----
+        if (do_dump) {
+            std::cout << "=== Config memory ===\n";
+            double t_dump = timings.now_ms();
+            std::vector<ReadRange> ranges = full_memory_ranges();
+            MemoryDump mem;
+            size_t n_read = read_ranges(mouse, ranges, mem, READ_WINDOW, &rtt);
+            timings.end("dump", t_dump);
+            print_memory(mem, std::cout);
+            std::cout << "Read " << n_read << "/" << ranges.size() << " blocks.\n\n";
+            if (n_read == 0) {
+                std::cerr << "Error: the mouse answered none of the reads; the read command "
+                          << "may not be right for this hardware (see --probe-commands)\n";
+                exit_code = 1;
+            }
+        }
 
-        if (!config_file.empty()) {
-            std::cout << "=== Applying config: " << config_file << " ===\n";
-            Config cfg = parse_config_file(config_file);
-            cfg.profile = profile;
-            validate_config(cfg);
-            apply_config(mouse, cfg, btn_layout, is_compx);
-            did_config = true;
+        // ---- --apply-plan FILE ----
+        if (plan_file) {
+            std::cout << "=== Applying plan: " << plan_file_path << " ===\n";
+            double t_send = timings.now_ms();
+            PlanFile::Section first = plan_file->sections(model)
+                ? plan_file->section(model, 0) : PlanFile::Section{};
+            if (first.count && link != LinkKind::Wired &&
+                !probe_link(mouse, first.packets[0],
+                            rtt.known() ? 2 * rtt.deadline_ms() : ACK_TIMEOUT_MS))
+                throw std::runtime_error("the mouse does not answer — is it asleep or out of range?");
+
+            // Keep the device shadow honest about what was written.
+            ShadowImage shadow;
+            shadow.load(shadow_key);
+            SendOptions opts = send_opts;
+            opts.on_result = [&shadow](const Packet& p, bool ok, double) {
+                if (ok) shadow.record(p);
+                else    shadow.forget(p);
+            };
+            try {
+                send_plan_file(mouse, *plan_file, model, opts, &send_stats);
+            } catch (...) {
+                for (size_t s = 0; s < plan_file->sections(model); ++s) {
+                    PlanFile::Section sec = plan_file->section(model, s);
+                    for (size_t i = 0; i < sec.count; ++i) shadow.forget(sec.packets[i]);
+                }
+                shadow.save(shadow_key);
+                throw;
+            }
+            shadow.save(shadow_key);
+            timings.end("send", t_send);
+            if (send_opts.window > 1)
+                print_send_stats(send_stats, send_opts.window);
         }
 
-        // ---- inline --dpi args ----
-        if (!dpi_args.empty()) {
-            DpiSettings dpi;
-            for (auto& [slot, val] : dpi_args) {
-                if (slot >= 1 && slot <= 5)
-                    dpi.values[slot - 1] = val;
+        // ---- --config FILE and inline settings ----
+        if (plan_future.valid()) {
+            if (!config_file.empty())
+                std::cout << "=== " << (do_verify ? "Verifying" : "Applying")
+                          << " config: " << config_file << " ===\n";
+            double    t_wait = timings.now_ms();
+            BuiltPlan built  = plan_future.get();
+            // Another device than the first one found was opened.
+            if (built.model != model)
+                built = make_plan(model);
+            timings.span(built.cache.hit ? "plan (cached)" : "plan build (bg)",
+                         built.start_ms, built.end_ms);
+            if (do_timings) {
+                std::ostringstream pc;
+                if (built.cache.enabled)
+                    pc << (built.cache.hit ? "hit" : "miss") << " (" << built.cache.hits
+                       << " hits, " << built.cache.misses << " misses so far)";
+                else
+                    pc << "off (neither XDG_CACHE_HOME nor HOME is set)";
+                timings.note("plan cache", pc.str());
+                double hidden = std::min(built.end_ms, t_ready) -
+                                std::max(built.start_ms, t_open_start);
+                std::ostringstream ov;
+                ov << std::fixed << std::setprecision(1) << std::max(hidden, 0.0)
+                   << " ms of plan build ran during open/drain, first write waited "
+                   << std::max(built.end_ms - t_wait, 0.0) << " ms for it";
+                timings.note("overlap", ov.str());
             }
-            if (is_compx)
-                send_sequence(mouse, build_compx_dpi_packets(dpi), "DPI config");
-            else
-                send_sequence(mouse, build_dpi_packets(dpi), "DPI config");
-            did_config = true;
-        }
-
-        // ---- inline --led arg ----
-        if (!led_arg.empty()) {
-            LedMode mode;
-            std::string sl = led_arg;
-            for (auto& c : sl) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
-            if      (sl == "off")       mode = LedMode::Off;
-            else if (sl == "rainbow")   mode = LedMode::Rainbow;
-            else if (sl == "static")    mode = LedMode::Steady;
-            else if (sl == "steady")    mode = LedMode::Steady;
-            else if (sl == "breathing") mode = LedMode::Respiration;
-            else if (sl == "respiration") mode = LedMode::Respiration;
-            else {
-                std::cerr << "Error: unknown LED mode '" << led_arg
-                          << "'. Valid: off, rainbow, steady, respiration\n";
-                exit_code = 1;
+            PacketPlan plan = std::move(built.plan);
+
+            if (do_verify) {
+                double t_verify = timings.now_ms();
+                if (!verify_plan(mouse, plan, shadow_key, rtt)) exit_code = 1;
+                timings.end("verify", t_verify);
                 goto cleanup;
             }
-            if (is_compx) {
-                uint32_t slot_color = (mode == LedMode::Off) ? 0x000000 : 0x00ff00;
-                uint32_t colors[5] = {slot_color, slot_color, slot_color, slot_color, slot_color};
-                send_sequence(mouse, build_compx_color_packets(colors, 5), "LED color");
-            } else {
-                send_sequence(mouse, build_led_packets(mode), "LED mode");
-            }
-            did_config = true;
-        }
 
-        // ---- inline --button args ----
-        if (!btn_args.empty()) {
-            std::map<uint8_t, ActionBytes> btn_changes;
-            for (auto& [name, action_str] : btn_args) {
-                Button btn;
-                if (!parse_button_name(name, btn)) {
-                    std::cerr << "Error: unknown button name '" << name << "'\n";
-                    exit_code = 1;
-                    goto cleanup;
-                }
-                ActionBytes ab;
-                if (!parse_action(action_str, ab)) {
-                    std::cerr << "Error: unknown action '" << action_str << "'\n";
-                    exit_code = 1;
-                    goto cleanup;
-                }
-                btn_changes[static_cast<uint8_t>(btn)] = ab;
-                // Register multi-key actions for complex parsing
-                if (ab[0] == 0x90 && ab[3] > 1) {
-                    register_multikey_action(static_cast<uint8_t>(btn), action_str);
+            // Leave out what the mouse already holds.  The shadow is only
+            // updated once the plan has gone through; if it does not, every
+            // address it touched is forgotten.  An apply that was killed
+            // part-way never got that far, so its journal stands in.
+            ShadowImage shadow;
+            shadow.load(shadow_key);
+            ApplyJournal journal;
+            bool interrupted = journal.load(shadow_key);
+            if (interrupted)
+                for (auto& p : journal.packets()) shadow.forget(p);
+            if (use_shadow) {
+                size_t skipped = 0;
+                plan = diff_plan(plan, shadow, skipped);
+                if (plan.empty())
+                    std::cout << "Nothing to write — the mouse already holds these settings.\n";
+                else if (skipped)
+                    std::cout << "Skipping " << skipped << " packet(s) the mouse already holds.\n";
+            }
+            size_t resume_at = 0;
+            if (interrupted && journal.matches(plan)) {
+                resume_at = journal.acked();
+                std::cout << "Resuming an interrupted apply after " << resume_at << " of "
+                          << plan_packet_count(plan) << " packets.\n";
+            }
+            if (plan.empty())
+                journal.finish();
+            else
+                journal.begin(shadow_key, plan, resume_at);
+
+            std::vector<std::pair<Packet, bool>> results;  // in the order they settled
+            SendOptions opts = send_opts;
+            opts.on_result = [&results, &journal](const Packet& p, bool ok, double) {
+                results.push_back({p, ok});
+                if (ok) journal.ack(p);
+            };
+
+            double t_send = timings.now_ms();
+            size_t allocs_before_send = allocation_count();
+            PlanPosition from = journal.resume(plan);
+            int resets = 0;
+            try {
+                for (;;) {
+                    try {
+                        // A sleeping wireless mouse fails one short probe instead
+                        // of timing out every packet.  Wired links skip it.
+                        PlanPosition first;
+                        const Packet* probe = plan_packet(plan, first);
+                        if (probe && from.section == 0 && from.packet == 0 &&
+                            link != LinkKind::Wired &&
+                            !probe_link(mouse, *probe, rtt.known() ? 2 * rtt.deadline_ms()
+                                                                   : ACK_TIMEOUT_MS)) {
+                            throw LinkDownError(
+                                "the mouse does not answer — is it asleep or out of range?",
+                                PlanPosition{});
+                        }
+                        send_plan(mouse, plan, opts, &send_stats, from);
+                        break;
+                    } catch (const LinkDownError& e) {
+                        journal.flush();
+                        PlanPosition at = e.resume;
+                        const Packet* resume = plan_packet(plan, at);
+                        if (!wait_wake_s || !resume) throw;
+                        std::cout << e.what() << "\nWaiting up to " << wait_wake_s
+                                  << " s for it to wake — move the mouse or press a button...\n";
+                        std::signal(SIGINT, handle_sigint);
+                        if (!wait_for_wake(mouse, *resume, wait_wake_s * 1000u, g_stop))
+                            throw std::runtime_error("the mouse did not wake up");
+                        // Let the probes' ACKs land and drop them.
+                        uint8_t drain[64];
+                        while (mouse.try_recv(drain, sizeof(drain), INTERRUPT_EP_IN, 100) > 0) {}
+                        std::cout << "Awake — resuming at " << plan[at.section].heading
+                                  << ", packet " << at.packet + 1 << ".\n";
+                        from = at;
+                    } catch (const TransferError& e) {
+                        // A stalled or re-enumerating receiver: reset the
+                        // port and carry on from the first packet it has
+                        // not acknowledged.
+                        journal.flush();
+                        if (!e.resettable() || resets == MAX_RESETS) throw;
+                        ++resets;
+                        std::cout << e.what() << " — resetting the device.\n";
+                        if (!mouse.reset()) throw;
+                        PlanPosition at = journal.resume(plan);
+                        if (!plan_packet(plan, at)) break;
+                        std::cout << "Reset — resuming at " << plan[at.section].heading
+                                  << ", packet " << at.packet + 1 << ".\n";
+                        from = at;
+                    }
                 }
+            } catch (...) {
+                journal.flush();
+                shadow.forget(plan);
+                shadow.save(shadow_key);
+                throw;
             }
-            send_sequence(mouse,
-                          build_button_mapping(btn_changes, btn_layout),
-                          "Button mapping");
-            did_config = true;
-        }
-
-        // ---- inline --polling-rate arg ----
-        if (polling_rate_arg != 0) {
-            send_sequence(mouse,
-                          {build_polling_rate_packet(polling_rate_arg)},
-                          "Polling rate");
-            did_config = true;
+            // Packets acknowledged before the interruption count as well.
+            for (size_t i = 0; i < resume_at; ++i)
+                shadow.record(journal.packets()[i]);
+            for (auto& [p, ok] : results) {
+                if (ok) shadow.record(p);
+                else    shadow.forget(p);
+            }
+            shadow.save(shadow_key);
+            journal.finish();
+            timings.end("send", t_send);
+            if (do_timings && allocation_counting())
+                timings.note("heap allocs", std::to_string(allocation_count() - allocs_before_send) +
+                                                " during send, " +
+                                                std::to_string(allocation_count()) + " in all");
+            if (send_opts.window > 1)
+                print_send_stats(send_stats, send_opts.window);
         }
 
-        // ---- commit ----
-        // The Redragon software always ends a config session with two
-        // "08 04 00..." packets (observed in USB captures).  These appear
-        // to act as a commit/apply-to-flash command.
-        if (did_config) {
-            Packet commit{};
-            commit[0] = 0x08;
-            commit[1] = 0x04;
-            commit[16] = compute_checksum(commit);  // = 0x49
-            send_sequence(mouse, {commit, commit}, "Commit");
+        // ---- --daemon ----
+        if (do_daemon) {
+            std::signal(SIGINT, handle_sigint);
+            std::signal(SIGTERM, handle_sigint);
+            daemon_opts.send       = send_opts;
+            daemon_opts.shadow_key = shadow_key;
+            daemon_opts.use_shadow = use_shadow;
+            exit_code = run_daemon(mouse, model, daemon_opts, g_stop);
         }
 
     } catch (const std::exception& e) {
@@ -698,6 +1436,26 @@ int main(int argc, char* argv[]) {
     }
 
 cleanup:
+    rtt.save(rtt_key);
+    double t_close = timings.now_ms();
     mouse.close();
+    if (do_timings) {
+        timings.end("close", t_close);
+        std::ostringstream stall;
+        stall << std::fixed << std::setprecision(1) << mouse.input_stall_ms() << " ms"
+              << (mouse.input_stall_ms() > 0 ? " (pointer interface detached)"
+                                             : " (pointer left with the kernel)");
+        timings.note("input stall", stall.str());
+        std::ostringstream ack;
+        ack << std::fixed << std::setprecision(1);
+        if (rtt.known())
+            ack << "srtt " << rtt.srtt_ms() << " ms, p95 " << rtt.p95_ms() << " ms -> ";
+        else
+            ack << "learning -> ";
+        ack << "deadline " << rtt.deadline_ms() << " ms, " << rtt.retries()
+            << " resend(s) (" << rtt.samples() << " samples)";
+        timings.note("ack rtt", ack.str());
+        timings.print(std::cout);
+    }
     return exit_code;
 }
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "protocol.h"
+
+// -----------------------------------------------------------------------
+// Packet layouts
+//
+// Every host→device packet the builders make is a write to the mouse's
+// config memory:
+//
+//   [0..2]   08 07 00     write command
+//   [3..4]   address      big-endian
+//   [5]      length       payload bytes used (at most 10)
+//   [6..15]  payload
+//   [16]     checksum     compute_checksum()
+//
+// A register is declared once, as a PacketWrite (one address) or a
+// PacketTable (the same register repeated at a stride, e.g. per DPI slot
+// or per button), together with its payload fields:
+//
+//   PacketField<Off, N>    N bytes at payload offset Off
+//   CheckedField<Off, N>   N bytes followed by their inner checksum,
+//                          0x55 - sum(bytes), which the mouse checks
+//                          for every value
+//
+// Offsets and sizes are template arguments, so a field that does not fit
+// its register fails to compile, and setting fields inlines to the same
+// byte stores as writing them by hand.
+// -----------------------------------------------------------------------
+
+static constexpr int PACKET_PAYLOAD     = 6;   // offset of payload byte 0
+static constexpr int PACKET_MAX_PAYLOAD = 10;
+
+// The 08 07 00 write command, address and length.
+constexpr void set_packet_write(Packet& p, uint16_t addr, uint8_t len) {
+    p[0] = 0x08;
+    p[1] = 0x07;
+    p[2] = 0x00;
+    p[3] = static_cast<uint8_t>(addr >> 8);
+    p[4] = static_cast<uint8_t>(addr & 0xFF);
+    p[5] = len;
+}
+
+// Fill in the outer checksum once all fields are set.
+constexpr void seal_packet(Packet& p) {
+    p[M913_PACKET_SIZE - 1] = compute_checksum(p);
+}
+
+// A write of `n` bytes from `data` to `addr`, checksummed.  For data with
+// no fixed layout (key macros).
+inline Packet packet_write(uint16_t addr, const uint8_t* data, size_t n) {
+    if (n > PACKET_MAX_PAYLOAD) throw std::length_error("packet payload too long");
+    Packet p{};
+    set_packet_write(p, addr, static_cast<uint8_t>(n));
+    for (size_t i = 0; i < n; ++i)
+        p[PACKET_PAYLOAD + i] = data[i];
+    seal_packet(p);
+    return p;
+}
+
+// N payload bytes at offset Off of a register of Len bytes.
+template <int Off, int N, int Len = PACKET_MAX_PAYLOAD>
+struct PacketField {
+    static_assert(Len > 0 && Len <= PACKET_MAX_PAYLOAD, "register longer than a packet payload");
+    static_assert(Off >= 0 && N > 0 && Off + N <= Len, "field lies outside its register");
+
+    static constexpr int at = PACKET_PAYLOAD + Off;  // packet offset
+
+    template <class... V>
+    static constexpr void set(Packet& p, V... v) {
+        static_assert(sizeof...(V) == N, "wrong number of bytes for the field");
+        const uint8_t bytes[] = {static_cast<uint8_t>(v)...};
+        for (int i = 0; i < N; ++i)
+            p[at + i] = bytes[i];
+    }
+
+    static constexpr void copy(Packet& p, const uint8_t* bytes) {
+        for (int i = 0; i < N; ++i)
+            p[at + i] = bytes[i];
+    }
+};
+
+// N value bytes at offset Off, then their inner checksum.
+template <int Off, int N, int Len = PACKET_MAX_PAYLOAD>
+struct CheckedField {
+    static_assert(Off + N < Len, "inner checksum lies outside its register");
+
+    using Value = PacketField<Off, N, Len>;
+    static constexpr int at = Value::at;
+
+    template <class... V>
+    static constexpr void set(Packet& p, V... v) {
+        Value::set(p, v...);
+        unsigned sum = (0u + ... + static_cast<uint8_t>(v));
+        p[at + N] = static_cast<uint8_t>((0x55 - sum) & 0xFF);
+    }
+};
+
+// A register of Len bytes at Addr.
+template <uint16_t Addr, int Len>
+struct PacketWrite {
+    static_assert(Len > 0 && Len <= PACKET_MAX_PAYLOAD, "register longer than a packet payload");
+
+    static constexpr uint16_t address = Addr;
+    static constexpr uint8_t  length  = Len;
+
+    template <int Off, int N> using field   = PacketField<Off, N, Len>;
+    template <int Off, int N> using checked = CheckedField<Off, N, Len>;
+
+    // The write with every field zero.
+    static constexpr Packet blank() {
+        Packet p{};
+        set_packet_write(p, Addr, Len);
+        return p;
+    }
+
+    // True if `p` is a write of this register (for checking templates).
+    static constexpr bool describes(const Packet& p) {
+        Packet head = blank();
+        for (int i = 0; i < PACKET_PAYLOAD; ++i)
+            if (p[i] != head[i]) return false;
+        return true;
+    }
+};
+
+// Count registers of Len bytes, Stride apart from Base.
+template <uint16_t Base, uint16_t Stride, size_t Count, int Len>
+struct PacketTable {
+    static_assert(Len > 0 && Len <= PACKET_MAX_PAYLOAD, "register longer than a packet payload");
+
+    static constexpr size_t  count  = Count;
+    static constexpr uint8_t length = Len;
+
+    template <int Off, int N> using field   = PacketField<Off, N, Len>;
+    template <int Off, int N> using checked = CheckedField<Off, N, Len>;
+
+    static constexpr uint16_t address(size_t i) {
+        if (i >= Count) throw std::out_of_range("register index out of range");
+        return static_cast<uint16_t>(Base + i * Stride);
+    }
+
+    static constexpr Packet blank(size_t i) {
+        Packet p{};
+        set_packet_write(p, address(i), Len);
+        return p;
+    }
+
+    static constexpr bool describes(size_t i, const Packet& p) {
+        Packet head = blank(i);
+        for (int k = 0; k < PACKET_PAYLOAD; ++k)
+            if (p[k] != head[k]) return false;
+        return true;
+    }
+};
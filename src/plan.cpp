@@ -0,0 +1,249 @@
+#include "plan.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include "data.h"
+#include "image.h"
+
+// -----------------------------------------------------------------------
+// DPI
+// -----------------------------------------------------------------------
+
+void check_dpi(uint16_t dpi, DeviceModel model) {
+    if (model == DeviceModel::Compx ? compx_dpi_supported(dpi) : dpi_supported(dpi))
+        return;
+    std::string msg = "DPI " + std::to_string(dpi) + " is not supported on " +
+                      model_name(model) + " hardware";
+    if (model == DeviceModel::Areson) {
+        int below = 0, above = 0;
+        for (int d = dpi - dpi % 100; d >= 100 && !below; d -= 100)
+            if (d != dpi && dpi_supported(static_cast<uint16_t>(d))) below = d;
+        for (int d = dpi - dpi % 100 + 100; d <= 16000 && !above; d += 100)
+            if (dpi_supported(static_cast<uint16_t>(d))) above = d;
+        if (below || above) {
+            msg += " (nearest: ";
+            if (below) msg += std::to_string(below);
+            if (below && above) msg += ", ";
+            if (above) msg += std::to_string(above);
+            msg += ")";
+        }
+    } else {
+        msg += " (50–" + std::to_string(COMPX_MAX_DPI) + " in steps of 50)";
+    }
+    throw std::runtime_error(msg);
+}
+
+// -----------------------------------------------------------------------
+// Config file
+// -----------------------------------------------------------------------
+
+void write_config_sections(ConfigImage& image, const Config& cfg, DeviceModel model) {
+    const bool is_compx = (model == DeviceModel::Compx);
+    PacketBatch batch;
+
+    // ---- Buttons ----
+    std::map<uint8_t, ButtonAction> btn_changes;
+    for (auto& [key, action_str] : cfg.buttons) {
+        Button btn;
+        if (!parse_button_name(key, btn)) {
+            std::cerr << "  Warning: unknown button '" << key << "', skipping\n";
+            continue;
+        }
+        ButtonAction action;
+        if (!parse_action(action_str, action)) {
+            std::cerr << "  Warning: unknown action '" << action_str
+                      << "' for " << key << ", skipping\n";
+            continue;
+        }
+        btn_changes[static_cast<uint8_t>(btn)] = action;
+    }
+    if (!btn_changes.empty()) {
+        batch.clear();
+        batch.extend(build_button_mapping(btn_changes, button_layout(model),
+                                          batch.tail(), batch.room()));
+        image.write_packets(batch, "Button mapping");
+    }
+
+    // ---- DPI ----
+    bool any_dpi = false;
+    for (int i = 0; i < 5; ++i)
+        if (cfg.dpi[i].value != 0) { any_dpi = true; break; }
+
+    if (any_dpi) {
+        DpiSettings dpi;
+        for (int i = 0; i < 5; ++i) {
+            if (cfg.dpi[i].value) check_dpi(cfg.dpi[i].value, model);
+            dpi.values[i]  = cfg.dpi[i].value;
+            dpi.enabled[i] = cfg.dpi[i].enabled;
+        }
+        batch.clear();
+        if (is_compx)
+            batch.extend(build_compx_dpi_packets(dpi, batch.tail(), batch.room()));
+        else
+            batch.extend(build_dpi_packets(dpi, batch.tail(), batch.room()));
+        image.write_packets(batch, "DPI config");
+    }
+
+    // ---- LED ----
+    if (is_compx) {
+        // Compx has per-slot RGB colors, no global LED modes.
+        //   [led] section    → applies one color to every active slot
+        //                       (mode=off → black)
+        //   dpiN_color keys  → override individual slots, take precedence
+        bool any_color = cfg.led.set;
+        for (int i = 0; i < 5; ++i)
+            if (cfg.dpi[i].color != 0xFFFFFFFF) any_color = true;
+
+        if (any_color) {
+            int n_slots = 1;
+            for (int i = 0; i < 5; ++i)
+                if (cfg.dpi[i].enabled) n_slots = i + 1;
+
+            uint32_t colors[5];
+            uint32_t global = cfg.led.set
+                ? ((cfg.led.mode == LedMode::Off) ? 0x000000 : cfg.led.color)
+                : 0xFFFFFFFF;
+            for (int i = 0; i < 5; ++i)
+                colors[i] = (cfg.dpi[i].color != 0xFFFFFFFF) ? cfg.dpi[i].color : global;
+
+            batch.clear();
+            batch.extend(build_compx_color_packets(colors, n_slots, batch.tail(), batch.room()));
+            image.write_packets(batch, "LED color");
+        }
+    } else if (cfg.led.set) {
+        batch.clear();
+        batch.extend(build_led_packets(cfg.led.mode, cfg.led.color, cfg.led.brightness,
+                                       cfg.led.speed, batch.tail(), batch.room()));
+        image.write_packets(batch, "LED mode");
+    }
+
+    // ---- Polling rate ----
+    if (cfg.mouse.set)
+        image.write_packet(build_polling_rate_packet(cfg.mouse.polling_rate), "Polling rate");
+}
+
+// -----------------------------------------------------------------------
+// Command-line settings
+// -----------------------------------------------------------------------
+
+void write_inline_sections(ConfigImage& image, const InlineSettings& args, DeviceModel model) {
+    const bool is_compx = (model == DeviceModel::Compx);
+    PacketBatch batch;
+
+    // ---- --dpi ----
+    if (!args.dpi.empty()) {
+        DpiSettings dpi;
+        for (auto& [slot, val] : args.dpi) {
+            check_dpi(val, model);
+            if (slot >= 1 && slot <= 5)
+                dpi.values[slot - 1] = val;
+        }
+        batch.clear();
+        if (is_compx)
+            batch.extend(build_compx_dpi_packets(dpi, batch.tail(), batch.room()));
+        else
+            batch.extend(build_dpi_packets(dpi, batch.tail(), batch.room()));
+        image.write_packets(batch, "DPI config");
+    }
+
+    // ---- --led ----
+    if (!args.led_mode.empty()) {
+        LedMode mode;
+        std::string sl = args.led_mode;
+        for (auto& c : sl) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if      (sl == "off")       mode = LedMode::Off;
+        else if (sl == "rainbow")   mode = LedMode::Rainbow;
+        else if (sl == "static")    mode = LedMode::Steady;
+        else if (sl == "steady")    mode = LedMode::Steady;
+        else if (sl == "breathing") mode = LedMode::Respiration;
+        else if (sl == "respiration") mode = LedMode::Respiration;
+        else
+            throw std::runtime_error("unknown LED mode '" + args.led_mode +
+                                     "'. Valid: off, rainbow, steady, respiration");
+        if (is_compx) {
+            uint32_t slot_color = (mode == LedMode::Off) ? 0x000000 : 0x00ff00;
+            uint32_t colors[5] = {slot_color, slot_color, slot_color, slot_color, slot_color};
+            batch.clear();
+            batch.extend(build_compx_color_packets(colors, 5, batch.tail(), batch.room()));
+            image.write_packets(batch, "LED color");
+        } else {
+            batch.clear();
+            batch.extend(build_led_packets(mode, LED_DEFAULT_COLOR, LED_DEFAULT_BRIGHTNESS,
+                                           LED_DEFAULT_SPEED, batch.tail(), batch.room()));
+            image.write_packets(batch, "LED mode");
+        }
+    }
+
+    // ---- --button ----
+    if (!args.buttons.empty()) {
+        std::map<uint8_t, ButtonAction> btn_changes;
+        for (auto& [name, action_str] : args.buttons) {
+            Button btn;
+            if (!parse_button_name(name, btn))
+                throw std::runtime_error("unknown button name '" + name + "'");
+            ButtonAction action;
+            if (!parse_action(action_str, action))
+                throw std::runtime_error("unknown action '" + action_str + "'");
+            btn_changes[static_cast<uint8_t>(btn)] = action;
+        }
+        batch.clear();
+        batch.extend(build_button_mapping(btn_changes, button_layout(model),
+                                          batch.tail(), batch.room()));
+        image.write_packets(batch, "Button mapping");
+    }
+
+    // ---- --polling-rate ----
+    if (args.polling_rate != 0)
+        image.write_packet(build_polling_rate_packet(args.polling_rate), "Polling rate");
+}
+
+// -----------------------------------------------------------------------
+// Whole plan
+// -----------------------------------------------------------------------
+
+PacketPlan build_plan(const Config* cfg, const InlineSettings& args, DeviceModel model) {
+    ConfigImage image;
+    if (cfg)
+        write_config_sections(image, *cfg, model);
+    write_inline_sections(image, args, model);
+    PacketPlan plan = plan_writes(image);
+    append_commit(plan);
+    return plan;
+}
+
+// -----------------------------------------------------------------------
+// Commit
+// -----------------------------------------------------------------------
+
+void append_commit(PacketPlan& plan) {
+    if (plan.empty()) return;
+
+    // Sent twice, as the Redragon software does (see COMMIT_PACKET).
+    plan.push_back({"Commit", {COMMIT_PACKET, COMMIT_PACKET}, true});
+}
+
+size_t plan_packet_count(const PacketPlan& plan) {
+    size_t n = 0;
+    for (auto& s : plan) n += s.packets.size();
+    return n;
+}
+
+const Packet* plan_packet(const PacketPlan& plan, PlanPosition& pos) {
+    while (pos.section < plan.size() && pos.packet >= plan[pos.section].packets.size()) {
+        ++pos.section;
+        pos.packet = 0;
+    }
+    if (pos.section >= plan.size()) return nullptr;
+    return &plan[pos.section].packets[pos.packet];
+}
+
+PlanPosition plan_position(const PacketPlan& plan, size_t index) {
+    PlanPosition pos;
+    while (pos.section < plan.size() && index >= plan[pos.section].packets.size()) {
+        index -= plan[pos.section].packets.size();
+        ++pos.section;
+    }
+    pos.packet = index;
+    return pos;
+}
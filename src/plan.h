@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+#include "protocol.h"
+#include "transport.h"
+
+// -----------------------------------------------------------------------
+// Packet plans
+//
+// A plan is the complete, ordered list of packets one invocation writes,
+// grouped into titled sections ("Button mapping", "DPI config", ...) and
+// ending with the commit.  Settings are collected in a ConfigImage first
+// (see image.h), so each address is written once.  Building it needs only the hardware revision,
+// not an open device, so plans can be built once and streamed to many mice.
+// -----------------------------------------------------------------------
+
+// Hardware revision.  Selects packet formats, the button layout and the
+// SET_REPORT report type.
+enum class DeviceModel : uint8_t {
+    Areson,  // original hardware, VID 25a7
+    Compx,   // newer tri-mode hardware, VID 3554
+};
+
+inline DeviceModel model_for_vid(uint16_t vid) {
+    return vid == COMPX_VID ? DeviceModel::Compx : DeviceModel::Areson;
+}
+
+inline const char* model_name(DeviceModel m) {
+    return m == DeviceModel::Compx ? "Compx" : "Areson";
+}
+
+// Button translation table for build_button_mapping (nullptr = identity).
+inline const uint8_t* button_layout(DeviceModel m) {
+    return m == DeviceModel::Compx ? COMPX_LAYOUT : nullptr;
+}
+
+// wValue for SET_REPORT: Areson uses a feature report, Compx an output report.
+inline uint16_t ctrl_value_for(DeviceModel m) {
+    return m == DeviceModel::Compx ? 0x0208 : CTRL_VALUE;
+}
+
+// One titled group of packets, sent with send_sequence().
+struct PlanSection {
+    std::string         heading;
+    std::vector<Packet> packets;
+    bool                lock_step = false;  // never pipelined (commit)
+};
+
+using PacketPlan = std::vector<PlanSection>;
+
+// A packet in a plan: section index and index within that section.
+struct PlanPosition {
+    size_t section = 0;
+    size_t packet  = 0;
+};
+
+// Settings given as command-line options (--dpi, --led, --button,
+// --polling-rate).  They are applied after any config file.
+struct InlineSettings {
+    std::vector<std::pair<int, uint16_t>>       dpi;           // slot (1-5), value
+    std::string                                 led_mode;      // "" = not set
+    std::vector<std::pair<std::string, std::string>> buttons;  // name, action
+    uint16_t                                    polling_rate = 0;  // 0 = not set
+
+    bool empty() const {
+        return dpi.empty() && led_mode.empty() && buttons.empty() && polling_rate == 0;
+    }
+};
+
+class ConfigImage;
+
+// Throw std::runtime_error, naming the nearest values that work, if DPI
+// `dpi` cannot be set on `model` hardware.  validate_config() only knows
+// the common 100–16000 range; the sections below check each value
+// against the hardware revision before any packet is built.
+void check_dpi(uint16_t dpi, DeviceModel model);
+
+// Write the settings of a parsed and validated config file into `image`.
+void write_config_sections(ConfigImage& image, const Config& cfg, DeviceModel model);
+
+// Write command-line settings into `image`, over anything already there.
+// Throws std::runtime_error on an unknown LED mode, button name or action.
+void write_inline_sections(ConfigImage& image, const InlineSettings& args, DeviceModel model);
+
+// Build the plan for a config file (may be nullptr) followed by
+// command-line settings: both are written into one ConfigImage, planned
+// with plan_writes() and closed with the commit.
+PacketPlan build_plan(const Config* cfg, const InlineSettings& args, DeviceModel model);
+
+// Append the commit section.  Does nothing if the plan is empty.
+void append_commit(PacketPlan& plan);
+
+// Total number of packets across all sections.
+size_t plan_packet_count(const PacketPlan& plan);
+
+// The packet at `pos`, first moving `pos` forward past the end of its
+// section if needed.  nullptr once `pos` is past the end of the plan.
+const Packet* plan_packet(const PacketPlan& plan, PlanPosition& pos);
+
+// The position `index` packets into the plan, counting across sections;
+// past the end once `index` reaches plan_packet_count().
+PlanPosition plan_position(const PacketPlan& plan, size_t index);
@@ -0,0 +1,231 @@
+#include "plancache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <map>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "discovery.h"
+#include "planfile.h"
+
+// $XDG_CACHE_HOME/m913-ctl (or ~/.cache/m913-ctl), created on demand;
+// "" if neither variable is set.
+static std::string plan_cache_dir() {
+    std::string base;
+    if (const char* x = std::getenv("XDG_CACHE_HOME"); x && *x) {
+        base = x;
+    } else if (const char* home = std::getenv("HOME"); home && *home) {
+        base = std::string(home) + "/.cache";
+    } else {
+        return "";
+    }
+    mkdir(base.c_str(), 0700);
+    std::string dir = base + "/m913-ctl";
+    mkdir(dir.c_str(), 0700);
+    return dir;
+}
+
+// ---- key ----
+//
+// 64-bit FNV-1a over length-prefixed fields.
+
+static void mix(uint64_t& h, const void* data, size_t len) {
+    auto* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+}
+
+static void mix(uint64_t& h, const std::string& s) {
+    uint64_t len = s.size();
+    mix(h, &len, sizeof(len));
+    mix(h, s.data(), s.size());
+}
+
+static void mix(uint64_t& h, uint64_t v) { mix(h, &v, sizeof(v)); }
+
+static std::string cache_key(const std::string& ini, Profile profile,
+                             const InlineSettings& args, DeviceModel model) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    mix(h, std::string(APP_VERSION));
+    mix(h, PLAN_FILE_VERSION);
+    // A rebuilt binary may plan differently under the same version string
+    // (development builds are all "dev").
+    struct stat exe{};
+    if (stat("/proc/self/exe", &exe) == 0) {
+        mix(h, static_cast<uint64_t>(exe.st_size));
+        mix(h, static_cast<uint64_t>(exe.st_mtim.tv_sec));
+        mix(h, static_cast<uint64_t>(exe.st_mtim.tv_nsec));
+    }
+    mix(h, static_cast<uint64_t>(model));
+    mix(h, static_cast<uint64_t>(profile));
+    mix(h, ini);
+
+    mix(h, args.dpi.size());
+    for (auto& [slot, value] : args.dpi) {
+        mix(h, static_cast<uint64_t>(slot));
+        mix(h, value);
+    }
+    mix(h, args.led_mode);
+    mix(h, args.buttons.size());
+    for (auto& [name, action] : args.buttons) {
+        mix(h, name);
+        mix(h, action);
+    }
+    mix(h, args.polling_rate);
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(h));
+    return hex;
+}
+
+// ---- eviction ----
+
+// Drop the least recently used plans (by mtime, which a hit refreshes)
+// until the cache is within its bounds.
+static void evict(const std::string& dir) {
+    struct Entry {
+        std::string path;
+        off_t       size;
+        timespec    used;
+    };
+    std::vector<Entry> entries;
+    size_t total = 0;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() < 5 || name.compare(name.size() - 5, 5, ".plan") != 0) continue;
+            std::string path = dir + "/" + name;
+            struct stat st{};
+            if (stat(path.c_str(), &st) != 0) continue;
+            entries.push_back({path, st.st_size, st.st_mtim});
+            total += static_cast<size_t>(st.st_size);
+        }
+        closedir(d);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec
+                                              : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    size_t count = entries.size();
+    for (auto& e : entries) {
+        if (count <= PLAN_CACHE_MAX_ENTRIES && total <= PLAN_CACHE_MAX_BYTES) break;
+        std::remove(e.path.c_str());
+        --count;
+        total -= static_cast<size_t>(e.size);
+    }
+}
+
+// ---- counters ----
+
+// Read-modify-write of the stats file under an exclusive lock on a
+// separate lock file (the stats file itself is replaced by rename), so
+// concurrent runs do not lose counts.  If the lock cannot be taken the
+// update still happens, unlocked: the counters are for --timings only.
+static void count(const std::string& dir, PlanCacheStats* stats) {
+    std::string path = dir + "/stats";
+    int lock = ::open((path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock >= 0) {
+        while (flock(lock, LOCK_EX) < 0 && errno == EINTR) {}
+    }
+    auto lines = load_cache_lines(path);
+    unsigned long hits   = std::strtoul(lines["hits"].c_str(), nullptr, 10);
+    unsigned long misses = std::strtoul(lines["misses"].c_str(), nullptr, 10);
+    if (stats->hit) ++hits;
+    else            ++misses;
+    lines["hits"]   = std::to_string(hits);
+    lines["misses"] = std::to_string(misses);
+    save_cache_lines(path, lines);
+    if (lock >= 0) ::close(lock);  // releases the lock
+    stats->hits   = hits;
+    stats->misses = misses;
+}
+
+// ---- lookup ----
+
+static PacketPlan build(const std::string& config_file, Profile profile,
+                        const InlineSettings& args, DeviceModel model) {
+    Config cfg;
+    bool   have_cfg = !config_file.empty();
+    if (have_cfg) {
+        cfg = parse_config_file(config_file);
+        cfg.profile = profile;
+        validate_config(cfg);
+    }
+    return build_plan(have_cfg ? &cfg : nullptr, args, model);
+}
+
+PacketPlan load_plan(const std::string& config_file, Profile profile,
+                     const InlineSettings& args, DeviceModel model,
+                     PlanCacheStats* stats) {
+    PlanCacheStats local;
+    if (!stats) stats = &local;
+    *stats = PlanCacheStats{};
+
+    std::string ini;
+    if (!config_file.empty()) {
+        std::ifstream f(config_file, std::ios::binary);
+        // Unreadable: let the parser report it.
+        if (!f) return build(config_file, profile, args, model);
+        ini.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+    std::string dir = plan_cache_dir();
+    if (dir.empty()) return build(config_file, profile, args, model);
+    stats->enabled = true;
+
+    std::string path = dir + "/" + cache_key(ini, profile, args, model) + ".plan";
+    try {
+        PlanFile file(path);
+        PacketPlan plan = file.plan(model);
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        stats->hit = true;
+        count(dir, stats);
+        return plan;
+    } catch (const std::exception&) {
+        // Missing or damaged: build it (again).
+    }
+
+    PacketPlan plan = build(config_file, profile, args, model);
+    try {
+        write_plan_file(path, {{model, plan}});
+        evict(dir);
+    } catch (const std::exception&) {
+        // Read-only or full cache: just build every time.
+    }
+    count(dir, stats);
+    return plan;
+}
+
+std::map<DeviceModel, PacketPlan> load_plans(const std::string& config_file, Profile profile,
+                                             const InlineSettings& args, bool use_cache,
+                                             std::map<DeviceModel, std::string>* errors) {
+    std::map<DeviceModel, PacketPlan> plans;
+    std::string error;
+    for (DeviceModel m : {DeviceModel::Areson, DeviceModel::Compx}) {
+        try {
+            plans[m] = use_cache ? load_plan(config_file, profile, args, m)
+                                 : build(config_file, profile, args, m);
+        } catch (const std::exception& e) {
+            if (error.empty()) error = e.what();
+            if (errors) (*errors)[m] = e.what();
+        }
+    }
+    if (plans.empty()) throw std::runtime_error(error);
+    if (!error.empty() && !errors)
+        std::cerr << "Warning: " << error << "; only "
+                  << model_name(plans.begin()->first) << " mice will be configured\n";
+    return plans;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include "config.h"
+#include "plan.h"
+#include "protocol.h"
+
+// -----------------------------------------------------------------------
+// Plan cache
+//
+// Built plans are kept in $XDG_CACHE_HOME/m913-ctl (~/.cache/m913-ctl
+// without it) as plan files (see planfile.h), named by a hash of
+// everything the plan depends on: the INI file's contents, --profile, the
+// command-line settings, the hardware revision, and the m913-ctl version
+// and binary.  A hit maps the file instead of parsing, validating and
+// building; editing the INI file (or upgrading) simply misses.
+//
+// The cache is best-effort: a damaged entry is rebuilt and any I/O error
+// falls back to building.  It holds at most PLAN_CACHE_MAX_ENTRIES plans
+// and PLAN_CACHE_MAX_BYTES; the least recently used are evicted first.
+// -----------------------------------------------------------------------
+
+static constexpr size_t PLAN_CACHE_MAX_ENTRIES = 32;
+static constexpr size_t PLAN_CACHE_MAX_BYTES   = 256 * 1024;
+
+// What load_plan() did, for --timings.  `hits` and `misses` are running
+// totals kept in the cache directory.
+struct PlanCacheStats {
+    bool          enabled = false;  // false: no cache directory
+    bool          hit     = false;
+    unsigned long hits    = 0;
+    unsigned long misses  = 0;
+};
+
+// The plan for a config file ("" = none) plus command-line settings, from
+// the cache or built (and stored) as build_plan() would.  Parse and
+// validation errors are thrown as by parse_config_file()/validate_config().
+PacketPlan load_plan(const std::string& config_file, Profile profile,
+                     const InlineSettings& args, DeviceModel model,
+                     PlanCacheStats* stats = nullptr);
+
+// load_plan() for every hardware revision, for callers that do not know
+// which they will meet.  A revision the settings do not suit (a DPI only
+// the other one has) is left out: its error goes into `errors` if given,
+// else a warning to stderr.  The error is thrown only if no revision is
+// left.  With use_cache false the plans are built without touching the
+// cache directory (--udev-apply does no file I/O beyond the config).
+std::map<DeviceModel, PacketPlan> load_plans(const std::string& config_file, Profile profile,
+                                             const InlineSettings& args, bool use_cache = true,
+                                             std::map<DeviceModel, std::string>* errors = nullptr);
@@ -0,0 +1,199 @@
+#include "planfile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char   MAGIC[8]      = {'M', '9', '1', '3', 'P', 'L', 'A', 'N'};
+static constexpr size_t HEADER_SIZE   = 16;
+static constexpr size_t ENTRY_SIZE    = 8;
+static constexpr size_t SECTION_HEAD  = 4;
+static constexpr uint8_t FLAG_LOCK_STEP = 0x01;
+
+static uint16_t get16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+
+static uint32_t get32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void put16(std::string& out, uint16_t v) {
+    out += static_cast<char>(v & 0xFF);
+    out += static_cast<char>(v >> 8);
+}
+
+static void put32(std::string& out, size_t at, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        out[at + static_cast<size_t>(i)] = static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+// -----------------------------------------------------------------------
+// Writing
+// -----------------------------------------------------------------------
+
+void write_plan_file(const std::string& path, const std::map<DeviceModel, PacketPlan>& plans) {
+    std::string out(MAGIC, sizeof(MAGIC));
+    put16(out, PLAN_FILE_VERSION);
+    put16(out, static_cast<uint16_t>(plans.size()));
+    out.append(4, '\0');  // file size, filled in below
+    size_t table = out.size();
+    out.append(ENTRY_SIZE * plans.size(), '\0');
+
+    size_t entry = table;
+    for (auto& [model, plan] : plans) {
+        out[entry]     = static_cast<char>(model);
+        out[entry + 2] = static_cast<char>(plan.size() & 0xFF);
+        out[entry + 3] = static_cast<char>(plan.size() >> 8);
+        put32(out, entry + 4, static_cast<uint32_t>(out.size()));
+        entry += ENTRY_SIZE;
+
+        for (auto& section : plan) {
+            size_t hlen = std::min<size_t>(section.heading.size(), 255);
+            put16(out, static_cast<uint16_t>(section.packets.size()));
+            out += static_cast<char>(section.lock_step ? FLAG_LOCK_STEP : 0);
+            out += static_cast<char>(hlen);
+            out.append(section.heading, 0, hlen);
+            for (auto& p : section.packets)
+                out.append(reinterpret_cast<const char*>(p.data()), p.size());
+        }
+    }
+    put32(out, 12, static_cast<uint32_t>(out.size()));
+
+    // Per process: two runs started by udev may store the same cached plan.
+    std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+        throw std::runtime_error("cannot write " + tmp + ": " + std::strerror(errno));
+    bool ok = std::fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::string err = std::strerror(errno);
+        std::remove(tmp.c_str());
+        throw std::runtime_error("cannot write " + path + ": " + err);
+    }
+}
+
+// -----------------------------------------------------------------------
+// Reading
+// -----------------------------------------------------------------------
+
+PlanFile::PlanFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(HEADER_SIZE)) {
+        ::close(fd);
+        throw std::runtime_error(path + " is not a plan file");
+    }
+    _size = static_cast<size_t>(st.st_size);
+    void* m = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED)
+        throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+    _data = static_cast<const uint8_t*>(m);
+
+    auto fail = [&](const std::string& why) {
+        munmap(const_cast<uint8_t*>(_data), _size);
+        _data = nullptr;
+        throw std::runtime_error(path + ": " + why);
+    };
+    if (std::memcmp(_data, MAGIC, sizeof(MAGIC)) != 0) fail("not a plan file");
+    if (get16(_data + 8) != PLAN_FILE_VERSION)
+        fail("plan format version " + std::to_string(get16(_data + 8)) +
+             " (this m913-ctl reads version " + std::to_string(PLAN_FILE_VERSION) +
+             "); compile it again");
+    size_t n_plans = get16(_data + 10);
+    if (get32(_data + 12) != _size || HEADER_SIZE + ENTRY_SIZE * n_plans > _size)
+        fail("file is truncated or damaged");
+
+    for (size_t e = 0; e < n_plans; ++e) {
+        const uint8_t* entry = _data + HEADER_SIZE + ENTRY_SIZE * e;
+        if (entry[0] > static_cast<uint8_t>(DeviceModel::Compx)) fail("unknown hardware revision");
+        size_t off = get32(entry + 4);
+        for (size_t s = 0, n = get16(entry + 2); s < n; ++s) {
+            if (off + SECTION_HEAD > _size) fail("file is truncated or damaged");
+            size_t count = get16(_data + off);
+            size_t body  = SECTION_HEAD + _data[off + 3];
+            if (off + body + count * M913_PACKET_SIZE > _size)
+                fail("file is truncated or damaged");
+            auto* pkts = reinterpret_cast<const Packet*>(_data + off + body);
+            for (size_t i = 0; i < count; ++i)
+                if (pkts[i][M913_PACKET_SIZE - 1] != compute_checksum(pkts[i]))
+                    fail("bad packet checksum");
+            off += body + count * M913_PACKET_SIZE;
+        }
+    }
+}
+
+PlanFile::~PlanFile() {
+    if (_data) munmap(const_cast<uint8_t*>(_data), _size);
+}
+
+size_t PlanFile::_entry(DeviceModel model) const {
+    size_t n_plans = get16(_data + 10);
+    for (size_t e = 0; e < n_plans; ++e) {
+        size_t at = HEADER_SIZE + ENTRY_SIZE * e;
+        if (_data[at] == static_cast<uint8_t>(model)) return at;
+    }
+    return 0;
+}
+
+size_t PlanFile::sections(DeviceModel model) const {
+    size_t e = _entry(model);
+    return e ? get16(_data + e + 2) : 0;
+}
+
+PlanFile::Section PlanFile::section(DeviceModel model, size_t i) const {
+    size_t off = get32(_data + _entry(model) + 4);
+    for (;;) {
+        size_t count = get16(_data + off);
+        size_t hlen  = _data[off + 3];
+        if (i-- == 0) {
+            return Section{
+                std::string_view(reinterpret_cast<const char*>(_data + off + SECTION_HEAD), hlen),
+                (_data[off + 2] & FLAG_LOCK_STEP) != 0,
+                reinterpret_cast<const Packet*>(_data + off + SECTION_HEAD + hlen),
+                count};
+        }
+        off += SECTION_HEAD + hlen + count * M913_PACKET_SIZE;
+    }
+}
+
+size_t PlanFile::packet_count(DeviceModel model) const {
+    size_t n = 0;
+    for (size_t s = 0, ns = sections(model); s < ns; ++s)
+        n += section(model, s).count;
+    return n;
+}
+
+PacketPlan PlanFile::plan(DeviceModel model) const {
+    PacketPlan plan;
+    for (size_t s = 0, n = sections(model); s < n; ++s) {
+        Section section = this->section(model, s);
+        plan.push_back({std::string(section.heading),
+                        std::vector<Packet>(section.packets, section.packets + section.count),
+                        section.lock_step});
+    }
+    return plan;
+}
+
+void send_plan_file(Transport& mouse, const PlanFile& file, DeviceModel model,
+                    const SendOptions& opts, SendStats* stats) {
+    size_t n = file.sections(model);
+    if (n == 0)
+        throw std::runtime_error(std::string("the plan file has no plan for ") +
+                                 model_name(model) + " hardware");
+    for (size_t s = 0; s < n; ++s) {
+        PlanFile::Section section = file.section(model, s);
+        SendOptions o = opts;
+        if (section.lock_step) o.window = 1;
+        send_sequence(mouse, section.packets, section.count, section.heading, o, stats);
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "apply.h"
+#include "plan.h"
+#include "protocol.h"
+
+// -----------------------------------------------------------------------
+// Compiled plan files (--compile / --apply-plan)
+//
+// A plan file holds finished plans, one per hardware revision, as
+// ready-to-send checksummed packets, so applying it needs no INI parsing,
+// validation or packet building.  Packets are stored back to back and
+// sent straight out of the mapped file.
+//
+// Layout (integers little-endian):
+//
+//   Offset | Size | Contents
+//   -------|------|--------------------------------------------------
+//   0      | 8    | magic "M913PLAN"
+//   8      | 2    | format version (PLAN_FILE_VERSION)
+//   10     | 2    | number of plans
+//   12     | 4    | file size
+//   16     | 8×n  | plan table: model (u8), 0 (u8), sections (u16),
+//          |      | offset of the first section (u32)
+//
+// Each section: packet count (u16), flags (u8, bit 0 = lock-step),
+// heading length (u8), the heading, then the packets, 17 bytes each.
+// -----------------------------------------------------------------------
+
+static constexpr uint16_t PLAN_FILE_VERSION = 1;
+
+static_assert(sizeof(Packet) == M913_PACKET_SIZE && alignof(Packet) == 1,
+              "plan files map packets in place");
+
+// Write `plans` to `path` (through a temporary and a rename).
+// Throws std::runtime_error on I/O errors.
+void write_plan_file(const std::string& path, const std::map<DeviceModel, PacketPlan>& plans);
+
+// A plan file mapped read-only.  The whole file is checked when it is
+// opened (layout and every packet's checksum); after that, reading it
+// allocates nothing.
+class PlanFile {
+public:
+    // Throws std::runtime_error if the file cannot be mapped, is not a plan
+    // file, has another format version or is damaged.
+    explicit PlanFile(const std::string& path);
+    ~PlanFile();
+
+    PlanFile(const PlanFile&) = delete;
+    PlanFile& operator=(const PlanFile&) = delete;
+
+    struct Section {
+        std::string_view heading;
+        bool             lock_step;
+        const Packet*    packets;
+        size_t           count;
+    };
+
+    // Number of sections of the plan for `model` (0 if the file has none).
+    size_t sections(DeviceModel model) const;
+
+    // Section `i` (< sections(model)) of the plan for `model`.
+    Section section(DeviceModel model, size_t i) const;
+
+    // Packets in the plan for `model`.
+    size_t packet_count(DeviceModel model) const;
+
+    // A copy of the plan for `model` (empty if the file has none).
+    PacketPlan plan(DeviceModel model) const;
+
+private:
+    // Offset of the plan table entry for `model`, 0 if absent.
+    size_t _entry(DeviceModel model) const;
+
+    const uint8_t* _data = nullptr;
+    size_t         _size = 0;
+};
+
+// Send the plan for `model` straight from the mapping, as send_plan()
+// does.  Throws std::runtime_error if the file has no plan for `model`.
+void send_plan_file(Transport& mouse, const PlanFile& file, DeviceModel model,
+                    const SendOptions& opts = {}, SendStats* stats = nullptr);
@@ -1,38 +1,22 @@
 #include "protocol.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <stdexcept>
 #include "data.h"
-
-// Global storage for multi-key action strings (simple solution)
-static std::map<uint8_t, std::string> g_multikey_actions;
-
-void register_multikey_action(uint8_t button_idx, const std::string& action_str) {
-    g_multikey_actions[button_idx] = action_str;
-}
-
-void clear_multikey_actions() {
-    g_multikey_actions.clear();
-}
+#include "packetlayout.h"
 
 // -----------------------------------------------------------------------
 // Checksum
 // -----------------------------------------------------------------------
 
-uint8_t compute_checksum(const Packet& p) {
-    // Host → device checksum formula, confirmed by cross-checking ALL
-    // templates in mouse_m908's M913 data.cpp against their byte[16]:
-    //   byte[16] = (0x55 - sum(bytes[0..15])) & 0xFF
-    //
-    // Note: device → host packets use a DIFFERENT formula:
-    //   byte[16] = (0x4C - sum(bytes[1..15])) & 0xFF
-    // (byte[0] = report ID 0x09 excluded from that sum)
-    uint16_t s = 0;
-    for (int i = 0; i < M913_PACKET_SIZE - 1; ++i)
-        s += p[i];
-    return static_cast<uint8_t>((0x55 - s) & 0xFF);
+bool ack_matches(const Packet& sent, const uint8_t* ack, int len) {
+    if (len != M913_PACKET_SIZE) return false;
+    if (ack[M913_PACKET_SIZE - 1] != compute_ack_checksum(ack)) return false;
+    return ack[3] == sent[3] && ack[4] == sent[4];
 }
 
 // -----------------------------------------------------------------------
@@ -64,22 +48,21 @@ const uint8_t COMPX_LAYOUT[16] = {
 // Default button-mapping packets for Compx hardware (VID 3554).
 // Layout: proto_idx 0=Left, 1=Right, 2=Middle, 3-7=Side1-5,
 //         8=Fire, 9=Side7, 10=Side6, 11-15=Side12-8.
-// Checksums are placeholder 0x00 — recomputed by build_button_mapping.
-static const uint8_t compx_default_button_mapping[8][17] = {
-    {0x08,0x07,0x00,0x00,0x60,0x08, 0x01,0x01,0x00,0x53, 0x01,0x02,0x00,0x52, 0x00,0x00,0x00},
-    {0x08,0x07,0x00,0x00,0x68,0x08, 0x01,0x04,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x00},
-    {0x08,0x07,0x00,0x00,0x70,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x00},
-    {0x08,0x07,0x00,0x00,0x78,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x00},
-    {0x08,0x07,0x00,0x00,0x80,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x00},
-    {0x08,0x07,0x00,0x00,0x88,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x00},
-    {0x08,0x07,0x00,0x00,0x90,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x00},
-    {0x08,0x07,0x00,0x00,0x98,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x00},
+static constexpr Packet compx_default_button_mapping[8] = {
+    {0x08,0x07,0x00,0x00,0x60,0x08, 0x01,0x01,0x00,0x53, 0x01,0x02,0x00,0x52, 0x00,0x00,0x34},
+    {0x08,0x07,0x00,0x00,0x68,0x08, 0x01,0x04,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x2c},
+    {0x08,0x07,0x00,0x00,0x70,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x24},
+    {0x08,0x07,0x00,0x00,0x78,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x1c},
+    {0x08,0x07,0x00,0x00,0x80,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x14},
+    {0x08,0x07,0x00,0x00,0x88,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x0c},
+    {0x08,0x07,0x00,0x00,0x90,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x04},
+    {0x08,0x07,0x00,0x00,0x98,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0xfc},
 };
 
 // Default button-mapping packets (8 × 17 bytes).
 // Two buttons per packet; addresses step by 0x08 from 0x60.
 // Source: mouse_m913::_c_data_button_mapping
-static const uint8_t default_button_mapping[8][17] = {
+static constexpr Packet default_button_mapping[8] = {
     {0x08,0x07,0x00,0x00,0x60,0x08, 0x00,0x00,0x00,0x55, 0x05,0x00,0x00,0x50, 0x00,0x00,0x34},
     {0x08,0x07,0x00,0x00,0x68,0x08, 0x05,0x00,0x00,0x50, 0x01,0x08,0x00,0x4c, 0x00,0x00,0x2c},
     {0x08,0x07,0x00,0x00,0x70,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0x24},
@@ -90,31 +73,13 @@ static const uint8_t default_button_mapping[8][17] = {
     {0x08,0x07,0x00,0x00,0x98,0x08, 0x05,0x00,0x00,0x50, 0x05,0x00,0x00,0x50, 0x00,0x00,0xfc},
 };
 
-// Per-button address bytes for keyboard-key sub-packets (bytes [3] and [4]).
-// Source: mouse_m913::_c_keyboard_key_buttons  (first two bytes of each entry)
-static const uint8_t kb_key_addr[16][2] = {
-    {0x01,0x00}, // button 0  (Side1)
-    {0x01,0x20}, // button 1  (Side2)
-    {0x01,0x40}, // button 2  (Side3)
-    {0x01,0x60}, // button 3  (Side4)
-    {0x01,0x80}, // button 4  (Side5)
-    {0x01,0xa0}, // button 5  (Side6)
-    {0x01,0xc0}, // button 6  (Right)
-    {0x01,0xe0}, // button 7  (Left)
-    {0x02,0x00}, // button 8  (Side7)
-    {0x02,0x20}, // button 9  (Side8)
-    {0x02,0x40}, // button 10 (Middle)
-    {0x02,0x60}, // button 11 (Fire)
-    {0x02,0x80}, // button 12 (Side9)
-    {0x02,0xa0}, // button 13 (Side10)
-    {0x02,0xc0}, // button 14 (Side11)
-    {0x02,0xe0}, // button 15 (Side12)
-};
-
 // DPI code lookup table (DPI value → 3-byte encoding).
 // Source: mouse_m913::_c_dpi_codes
-// Only a representative subset; extend as needed.
-static const struct { uint16_t dpi; uint8_t b[3]; } dpi_table[] = {
+// The vendor's codes do not follow a formula (800 → 0x09 but 700 → 0x07,
+// 16000 → 0xbd), so only the values listed here can be set; there is no
+// code to send for the other 100-steps.
+struct DpiCode { uint16_t dpi; uint8_t b[3]; };
+static constexpr DpiCode dpi_table[] = {
     {  100, {0x00,0x00,0x55}},
     {  200, {0x02,0x02,0x51}},
     {  300, {0x03,0x03,0x4f}},
@@ -172,193 +137,255 @@ static const struct { uint16_t dpi; uint8_t b[3]; } dpi_table[] = {
     {16000, {0xbd,0xbd,0xdb}},
 };
 
-// Keyboard-key sub-packet template.
-// Source: rd_mouse_wireless::_c_data_button_as_keyboard_key
-static const uint8_t kb_key_template[17] = {
-    0x08,0x07,0x00,0x01,0x60,0x08,
-    0x02,0x81,0x21,0x00,0x41,0x21,0x00,0x4f,
-    0x00,0x00,0x88
-};
-
 // DPI config packet templates (4 packets).
 // Source: mouse_m913::_c_data_dpi
-static const uint8_t dpi_template[4][17] = {
+static constexpr Packet dpi_template[4] = {
     {0x08,0x07,0x00,0x00,0x0c,0x08, 0x00,0x00,0x00,0x55, 0x02,0x02,0x00,0x51, 0x00,0x00,0x88},
     {0x08,0x07,0x00,0x00,0x14,0x08, 0x03,0x03,0x00,0x4f, 0x04,0x04,0x00,0x4d, 0x00,0x00,0x80},
     {0x08,0x07,0x00,0x00,0x1c,0x04, 0x05,0x05,0x00,0x4b, 0x00,0x00,0x00,0x00, 0x00,0x00,0xd1},
     {0x08,0x07,0x00,0x00,0x02,0x02, 0x05,0x50,0x00,0x00, 0x00,0x00,0x00,0x00, 0x00,0x00,0xed},
 };
 
-// "Unknown_2" packets always sent after DPI config.
+// "Unknown_2" packets always sent after DPI config.  They write five
+// colours (red, green, blue, yellow, ff557d) where Compx hardware keeps
+// its per-slot DPI colours, so they are probably the DPI indicator
+// defaults.
 // Source: mouse_m913::_c_data_unknown_2
-static const uint8_t unknown2[3][17] = {
+static constexpr Packet unknown2[3] = {
     {0x08,0x07,0x00,0x00,0x2c,0x08, 0xff,0x00,0x00,0x56, 0x00,0x00,0xff,0x56, 0x00,0x00,0x68},
     {0x08,0x07,0x00,0x00,0x34,0x08, 0x00,0xff,0x00,0x56, 0xff,0xff,0x00,0x57, 0x00,0x00,0x60},
     {0x08,0x07,0x00,0x00,0x3c,0x04, 0xff,0x55,0x7d,0x84, 0x00,0x00,0x00,0x00, 0x00,0x00,0xb1},
 };
 
-// LED mode packet templates.
+// Fixed LED mode packets.
 // The 0x0000 (polling rate) packet has been removed from all templates —
 // it is now sent separately via build_polling_rate_packet().
 // Source: mouse_m913::_c_data_led_*
-static const uint8_t led_off[1][17] = {
+static constexpr Packet led_off[1] = {
     {0x08,0x07,0x00,0x00,0x58,0x02, 0x00,0x55,0x00,0x00, 0x00,0x00,0x00,0x00, 0x00,0x00,0x97},
 };
-static const uint8_t led_breathing[2][17] = {
-    {0x08,0x07,0x00,0x00,0x54,0x08, 0xff,0x00,0x00,0x57, 0x01,0x54,0xff,0x56, 0x00,0x00,0xeb},
-    {0x08,0x07,0x00,0x00,0x5c,0x02, 0x03,0x52,0x00,0x00, 0x00,0x00,0x00,0x00, 0x00,0x00,0x93},
-};
-static const uint8_t led_rainbow[2][17] = {
+static constexpr Packet led_rainbow[2] = {
     {0x08,0x07,0x00,0x00,0x54,0x08, 0xff,0x00,0xff,0x57, 0x03,0x52,0x80,0xd5, 0x00,0x00,0xeb},
     {0x08,0x07,0x00,0x00,0x5c,0x02, 0x03,0x52,0x00,0x00, 0x00,0x00,0x00,0x00, 0x00,0x00,0x93},
 };
-static const uint8_t led_static[1][17] = {
-    {0x08,0x07,0x00,0x00,0x54,0x08, 0xff,0x00,0x00,0x57, 0x01,0x54,0xff,0x56, 0x00,0x00,0xeb},
+
+// -----------------------------------------------------------------------
+// Registers (see packetlayout.h)
+// -----------------------------------------------------------------------
+
+// Polling rate: one checked code (1000/500/250/125 Hz → 01/02/04/08).
+struct PollingRate : PacketWrite<0x0000, 2> {
+    using Code = checked<0, 1>;
+};
+
+// Number of active DPI stages, 1–5.
+struct DpiStages : PacketWrite<0x0002, 2> {
+    using Count = checked<0, 1>;
 };
 
+// Areson DPI levels: 1–2 at 0x0c, 3–4 at 0x14, each a checked
+// {code, code, 0x00}; level 5 alone at 0x1c.
+struct DpiLevelPairs : PacketTable<0x000c, 0x08, 2, 8> {
+    using First  = checked<0, 3>;
+    using Second = checked<4, 3>;
+};
+struct DpiLevel5 : PacketWrite<0x001c, 4> {
+    using Level = checked<0, 3>;
+};
+
+// Compx DPI levels, one register per slot: checked {code, code, 0x00}.
+struct CompxDpiLevel : PacketTable<0x000c, 0x04, 5, 4> {
+    using Level = checked<0, 3>;
+};
+
+// Compx per-slot DPI colours: checked {r, g, b}.
+struct CompxDpiColor : PacketTable<0x002c, 0x04, 5, 4> {
+    using Color = checked<0, 3>;
+};
+
+// Logo LED colour, mode and brightness, each checked.
+struct LedLogo : PacketWrite<0x0054, 8> {
+    using Color      = checked<0, 3>;
+    using Mode       = checked<4, 1>;
+    using Brightness = checked<6, 1>;
+};
+static constexpr uint8_t LED_MODE_STEADY      = 0x01;
+static constexpr uint8_t LED_MODE_RESPIRATION = 0x02;
+
+// Respiration speed: 01 (slowest) to 05 (fastest) in USB captures.
+struct LedSpeed : PacketWrite<0x005c, 2> {
+    using Speed = checked<0, 1>;
+};
+
+// Button mapping: two buttons per register, 4 action bytes each, by
+// protocol index (button b is slot b % 2 of register b / 2).
+struct ButtonMapping : PacketTable<0x0060, 0x08, 8, 8> {
+    using Even = field<0, 4>;
+    using Odd  = field<4, 4>;
+};
+
+// Keyboard-key macros, one 0x20-byte slot per protocol index:
+//   [COUNT][up to 10 events of 3 bytes][inner checksum]
+// written 10 bytes at a time from the slot's start.  The slot's mapping
+// gets KEY_MACRO_ACTION.
+// Source: mouse_m913::_c_keyboard_key_buttons (addresses)
+struct KeyMacro : PacketTable<0x0100, 0x20, 16, 10> {
+    static constexpr size_t SIZE = 0x20;
+};
+static constexpr uint8_t KEY_MACRO_ACTION[4] = {0x05, 0x00, 0x00, 0x50};
+
+// Every template must carry its own checksum, since the ones sent as they
+// are (unknown2, led_off, led_rainbow) go out exactly as written here, and
+// those a builder fills in must be writes of the register it fills.
+template <size_t N>
+static constexpr bool checksums_ok(const Packet (&pkts)[N]) {
+    for (const Packet& p : pkts)
+        if (p[M913_PACKET_SIZE - 1] != compute_checksum(p)) return false;
+    return true;
+}
+
+static constexpr bool templates_match_registers() {
+    for (size_t i = 0; i < ButtonMapping::count; ++i)
+        if (!ButtonMapping::describes(i, default_button_mapping[i]) ||
+            !ButtonMapping::describes(i, compx_default_button_mapping[i]))
+            return false;
+    return DpiLevelPairs::describes(0, dpi_template[0]) &&
+           DpiLevelPairs::describes(1, dpi_template[1]) &&
+           DpiLevel5::describes(dpi_template[2]) &&
+           DpiStages::describes(dpi_template[3]);
+}
+
+static_assert(checksums_ok(compx_default_button_mapping), "compx_default_button_mapping checksum");
+static_assert(checksums_ok(default_button_mapping), "default_button_mapping checksum");
+static_assert(checksums_ok(dpi_template), "dpi_template checksum");
+static_assert(checksums_ok(unknown2), "unknown2 checksum");
+static_assert(checksums_ok(led_off), "led_off checksum");
+static_assert(checksums_ok(led_rainbow), "led_rainbow checksum");
+static_assert(templates_match_registers(), "template is not a write of its register");
+
 // -----------------------------------------------------------------------
 // Internal helpers
 // -----------------------------------------------------------------------
 
-static Packet from_raw(const uint8_t src[17]) {
-    Packet p;
-    std::copy(src, src + 17, p.begin());
-    return p;
+// Bounded output for the builders: appends to the caller's buffer and
+// throws std::length_error instead of writing past its end.
+struct PacketSink {
+    Packet* out;
+    size_t  capacity;
+    size_t  n = 0;
+
+    void push(const Packet& p) {
+        if (n == capacity) throw std::length_error("packet buffer too small");
+        out[n++] = p;
+    }
+};
+
+// dpi_table position + 1 for each 100-step from 100 to 16000, 0 where the
+// table has no code, so lookups are a single index.
+static constexpr size_t DPI_STEPS = 160;
+
+static constexpr std::array<uint8_t, DPI_STEPS> make_dpi_index() {
+    std::array<uint8_t, DPI_STEPS> index{};
+    for (size_t i = 0; i < sizeof(dpi_table) / sizeof(dpi_table[0]); ++i)
+        index[dpi_table[i].dpi / 100 - 1] = static_cast<uint8_t>(i + 1);
+    return index;
 }
 
+static constexpr std::array<uint8_t, DPI_STEPS> dpi_index = make_dpi_index();
+
 // Look up DPI 3-byte encoding; returns nullptr if not found.
-static const uint8_t* lookup_dpi(uint16_t dpi) {
-    for (auto& e : dpi_table)
-        if (e.dpi == dpi) return e.b;
-    return nullptr;
+static constexpr const uint8_t* lookup_dpi(uint16_t dpi) {
+    if (dpi < 100 || dpi > 100 * DPI_STEPS || dpi % 100 != 0) return nullptr;
+    uint8_t pos = dpi_index[dpi / 100 - 1];
+    return pos ? dpi_table[pos - 1].b : nullptr;
+}
+
+// Every table entry is a 100-step the index finds again, and its bytes
+// are a code, the same code, and their inner checksum.
+static constexpr bool dpi_table_round_trips() {
+    for (auto& e : dpi_table) {
+        if (lookup_dpi(e.dpi) != e.b) return false;
+        if (e.b[1] != e.b[0]) return false;
+        if (e.b[2] != static_cast<uint8_t>(0x55 - e.b[0] - e.b[1])) return false;
+    }
+    return true;
+}
+static_assert(dpi_table_round_trips(), "dpi_table entry does not round-trip");
+
+bool dpi_supported(uint16_t dpi) { return lookup_dpi(dpi) != nullptr; }
+
+bool compx_dpi_supported(uint16_t dpi) {
+    return dpi >= 50 && dpi <= COMPX_MAX_DPI && dpi % 50 == 0;
 }
 
 // -----------------------------------------------------------------------
 // Button mapping
 // -----------------------------------------------------------------------
 
-std::vector<Packet> build_button_mapping(
-        const std::map<uint8_t, ActionBytes>& changes,
-        const uint8_t* layout) {
+size_t build_button_mapping(const std::map<uint8_t, ButtonAction>& changes,
+                            const uint8_t* layout, Packet* out_buf, size_t capacity) {
+    PacketSink out{out_buf, capacity};
 
     // Start from the appropriate 8-packet default template.
-    const uint8_t (*defaults)[17] = layout ? compx_default_button_mapping
-                                            : default_button_mapping;
+    const Packet* defaults = layout ? compx_default_button_mapping
+                                    : default_button_mapping;
     Packet buf[8];
     for (int i = 0; i < 8; ++i)
-        buf[i] = from_raw(defaults[i]);
+        buf[i] = defaults[i];
 
-    // The action bytes of button `b` sit at:
-    //   packet[b/2], bytes [6..9]  if b is even
-    //   packet[b/2], bytes [10..13] if b is odd
-    static const uint8_t kb_key_action[4] = {0x05, 0x00, 0x00, 0x50};
+    auto set_mapping = [&](uint8_t proto_idx, const uint8_t* bytes) {
+        Packet& p = buf[proto_idx / 2];
+        if (proto_idx % 2 == 0) ButtonMapping::Even::copy(p, bytes);
+        else                    ButtonMapping::Odd::copy(p, bytes);
+    };
 
-    // Keyboard-key sub-packets are collected first.
-    std::vector<Packet> result;
+    // Keyboard-key sub-packets are written first.
 
-    for (auto& [btn_idx, ab] : changes) {
+    for (auto& [btn_idx, action] : changes) {
+        const ActionBytes& ab = action.bytes;
         if (btn_idx >= 16) continue;  // out of range
 
         // Translate button enum value to protocol index for this device.
         uint8_t proto_idx = layout ? layout[btn_idx] : btn_idx;
 
         if (ab[0] == 0x90 || ab[0] == 0x92) {
-            // Keyboard-key action: ab = {0x90, modifier, scancode, 0x00} (single key)
-            //                  or  ab = {0x91, modifier, first_key, key_count} (multi-key)  
+            // Keyboard-key action: ab = {0x90, ...} with the modifiers and keys
+            //                      in action.mods / action.keys
             //                  or  ab = {0x92, extra_byte, consumer_code, extra_byte2} (multimedia)
-            // Confirmed protocol (from USB captures):
-            //
-            //   Plain key (no modifier): single 17-byte sub-packet at btn_addr, len=0x08
-            //     payload: [0x02][0x81][SC][0x00][0x41][SC][0x00][inner_cksum]
+            // Confirmed protocol (from USB captures): the button's KeyMacro
+            // slot gets COUNT, the events (3 bytes each) and an inner
+            // checksum over both, e.g. for a plain key:
+            //     [0x02][0x81][SC][0x00][0x41][SC][0x00][inner_cksum]
             //     where 0x02=count(2 events), 0x81=key-down, 0x41=key-up
-            //     inner_cksum = (0x55 - 0x02 - 0x81 - SC - 0x41 - SC) & 0xFF
-            //                 = (0x91 - 2*SC) & 0xFF
-            //
-            //   Modifier+key: two sub-packets
-            //     Event types: 0x80/0x40 = modifier down/up, 0x81/0x41 = key down/up
-            //     Event order: [each mod bit down], key-down, [each mod bit up], key-up
-            //     Packet 1 at btn_addr,        len=0x0A: [COUNT][first 3 events (9 bytes)]
-            //     Packet 2 at btn_addr+0x0A,   len=var:  [remaining events][inner_cksum]
-            //     inner_cksum = (0x55 - COUNT - sum_of_all_event_bytes) & 0xFF
-            //
-            // The mapping slot always gets the same KB marker (05 00 00 50).
-
-            uint8_t addr_hi = kb_key_addr[proto_idx][0];
-            uint8_t addr_lo = kb_key_addr[proto_idx][1];
+            // Event types: 0x80/0x40 = modifier down/up, 0x81/0x41 = key
+            // down/up, 0x82/0x42 = consumer key down/up.
+            uint8_t slot[KeyMacro::SIZE];
+            size_t  n = 1;  // slot[0] = COUNT, filled in below
+            auto event = [&](uint8_t type, uint8_t code, uint8_t extra) {
+                if (n + 3 >= sizeof(slot))
+                    throw std::runtime_error("key binding has too many keys for one button");
+                slot[n++] = type;
+                slot[n++] = code;
+                slot[n++] = extra;
+            };
 
             if (ab[0] == 0x92) {
-                // Multimedia key: generate sub-packet with consumer code
-                // Pattern: 08 07 00 01 ADDR 08 02 82 CODE EXTRA 42 CODE EXTRA CKSUM 00 00 XX
-                uint8_t extra = ab[1];
-                uint8_t code = ab[2];
-                uint8_t extra2 = ab[3];
-                
-                Packet sub = {};
-                sub[0]=0x08; sub[1]=0x07; sub[2]=0x00; sub[3]=addr_hi; sub[4]=addr_lo; sub[5]=0x08;
-                sub[6]=0x02; sub[7]=0x82; sub[8]=code; sub[9]=extra; sub[10]=0x42; sub[11]=code; sub[12]=extra2;
-                // Inner checksum: (0x55 - sum(bytes 6-12)) & 0xFF
-                uint8_t isum = 0x02 + 0x82 + code + extra + 0x42 + code + extra2;
-                sub[13] = (0x55u - isum) & 0xFF;
-                sub[16] = compute_checksum(sub);
-                result.push_back(sub);
+                // Multimedia key: consumer code down and up.
+                event(0x82, ab[2], ab[1]);
+                event(0x42, ab[2], ab[3]);
             } else {
-                uint8_t mods = ab[1];
-                uint8_t sc   = ab[2];
-                uint8_t key_count = ab[3];
-
-                // Collect all keys for this binding.
-                // For multi-key combos (key_count > 1), re-parse the
-                // original action string to get all scancodes + modifiers.
-                std::vector<uint8_t> keys;
-
-                if (key_count > 1) {
-                    auto it = g_multikey_actions.find(btn_idx);
-                    if (it != g_multikey_actions.end()) {
-                        uint8_t parsed_mods;
-                        std::vector<uint8_t> parsed_keys;
-                        if (parse_multikey(it->second, parsed_mods, parsed_keys) && parsed_keys.size() >= 2) {
-                            mods = parsed_mods;
-                            keys = parsed_keys;
-                        }
-                    }
-                    // Fall back to single key if multi-key parsing failed
-                    if (keys.empty()) {
-                        keys.push_back(sc);
-                    }
-                } else {
-                    if (sc != 0x00) keys.push_back(sc);
-                }
-
-                if (mods != 0x00 && keys.empty()) {
-                    // Modifier-only binding (e.g. just "super"):
-                    // Single packet, same format as plain key but with
-                    // mod-down (0x80) / mod-up (0x40) event types.
-                    Packet sub;
-                    std::copy(kb_key_template, kb_key_template + 17, sub.begin());
-                    sub[3]  = addr_hi;
-                    sub[4]  = addr_lo;
-                    sub[7]  = 0x80;  // modifier down
-                    sub[8]  = mods;
-                    sub[10] = 0x40;  // modifier up
-                    sub[11] = mods;
-                    uint8_t isum = 0x02 + 0x80 + mods + 0x40 + mods;
-                    sub[13] = static_cast<uint8_t>((0x55 - isum) & 0xFF);
-                    sub[16] = compute_checksum(sub);
-                    result.push_back(sub);
-                } else if (mods == 0x00 && keys.size() == 1) {
-                    // Plain single key: use the existing single-packet template.
-                    Packet sub;
-                    std::copy(kb_key_template, kb_key_template + 17, sub.begin());
-                    sub[3]  = addr_hi;
-                    sub[4]  = addr_lo;
-                    sub[8]  = keys[0];
-                    sub[11] = keys[0];
-                    sub[13] = static_cast<uint8_t>((0x91 - 2u * keys[0]) & 0xFF);
-                    sub[16] = compute_checksum(sub);
-                    result.push_back(sub);
-                } else {
-                    // Unified path for: modifier+key, multi-key, modifier+multi-key.
-                    // Build event list following the pattern confirmed by USB captures:
+                const uint8_t  mods   = action.mods;
+                const uint8_t* keys   = action.keys.data();
+                const size_t   n_keys = action.n_keys;
+
+                if (mods != 0x00 && n_keys == 0) {
+                    // Modifier-only binding (e.g. just "super"): all its
+                    // modifier bits in one down and one up event.
+                    event(0x80, mods, 0x00);
+                    event(0x40, mods, 0x00);
+                } else if (n_keys > 0) {
+                    // Plain key, modifier+key, multi-key, modifier+multi-key.
+                    // Event order confirmed by USB captures:
                     //   1. All modifier bits DOWN (0x80, LSB first)
                     //   2. All regular keys DOWN (0x81, in order)
                     //   3. All modifier bits UP (0x40, same order as down)
@@ -366,212 +393,154 @@ std::vector<Packet> build_button_mapping(
                     static const uint8_t mod_bits[] = {
                         0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x80
                     };
-
-                    std::vector<uint8_t> evts;
-                    evts.reserve(24);
-
-                    // Modifier-down events
                     for (uint8_t b : mod_bits)
-                        if (mods & b) { evts.push_back(0x80); evts.push_back(b); evts.push_back(0x00); }
-                    // All keys down
-                    for (uint8_t k : keys) {
-                        evts.push_back(0x81); evts.push_back(k); evts.push_back(0x00);
-                    }
-                    // Modifier-up events (same order as down)
+                        if (mods & b) event(0x80, b, 0x00);
+                    for (size_t i = 0; i < n_keys; ++i)
+                        event(0x81, keys[i], 0x00);
                     for (uint8_t b : mod_bits)
-                        if (mods & b) { evts.push_back(0x40); evts.push_back(b); evts.push_back(0x00); }
-                    // All keys up (reverse order)
-                    for (int i = static_cast<int>(keys.size()) - 1; i >= 0; --i) {
-                        evts.push_back(0x41); evts.push_back(keys[i]); evts.push_back(0x00);
-                    }
-
-                    uint8_t count = static_cast<uint8_t>(evts.size() / 3);
-
-                    // Inner checksum covers COUNT + all event bytes
-                    uint16_t isum = count;
-                    for (uint8_t b : evts) isum += b;
-                    uint8_t inner = (0x55u - static_cast<uint8_t>(isum & 0xFF)) & 0xFF;
-
-                    // Packet 1: len=0x0A, payload = COUNT + first 9 event bytes
-                    Packet p1 = {};
-                    p1[0]=0x08; p1[1]=0x07; p1[2]=0x00;
-                    p1[3]=addr_hi; p1[4]=addr_lo; p1[5]=0x0a;
-                    p1[6] = count;
-                    for (int i = 0; i < 9 && i < static_cast<int>(evts.size()); ++i)
-                        p1[7 + i] = evts[i];
-                    p1[16] = compute_checksum(p1);
-                    result.push_back(p1);
-
-                    // Packet 2: remaining event bytes + inner checksum
-                    size_t p1_evts = std::min<size_t>(9, evts.size());
-                    size_t remaining = evts.size() - p1_evts;
-                    Packet p2 = {};
-                    p2[0]=0x08; p2[1]=0x07; p2[2]=0x00;
-                    p2[3]=addr_hi; p2[4]=static_cast<uint8_t>(addr_lo + 0x0a);
-                    p2[5] = static_cast<uint8_t>(remaining + 1);
-                    for (size_t i = 0; i < remaining; ++i)
-                        p2[6 + i] = evts[p1_evts + i];
-                    p2[6 + remaining] = inner;
-                    p2[16] = compute_checksum(p2);
-                    result.push_back(p2);
+                        if (mods & b) event(0x40, b, 0x00);
+                    for (size_t i = n_keys; i-- > 0;)
+                        event(0x41, keys[i], 0x00);
                 }
             }
 
-            // Put the keyboard_key marker in the mapping packet.
-            int pkt = proto_idx / 2;
-            int off = (proto_idx % 2 == 0) ? 6 : 10;
-            for (int k = 0; k < 4; ++k)
-                buf[pkt][off + k] = kb_key_action[k];
+            if (n > 1) {
+                slot[0] = static_cast<uint8_t>((n - 1) / 3);
+                unsigned isum = 0;
+                for (size_t i = 0; i < n; ++i) isum += slot[i];
+                slot[n++] = static_cast<uint8_t>((0x55u - isum) & 0xFF);
+
+                uint16_t addr = KeyMacro::address(proto_idx);
+                for (size_t at = 0; at < n; at += KeyMacro::length)
+                    out.push(packet_write(static_cast<uint16_t>(addr + at), slot + at,
+                                          std::min<size_t>(KeyMacro::length, n - at)));
+            }
+
+            set_mapping(proto_idx, KEY_MACRO_ACTION);
         } else {
             // Direct action (mouse button, DPI cycle, etc.)
-            int pkt = proto_idx / 2;
-            int off = (proto_idx % 2 == 0) ? 6 : 10;
-            for (int k = 0; k < 4; ++k)
-                buf[pkt][off + k] = ab[k];
+            set_mapping(proto_idx, ab.data());
         }
     }
 
     // Recompute checksum for any modified mapping packets.
     for (int i = 0; i < 8; ++i)
-        buf[i][16] = compute_checksum(buf[i]);
+        seal_packet(buf[i]);
 
     // Keyboard-key sub-packets go first, then the 8 mapping packets.
     for (int i = 0; i < 8; ++i)
-        result.push_back(buf[i]);
-
-    // Clean up multi-key registrations after use.
-    clear_multikey_actions();
+        out.push(buf[i]);
 
-    return result;
+    return out.n;
 }
 
 // -----------------------------------------------------------------------
 // DPI
 // -----------------------------------------------------------------------
 
-std::vector<Packet> build_dpi_packets(const DpiSettings& dpi) {
+// Active DPI stages: disabling a stage disables every stage above it.
+static uint8_t dpi_stage_count(const DpiSettings& dpi) {
+    uint8_t count = 5;
+    for (uint8_t i = 4; i >= 1; --i)
+        if (!dpi.enabled[i]) count = i;
+    return count;
+}
+
+size_t build_dpi_packets(const DpiSettings& dpi, Packet* out_buf, size_t capacity) {
+    PacketSink out{out_buf, capacity};
+
     // Copy the 4-packet template.
     Packet buf[4];
     for (int i = 0; i < 4; ++i)
-        buf[i] = from_raw(dpi_template[i]);
-
-    // Helper: set a DPI level's 3 bytes at the appropriate positions.
-    auto set_level = [&](int pkt, int base_off, uint16_t val) {
-        const uint8_t* code = lookup_dpi(val);
-        if (!code) return;  // unknown DPI, keep template value
-        buf[pkt][base_off]     = code[0];
-        buf[pkt][base_off + 1] = code[1];
-        // byte 2 is at +3 (not +2 — there's a 0x00 gap at +2)
-        buf[pkt][base_off + 3] = code[2];
+        buf[i] = dpi_template[i];
+
+    auto code = [](uint16_t val) {
+        const uint8_t* c = lookup_dpi(val);
+        if (!c)
+            throw std::runtime_error("DPI " + std::to_string(val) + " has no code on this mouse");
+        return c;
     };
 
-    // Levels 1 and 2 → packet 0
-    if (dpi.values[0]) set_level(0, 6,  dpi.values[0]);
-    if (dpi.values[1]) set_level(0, 10, dpi.values[1]);
-    // Levels 3 and 4 → packet 1
-    if (dpi.values[2]) set_level(1, 6,  dpi.values[2]);
-    if (dpi.values[3]) set_level(1, 10, dpi.values[3]);
-    // Level 5 → packet 2 (only 4 bytes, no second level)
-    if (dpi.values[4]) set_level(2, 6,  dpi.values[4]);
-
-    // Enabled levels → packet 3 bytes [6] and [7].
-    // mouse_m908 logic: highest disabled level determines the enable bytes.
-    // Count how many levels are enabled (must keep at least 1).
-    int num_enabled = 0;
-    for (int i = 0; i < 5; ++i) if (dpi.enabled[i]) ++num_enabled;
-    if (num_enabled == 0) {
-        // Can't disable all levels; leave packet 3 at template default.
-    } else {
-        uint8_t e1 = 0x05, e2 = 0x50;
-        if (!dpi.enabled[4]) { e1 = 0x04; e2 = 0x51; }
-        if (!dpi.enabled[3]) { e1 = 0x03; e2 = 0x52; }
-        if (!dpi.enabled[2]) { e1 = 0x02; e2 = 0x53; }
-        if (!dpi.enabled[1]) { e1 = 0x01; e2 = 0x54; }
-        buf[3][6] = e1;
-        buf[3][7] = e2;
+    // Levels 1 and 2 → packet 0, 3 and 4 → packet 1, 5 → packet 2.  The
+    // table's third byte is the inner checksum the layout computes.
+    for (int i = 0; i < 4; ++i) {
+        if (!dpi.values[i]) continue;
+        const uint8_t* c = code(dpi.values[i]);
+        if (i % 2 == 0) DpiLevelPairs::First::set(buf[i / 2], c[0], c[1], 0x00);
+        else            DpiLevelPairs::Second::set(buf[i / 2], c[0], c[1], 0x00);
     }
+    if (dpi.values[4]) {
+        const uint8_t* c = code(dpi.values[4]);
+        DpiLevel5::Level::set(buf[2], c[0], c[1], 0x00);
+    }
+
+    // Enabled levels → packet 3 (mouse_m908 logic: the lowest disabled
+    // level sets the count).  With every level disabled, leave packet 3
+    // at its template default: at least one must stay on.
+    bool any_enabled = false;
+    for (int i = 0; i < 5; ++i) any_enabled = any_enabled || dpi.enabled[i];
+    if (any_enabled)
+        DpiStages::Count::set(buf[3], dpi_stage_count(dpi));
 
     // Recompute checksums.
     for (int i = 0; i < 4; ++i)
-        buf[i][16] = compute_checksum(buf[i]);
+        seal_packet(buf[i]);
 
-    std::vector<Packet> result;
     for (int i = 0; i < 4; ++i)
-        result.push_back(buf[i]);
+        out.push(buf[i]);
 
     // Append the 3 "unknown_2" packets (always required after DPI config).
     for (int i = 0; i < 3; ++i)
-        result.push_back(from_raw(unknown2[i]));
+        out.push(unknown2[i]);
 
-    return result;
+    return out.n;
 }
 
 // -----------------------------------------------------------------------
 // LED
 // -----------------------------------------------------------------------
 
-std::vector<Packet> build_led_packets(LedMode mode,
-                                      uint32_t color,
-                                      uint8_t  brightness,
-                                      uint8_t  speed) {
-    std::vector<Packet> result;
+size_t build_led_packets(LedMode mode, uint32_t color, uint8_t brightness, uint8_t speed,
+                         Packet* out_buf, size_t capacity) {
+    PacketSink out{out_buf, capacity};
+
+    uint8_t r = (color >> 16) & 0xff;
+    uint8_t g = (color >>  8) & 0xff;
+    uint8_t b =  color        & 0xff;
 
     if (mode == LedMode::Off) {
-        result.push_back(from_raw(led_off[0]));
+        out.push(led_off[0]);
 
     } else if (mode == LedMode::Respiration) {
         // Respiration mode: color + mode in 0x54 packet, speed in 0x5C packet.
-        // Each data byte has an inline checksum: (0x55 - data) & 0xFF
         // Confirmed from USB captures (logo_respiration_*.txt).
-        uint8_t r = (color >> 16) & 0xff;
-        uint8_t g = (color >> 8) & 0xff;
-        uint8_t b = color & 0xff;
-
-        Packet p1 = from_raw(led_breathing[0]);
-        p1[6]  = r;
-        p1[7]  = g;
-        p1[8]  = b;
-        p1[9]  = static_cast<uint8_t>((0x55 - r - g - b) & 0xFF);
-        p1[10] = 0x02;  // Mode: respiration
-        p1[11] = static_cast<uint8_t>((0x55 - 0x02) & 0xFF);  // = 0x53
-        p1[12] = brightness;
-        p1[13] = static_cast<uint8_t>((0x55 - brightness) & 0xFF);
-        p1[16] = compute_checksum(p1);
-        result.push_back(p1);
-
-        // Speed packet at address 0x5C: [speed, (0x55 - speed)]
-        // USB captures show speed range: 01 (slowest) to 05 (fastest).
-        Packet p2 = from_raw(led_breathing[1]);
-        p2[6] = speed;
-        p2[7] = static_cast<uint8_t>((0x55 - speed) & 0xFF);
-        p2[16] = compute_checksum(p2);
-        result.push_back(p2);
+        Packet p1 = LedLogo::blank();
+        LedLogo::Color::set(p1, r, g, b);
+        LedLogo::Mode::set(p1, LED_MODE_RESPIRATION);
+        LedLogo::Brightness::set(p1, brightness);
+        seal_packet(p1);
+        out.push(p1);
+
+        Packet p2 = LedSpeed::blank();
+        LedSpeed::Speed::set(p2, speed);
+        seal_packet(p2);
+        out.push(p2);
 
     } else if (mode == LedMode::Rainbow) {
         for (int i = 0; i < 2; ++i)
-            result.push_back(from_raw(led_rainbow[i]));
+            out.push(led_rainbow[i]);
 
     } else {  // Steady (static color with brightness)
-        // Inline checksums confirmed from USB captures (logo_steady_*.txt).
-        uint8_t r = (color >> 16) & 0xff;
-        uint8_t g = (color >>  8) & 0xff;
-        uint8_t b =  color        & 0xff;
-
-        Packet buf = from_raw(led_static[0]);
-        buf[6]  = r;
-        buf[7]  = g;
-        buf[8]  = b;
-        buf[9]  = static_cast<uint8_t>((0x55 - r - g - b) & 0xFF);
-        buf[10] = 0x01; // Mode: steady
-        buf[11] = static_cast<uint8_t>((0x55 - 0x01) & 0xFF);  // = 0x54
-        buf[12] = brightness;
-        buf[13] = static_cast<uint8_t>((0x55 - brightness) & 0xFF);
-        buf[16] = compute_checksum(buf);
-        result.push_back(buf);
-        return result;
+        // Confirmed from USB captures (logo_steady_*.txt).
+        Packet p = LedLogo::blank();
+        LedLogo::Color::set(p, r, g, b);
+        LedLogo::Mode::set(p, LED_MODE_STEADY);
+        LedLogo::Brightness::set(p, brightness);
+        seal_packet(p);
+        out.push(p);
     }
 
-    return result;
+    return out.n;
 }
 
 // -----------------------------------------------------------------------
@@ -579,23 +548,19 @@ std::vector<Packet> build_led_packets(LedMode mode,
 // -----------------------------------------------------------------------
 
 Packet build_polling_rate_packet(uint16_t hz) {
-    // Polling rate register is at address 0x0000, length 2.
     // Encoding confirmed from USB captures (1000.txt / 500.txt / 125.txt):
     //   1000 Hz → 0x01  250 Hz → 0x04
     //    500 Hz → 0x02  125 Hz → 0x08
-    // Byte[7] is always (0x55 - code), making the outer checksum 0xEF for any rate.
+    // The code is checked, making the outer checksum 0xEF for any rate.
     uint8_t code;
     if      (hz >= 1000) code = 0x01;
     else if (hz >= 500)  code = 0x02;
     else if (hz >= 250)  code = 0x04;
     else                 code = 0x08;  // 125 Hz
 
-    Packet p{};
-    p[0] = 0x08; p[1] = 0x07;
-    p[4] = 0x00; p[5] = 0x02;
-    p[6] = code;
-    p[7] = static_cast<uint8_t>((0x55u - code) & 0xFF);
-    p[16] = compute_checksum(p);
+    Packet p = PollingRate::blank();
+    PollingRate::Code::set(p, code);
+    seal_packet(p);
     return p;
 }
 
@@ -604,60 +569,93 @@ Packet build_polling_rate_packet(uint16_t hz) {
 // Compx hardware (VID 3554)
 // -----------------------------------------------------------------------
 
-// Build a single Compx-style 17-byte config packet.
-// addr: memory address byte (byte[4]); len: payload length (byte[5])
-// b6..b9: payload bytes[6..9] (inner checksum in b9 is caller's responsibility)
-static Packet compx_packet(uint8_t addr, uint8_t len,
-                            uint8_t b6, uint8_t b7, uint8_t b8, uint8_t b9) {
-    Packet p{};
-    p[0]=0x08; p[1]=0x07; p[2]=0x00; p[3]=0x00;
-    p[4]=addr; p[5]=len;
-    p[6]=b6; p[7]=b7; p[8]=b8; p[9]=b9;
-    p[16] = compute_checksum(p);
-    return p;
-}
-
-std::vector<Packet> build_compx_dpi_packets(const DpiSettings& dpi) {
-    std::vector<Packet> result;
+size_t build_compx_dpi_packets(const DpiSettings& dpi, Packet* out_buf, size_t capacity) {
+    PacketSink out{out_buf, capacity};
 
-    // One DPI value packet per slot. Encoding: code = (DPI / 50) - 1,
-    // stored in bytes[6] and [7], addr = 0x0c + slot*0x04.
+    // One DPI value packet per slot. Encoding: code = (DPI / 50) - 1.
     for (int i = 0; i < 5; ++i) {
         if (dpi.values[i] == 0) continue;
-        uint8_t addr = static_cast<uint8_t>(0x0c + i * 0x04);
+        if (!compx_dpi_supported(dpi.values[i]))
+            throw std::runtime_error("DPI " + std::to_string(dpi.values[i]) +
+                                     " is not supported on this mouse");
         uint8_t code = static_cast<uint8_t>((dpi.values[i] / 50) - 1);
-        uint8_t inner = (0x55u - code - code) & 0xFF;
-        result.push_back(compx_packet(addr, 0x04, code, code, 0x00, inner));
+        Packet p = CompxDpiLevel::blank(i);
+        CompxDpiLevel::Level::set(p, code, code, 0x00);
+        seal_packet(p);
+        out.push(p);
     }
 
-    // Stage-count packet (addr=0x02): byte[6] = number of active stages,
-    // byte[7] = 0x55 - count. Same control as the original hardware; the
-    // Compx device honours it (disabling cascades from the top down, so
+    // Stage count: same control as the original hardware; the Compx
+    // device honours it (disabling cascades from the top down, so
     // dpi2_enable=0 yields a single active stage).
-    uint8_t count = 0x05, comp = 0x50;
-    if (!dpi.enabled[4]) { count = 0x04; comp = 0x51; }
-    if (!dpi.enabled[3]) { count = 0x03; comp = 0x52; }
-    if (!dpi.enabled[2]) { count = 0x02; comp = 0x53; }
-    if (!dpi.enabled[1]) { count = 0x01; comp = 0x54; }
-    result.push_back(compx_packet(0x02, 0x02, count, comp, 0x00, 0x00));
-
-    return result;
+    Packet p = DpiStages::blank();
+    DpiStages::Count::set(p, dpi_stage_count(dpi));
+    seal_packet(p);
+    out.push(p);
+
+    return out.n;
 }
 
-std::vector<Packet> build_compx_color_packets(const uint32_t colors[5], int n_slots) {
-    std::vector<Packet> result;
+size_t build_compx_color_packets(const uint32_t colors[5], int n_slots,
+                                 Packet* out_buf, size_t capacity) {
+    PacketSink out{out_buf, capacity};
 
     for (int i = 0; i < n_slots; ++i) {
         if (colors[i] == 0xFFFFFFFF) continue;  // not set, skip
-        uint8_t addr  = static_cast<uint8_t>(0x2c + i * 0x04);
-        uint8_t r     = (colors[i] >> 16) & 0xFF;
-        uint8_t g     = (colors[i] >>  8) & 0xFF;
-        uint8_t b     = (colors[i]      ) & 0xFF;
-        uint8_t inner = (0x55u - r - g - b) & 0xFF;
-        result.push_back(compx_packet(addr, 0x04, r, g, b, inner));
+        Packet p = CompxDpiColor::blank(i);
+        CompxDpiColor::Color::set(p, (colors[i] >> 16) & 0xFF, (colors[i] >> 8) & 0xFF,
+                                  colors[i] & 0xFF);
+        seal_packet(p);
+        out.push(p);
     }
 
-    return result;
+    return out.n;
+}
+
+// -----------------------------------------------------------------------
+// Vector forms
+// -----------------------------------------------------------------------
+
+std::vector<Packet> build_button_mapping(const std::map<uint8_t, ButtonAction>& changes,
+                                         const uint8_t* layout) {
+    PacketBatch batch;
+    batch.extend(build_button_mapping(changes, layout, batch.tail(), batch.room()));
+    return {batch.begin(), batch.end()};
+}
+
+std::vector<Packet> build_dpi_packets(const DpiSettings& dpi) {
+    Packet buf[DPI_PACKETS];
+    return {buf, buf + build_dpi_packets(dpi, buf, DPI_PACKETS)};
+}
+
+std::vector<Packet> build_led_packets(LedMode mode, uint32_t color, uint8_t brightness,
+                                      uint8_t speed) {
+    Packet buf[MAX_LED_PACKETS];
+    return {buf, buf + build_led_packets(mode, color, brightness, speed, buf, MAX_LED_PACKETS)};
+}
+
+std::vector<Packet> build_compx_dpi_packets(const DpiSettings& dpi) {
+    Packet buf[MAX_COMPX_DPI_PACKETS];
+    return {buf, buf + build_compx_dpi_packets(dpi, buf, MAX_COMPX_DPI_PACKETS)};
+}
+
+std::vector<Packet> build_compx_color_packets(const uint32_t colors[5], int n_slots) {
+    Packet buf[MAX_COMPX_COLOR_PACKETS];
+    return {buf, buf + build_compx_color_packets(colors, n_slots, buf, MAX_COMPX_COLOR_PACKETS)};
+}
+
+// -----------------------------------------------------------------------
+// PacketBatch
+// -----------------------------------------------------------------------
+
+void PacketBatch::push_back(const Packet& p) {
+    if (_size == CAPACITY) throw std::length_error("PacketBatch is full");
+    _packets[_size++] = p;
+}
+
+void PacketBatch::extend(size_t n) {
+    if (n > room()) throw std::length_error("PacketBatch is full");
+    _size += n;
 }
 
 // -----------------------------------------------------------------------
@@ -675,3 +673,24 @@ void hexdump_packet(const Packet& p, const std::string& label) {
     }
     std::cout << std::dec << "\n";
 }
+
+std::string packet_hex(const Packet& p) {
+    static const char digits[] = "0123456789abcdef";
+    std::string s;
+    s.reserve(2 * M913_PACKET_SIZE);
+    for (uint8_t b : p) {
+        s += digits[b >> 4];
+        s += digits[b & 0x0F];
+    }
+    return s;
+}
+
+bool packet_from_hex(const std::string& hex, Packet& p) {
+    if (hex.size() != 2 * M913_PACKET_SIZE) return false;
+    for (int i = 0; i < M913_PACKET_SIZE; ++i) {
+        unsigned int b;
+        if (std::sscanf(hex.c_str() + 2 * i, "%2x", &b) != 1) return false;
+        p[i] = static_cast<uint8_t>(b);
+    }
+    return p[M913_PACKET_SIZE - 1] == compute_checksum(p);
+}
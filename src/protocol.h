@@ -1,12 +1,13 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <map>
 #include <string>
 #include <vector>
 
-#include "usb.h"
+#include "transport.h"
 
 // -----------------------------------------------------------------------
 // M913 17-byte packet layout (confirmed from mouse_m908 M913 source +
@@ -80,24 +81,69 @@ using Packet = std::array<uint8_t, M913_PACKET_SIZE>;
 // 4-byte action code for button remapping (see data.h for format)
 using ActionBytes = std::array<uint8_t, 4>;
 
+struct ButtonAction;  // data.h
+
 // -----------------------------------------------------------------------
 // Packet sequence builders
 //
-// Each builder returns a std::vector<Packet> containing all the packets
-// that must be sent (with ACK read after each) to apply the setting.
+// Each builder produces all the packets that must be sent (with ACK read
+// after each) to apply the setting.  The main form writes them to a
+// caller-provided buffer of `capacity` packets and returns how many it
+// wrote, without touching the heap; it throws std::length_error if the
+// buffer is too small (the MAX_* counts below always suffice).  The
+// vector forms are conveniences around it.
 // -----------------------------------------------------------------------
 
-// Helper to register multi-key action strings for complex parsing
-void register_multikey_action(uint8_t button_idx, const std::string& action_str);
-void clear_multikey_actions();
+// Most packets each builder writes.  A key binding fills at most the 0x20
+// bytes of its button's macro slot: 4 writes of up to 10 bytes.
+static constexpr size_t MAX_BUTTON_MAPPING_PACKETS = 8 + 16 * 4;
+static constexpr size_t DPI_PACKETS                = 7;
+static constexpr size_t MAX_LED_PACKETS            = 2;
+static constexpr size_t MAX_COMPX_DPI_PACKETS      = 6;
+static constexpr size_t MAX_COMPX_COLOR_PACKETS    = 5;
+
+// A bounded in-place packet buffer, large enough for any one builder:
+//
+//   PacketBatch batch;
+//   batch.extend(build_dpi_packets(dpi, batch.tail(), batch.room()));
+class PacketBatch {
+public:
+    static constexpr size_t CAPACITY = MAX_BUTTON_MAPPING_PACKETS;
+
+    const Packet* data() const  { return _packets.data(); }
+    size_t        size() const  { return _size; }
+    bool          empty() const { return _size == 0; }
+    const Packet* begin() const { return _packets.data(); }
+    const Packet* end() const   { return _packets.data() + _size; }
+    const Packet& operator[](size_t i) const { return _packets[i]; }
+
+    void clear() { _size = 0; }
+
+    // Throws std::length_error when full.
+    void push_back(const Packet& p);
+
+    // Free space after the packets, for a builder to write into, and
+    // taking the `n` packets it wrote.
+    Packet* tail()       { return _packets.data() + _size; }
+    size_t  room() const { return CAPACITY - _size; }
+    void    extend(size_t n);
+
+private:
+    std::array<Packet, CAPACITY> _packets;
+    size_t                       _size = 0;
+};
 
 // Build the complete button-mapping packet sequence (always 8 packets
 // plus any keyboard-key sub-packets that precede them).
 //
-// changes: map of button index → 4-byte action.
-//   - Mouse/special actions (ab[0] != 0x90): used directly in the mapping.
-//   - Keyboard-key actions (ab[0] == 0x90): a keyboard-key sub-packet is
-//     prepended and {0x05,0x00,0x00,0x50} is used in the mapping packet.
+// changes: map of button index → parsed action (see parse_action()).
+//   - Mouse/special actions (bytes[0] != 0x90): used directly in the mapping.
+//   - Keyboard-key actions (bytes[0] == 0x90): keyboard-key sub-packets
+//     holding every key event are prepended and {0x05,0x00,0x00,0x50} is
+//     used in the mapping packet.
+//
+// Reads nothing but its arguments, so plans for several devices can be
+// built on separate threads.
 //
 // Buttons NOT in `changes` keep their factory-default actions.
 // Button index layout for Compx hardware (VID 3554).
@@ -106,8 +152,10 @@ extern const uint8_t COMPX_LAYOUT[16];
 
 // layout: optional translation table (button enum value → protocol index).
 //         Pass nullptr for Areson hardware (identity mapping).
+size_t build_button_mapping(const std::map<uint8_t, ButtonAction>& changes,
+                            const uint8_t* layout, Packet* out, size_t capacity);
 std::vector<Packet> build_button_mapping(
-    const std::map<uint8_t, ActionBytes>& changes,
+    const std::map<uint8_t, ButtonAction>& changes,
     const uint8_t* layout = nullptr);
 
 // DPI settings for build_dpi_packets.
@@ -119,17 +167,29 @@ struct DpiSettings {
     std::array<uint32_t, 5> colors  = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF};
 };
 
+// True if Areson hardware has a code for `dpi`.  The vendor table covers
+// most, not all, of the 100-steps from 100 to 16000.
+bool dpi_supported(uint16_t dpi);
+
 // Build the complete DPI packet sequence (4 DPI config packets +
 // 3 "unknown_2" packets that must always follow, = 7 total).
+// Throws std::runtime_error for a value without a code (dpi_supported()).
+size_t build_dpi_packets(const DpiSettings& dpi, Packet* out, size_t capacity);
 std::vector<Packet> build_dpi_packets(const DpiSettings& dpi);
 
 // Build the LED configuration packet sequence (1–2 packets).
 // color: 24-bit RGB (0xRRGGBB), brightness: 0–255 (Steady mode only)
 // speed: 1–5 (Respiration mode, 1=slowest, 5=fastest)
+static constexpr uint32_t LED_DEFAULT_COLOR      = 0x00ff00;
+static constexpr uint8_t  LED_DEFAULT_BRIGHTNESS = 0xff;
+static constexpr uint8_t  LED_DEFAULT_SPEED      = 0x03;
+
+size_t build_led_packets(LedMode mode, uint32_t color, uint8_t brightness, uint8_t speed,
+                         Packet* out, size_t capacity);
 std::vector<Packet> build_led_packets(LedMode mode,
-                                      uint32_t color      = 0x00ff00,
-                                      uint8_t  brightness = 0xff,
-                                      uint8_t  speed      = 0x03);
+                                      uint32_t color      = LED_DEFAULT_COLOR,
+                                      uint8_t  brightness = LED_DEFAULT_BRIGHTNESS,
+                                      uint8_t  speed      = LED_DEFAULT_SPEED);
 
 // Build the polling rate configuration packet (1 packet).
 // hz: one of 125, 250, 500, 1000 (values are rounded down to nearest valid rate)
@@ -140,14 +200,21 @@ Packet build_polling_rate_packet(uint16_t hz);
 // -----------------------------------------------------------------------
 
 // Build DPI packets for Compx hardware.
-// DPI values must be multiples of 50 in range 50–12750.
+// DPI values must be multiples of 50 in range 50–12750 (one code byte,
+// DPI / 50 - 1); others throw std::runtime_error.
 // Values of 0 for a slot leave that slot unchanged.
+static constexpr uint16_t COMPX_MAX_DPI = 12750;
+bool compx_dpi_supported(uint16_t dpi);
+
+size_t build_compx_dpi_packets(const DpiSettings& dpi, Packet* out, size_t capacity);
 std::vector<Packet> build_compx_dpi_packets(const DpiSettings& dpi);
 
 // Build per-slot color packets for Compx hardware.
 // colors[5]: one 0xRRGGBB per slot; 0x000000 = LED off for that slot.
 //            0xFFFFFFFF = skip this slot (no packet sent).
 // n_slots: number of active DPI slots (1–5).
+size_t build_compx_color_packets(const uint32_t colors[5], int n_slots,
+                                 Packet* out, size_t capacity);
 std::vector<Packet> build_compx_color_packets(const uint32_t colors[5], int n_slots);
 
 // -----------------------------------------------------------------------
@@ -156,8 +223,42 @@ std::vector<Packet> build_compx_color_packets(const uint32_t colors[5], int n_sl
 
 // Compute the checksum byte for a host→device packet.
 // Formula: (0x55 - sum(bytes[0..15])) & 0xFF
-// Confirmed against all mouse_m908 M913 template values.
-uint8_t compute_checksum(const Packet& p);
+// Confirmed against all mouse_m908 M913 template values.  constexpr, so
+// packet templates can be checked at compile time.
+constexpr uint8_t compute_checksum(const Packet& p) {
+    unsigned s = 0;
+    for (int i = 0; i < M913_PACKET_SIZE - 1; ++i)
+        s += p[i];
+    return static_cast<uint8_t>((0x55 - s) & 0xFF);
+}
+
+// Compute the checksum byte for a device→host packet (ACKs on EP 0x82).
+// Formula: (0x4C - sum(bytes[1..15])) & 0xFF — byte[0] (report ID 0x09)
+// is excluded.
+constexpr uint8_t compute_ack_checksum(const uint8_t* p) {
+    unsigned s = 0;
+    for (int i = 1; i < M913_PACKET_SIZE - 1; ++i)
+        s += p[i];
+    return static_cast<uint8_t>((0x4C - s) & 0xFF);
+}
+
+// The Redragon software always ends a config session with two of these
+// (observed in USB captures); they appear to apply the writes to flash.
+constexpr Packet COMMIT_PACKET = {0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x49};
+static_assert(COMMIT_PACKET[M913_PACKET_SIZE - 1] == compute_checksum(COMMIT_PACKET),
+              "commit packet checksum");
+
+// True if `ack` (len bytes read from EP 0x82) is a well-formed ACK for the
+// host→device packet `sent`: 17 bytes, valid device→host checksum, and the
+// same memory address (bytes [3] and [4]) as the packet it acknowledges.
+bool ack_matches(const Packet& sent, const uint8_t* ack, int len);
 
 // Pretty-print a packet as a hex dump to stdout
 void hexdump_packet(const Packet& p, const std::string& label = "");
+
+// A packet as 34 hex digits without spaces, as stored in the runtime
+// caches, and back.  packet_from_hex() rejects anything else, including a
+// packet whose host→device checksum is wrong.
+std::string packet_hex(const Packet& p);
+bool packet_from_hex(const std::string& hex, Packet& p);
@@ -0,0 +1,197 @@
+#include "readback.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint8_t CMD_WRITE = 0x07;
+
+static double ms_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+static unsigned int ms_left(Clock::time_point sent, unsigned int deadline_ms) {
+    double waited = ms_since(sent);
+    return waited >= deadline_ms ? 0 : static_cast<unsigned int>(deadline_ms - waited);
+}
+
+static void check_range(uint16_t addr, size_t len) {
+    if (len == 0 || len > MAX_READ || addr >= ConfigImage::SIZE ||
+        len > static_cast<size_t>(ConfigImage::SIZE - addr)) {
+        char msg[64];
+        std::snprintf(msg, sizeof(msg), "bad config read 0x%03x+%zu", addr, len);
+        throw std::runtime_error(msg);
+    }
+}
+
+static void store(const Packet& req, const uint8_t* reply, MemoryDump& out) {
+    uint16_t addr = static_cast<uint16_t>((req[3] << 8) | req[4]);
+    for (size_t i = 0; i < req[5]; ++i) {
+        out.bytes[addr + i] = reply[6 + i];
+        out.known[addr + i] = true;
+    }
+}
+
+Packet build_read_packet(uint16_t addr, uint8_t len) {
+    check_range(addr, len);
+    Packet p{};
+    p[0] = 0x08;
+    p[1] = CMD_READ;
+    p[3] = static_cast<uint8_t>(addr >> 8);
+    p[4] = static_cast<uint8_t>(addr & 0xFF);
+    p[5] = len;
+    p[16] = compute_checksum(p);
+    return p;
+}
+
+bool read_reply_matches(const Packet& req, const uint8_t* reply, int len) {
+    return ack_matches(req, reply, len) && reply[1] == CMD_READ && reply[5] == req[5];
+}
+
+bool read_block(Transport& mouse, uint16_t addr, uint8_t len, uint8_t* out,
+                RttEstimator* rtt) {
+    Packet req = build_read_packet(addr, len);
+    uint8_t buf[M913_PACKET_SIZE];
+    while (mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, 0) > 0) {}
+
+    unsigned int deadline = rtt ? rtt->deadline_ms() : ACK_TIMEOUT_MS;
+    int          attempts = 1 + (rtt ? rtt->retries() : 0);
+    for (int a = 0; a < attempts; ++a) {
+        auto t0 = Clock::now();
+        mouse.send(req.data());
+        int got;
+        // Skip anything else that turns up (a late reply to an earlier read).
+        while ((got = mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN,
+                                     ms_left(t0, deadline))) > 0) {
+            if (!read_reply_matches(req, buf, got)) continue;
+            if (rtt && a == 0) rtt->observe(ms_since(t0));
+            std::memcpy(out, buf + 6, len);
+            return true;
+        }
+        deadline = std::min(deadline * 2, ACK_TIMEOUT_MS);
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------
+// Pipelined read: keep up to `window` requests in flight and match each
+// reply to its request by address.  The first timeout ends the pipeline;
+// whatever is still missing is then read lock-step.
+// -----------------------------------------------------------------------
+size_t read_ranges(Transport& mouse, const std::vector<ReadRange>& ranges, MemoryDump& out,
+                   int window, RttEstimator* rtt) {
+    std::vector<Packet> reqs;
+    reqs.reserve(ranges.size());
+    for (auto& r : ranges)
+        reqs.push_back(build_read_packet(r.addr, r.len));
+
+    struct InFlight { size_t idx; Clock::time_point sent; };
+    std::deque<InFlight> inflight;
+    std::vector<bool>    done(reqs.size(), false);
+    size_t               n_done = 0, next = 0;
+    SendTracker          sends(mouse);
+    uint8_t              buf[M913_PACKET_SIZE];
+
+    while (mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, 0) > 0) {}
+
+    while (next < reqs.size() || !inflight.empty()) {
+        while (next < reqs.size() && inflight.size() < static_cast<size_t>(std::max(window, 1))) {
+            sends.submit(reqs[next].data());
+            inflight.push_back({next++, Clock::now()});
+        }
+
+        unsigned int deadline = rtt ? rtt->deadline_ms() : ACK_TIMEOUT_MS;
+        int got = mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN,
+                                 ms_left(inflight.front().sent, deadline));
+        if (sends.errors() || got == 0) break;
+
+        auto it = std::find_if(inflight.begin(), inflight.end(), [&](const InFlight& f) {
+            return read_reply_matches(reqs[f.idx], buf, got);
+        });
+        if (it == inflight.end()) continue;  // stray report; the deadline still runs
+
+        if (rtt) rtt->observe(ms_since(it->sent));
+        store(reqs[it->idx], buf, out);
+        done[it->idx] = true;
+        ++n_done;
+        inflight.erase(it);
+    }
+
+    if (n_done == reqs.size()) return n_done;
+
+    // Let abandoned requests finish so their replies are not taken for the
+    // retries' (read_block() also skips mismatched replies).
+    sends.drain();
+    while (mouse.try_recv(buf, sizeof(buf), INTERRUPT_EP_IN, 50) > 0) {}
+
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        if (done[i]) continue;
+        uint8_t data[MAX_READ];
+        if (!read_block(mouse, ranges[i].addr, ranges[i].len, data, rtt)) continue;
+        std::memcpy(buf + 6, data, ranges[i].len);
+        store(reqs[i], buf, out);
+        ++n_done;
+    }
+    return n_done;
+}
+
+std::vector<ReadRange> full_memory_ranges() {
+    std::vector<ReadRange> ranges;
+    for (uint16_t a = 0; a < ConfigImage::SIZE; a = static_cast<uint16_t>(a + MAX_READ)) {
+        size_t len = std::min<size_t>(MAX_READ, ConfigImage::SIZE - a);
+        ranges.push_back({a, static_cast<uint8_t>(len)});
+    }
+    return ranges;
+}
+
+std::vector<ReadRange> plan_ranges(const PacketPlan& plan) {
+    std::vector<ReadRange> ranges;
+    for (auto& section : plan)
+        for (auto& p : section.packets) {
+            if (p[0] != 0x08 || p[1] != CMD_WRITE || p[5] == 0 || p[5] > MAX_READ) continue;
+            ReadRange r{static_cast<uint16_t>((p[3] << 8) | p[4]), p[5]};
+            bool seen = std::any_of(ranges.begin(), ranges.end(), [&](const ReadRange& o) {
+                return o.addr == r.addr && o.len == r.len;
+            });
+            if (!seen) ranges.push_back(r);
+        }
+    return ranges;
+}
+
+WriteState compare_write(const Packet& p, const MemoryDump& mem) {
+    uint16_t addr = static_cast<uint16_t>((p[3] << 8) | p[4]);
+    if (addr + p[5] > ConfigImage::SIZE) return WriteState::Unread;
+    bool differs = false;
+    for (size_t i = 0; i < p[5]; ++i) {
+        if (!mem.known[addr + i]) return WriteState::Unread;
+        if (mem.bytes[addr + i] != p[6 + i]) differs = true;
+    }
+    return differs ? WriteState::Differs : WriteState::Held;
+}
+
+void print_memory(const MemoryDump& mem, std::ostream& out) {
+    auto flags = out.flags();
+    auto fill  = out.fill();
+    out << std::hex << std::setfill('0');
+    for (size_t line = 0; line < ConfigImage::SIZE; line += 16) {
+        if (std::none_of(mem.known.begin() + line, mem.known.begin() + line + 16,
+                         [](bool k) { return k; }))
+            continue;
+        out << "  " << std::setw(3) << line << ": ";
+        for (size_t i = line; i < line + 16; ++i) {
+            if (mem.known[i]) out << std::setw(2) << static_cast<int>(mem.bytes[i]) << " ";
+            else              out << "-- ";
+            if (i % 16 == 7) out << " ";
+        }
+        out << "\n";
+    }
+    out.flags(flags);
+    out.fill(fill);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+#include "image.h"
+#include "plan.h"
+#include "protocol.h"
+#include "rtt.h"
+#include "transport.h"
+
+// -----------------------------------------------------------------------
+// Config read-back
+//
+// Sub-command 0x08 is the read counterpart of the 0x07 write: the request
+// is 08 08 00 <hi> <lo> <len> with no payload, and the mouse answers on
+// EP 0x82 with a report carrying the same header and the bytes held at
+// that address in [6..6+len), under the device→host checksum.  At most
+// MAX_READ bytes come back per request.  Reads change nothing, so they
+// are pipelined freely and matched to their replies by address.
+//
+// Experimental: 0x08 is inferred from the write's framing and has not
+// been confirmed on hardware.  --probe-commands sweeps the 08 XX
+// sub-commands and flags read-shaped replies; until one is confirmed,
+// --verify and --dump only run with --experimental-read.
+// -----------------------------------------------------------------------
+
+static constexpr uint8_t CMD_READ = 0x08;
+
+// Longest read: the payload bytes 6..15 of one report.
+static constexpr size_t MAX_READ = 10;
+
+// Reads kept in flight by read_ranges().
+static constexpr int READ_WINDOW = 8;
+
+// The request for `len` bytes at `addr`.
+Packet build_read_packet(uint16_t addr, uint8_t len);
+
+// True if `reply` (len bytes from EP 0x82) answers the read `req`: a
+// well-formed device→host report for the same sub-command, address and
+// length.
+bool read_reply_matches(const Packet& req, const uint8_t* reply, int len);
+
+// Read `len` (1..MAX_READ) bytes at `addr` into `out`, lock-step.  The
+// deadline and resends follow `rtt` as for send_cmd().  Returns false if
+// no matching reply arrived.  Throws std::runtime_error on a bad range.
+bool read_block(Transport& mouse, uint16_t addr, uint8_t len, uint8_t* out,
+                RttEstimator* rtt = nullptr);
+
+struct ReadRange {
+    uint16_t addr;
+    uint8_t  len;
+};
+
+// Config memory as read back.  `known` is false where nothing was read.
+struct MemoryDump {
+    std::array<uint8_t, ConfigImage::SIZE> bytes{};
+    std::array<bool, ConfigImage::SIZE>    known{};
+};
+
+// Read every range into `out` with up to `window` reads in flight.  Reads
+// whose reply does not arrive in time are retried lock-step with
+// read_block().  Returns the number of ranges read.
+size_t read_ranges(Transport& mouse, const std::vector<ReadRange>& ranges, MemoryDump& out,
+                   int window = READ_WINDOW, RttEstimator* rtt = nullptr);
+
+// The whole config image in MAX_READ-byte reads.
+std::vector<ReadRange> full_memory_ranges();
+
+// The ranges written by the config writes in `plan`.
+std::vector<ReadRange> plan_ranges(const PacketPlan& plan);
+
+// How one planned config write compares with memory read back.
+enum class WriteState {
+    Held,     // every byte already there
+    Differs,  // read back, at least one byte differs
+    Unread,   // part of the range could not be read
+};
+WriteState compare_write(const Packet& p, const MemoryDump& mem);
+
+// Print `mem` as 16 bytes per line with addresses; unread bytes show as
+// "--" and lines with nothing read are left out.
+void print_memory(const MemoryDump& mem, std::ostream& out);
@@ -0,0 +1,106 @@
+#include "rtt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+#include "discovery.h"
+
+// EWMA gains from RFC 6298: 1/8 for the mean, 1/4 for the deviation.
+static constexpr double RTT_ALPHA = 0.125;
+static constexpr double RTT_BETA  = 0.25;
+
+void RttEstimator::observe(double rtt_ms) {
+    if (rtt_ms < 0) return;
+    if (_count == 0) {
+        _srtt   = rtt_ms;
+        _rttvar = rtt_ms / 2;
+    } else {
+        _rttvar = (1 - RTT_BETA) * _rttvar + RTT_BETA * std::fabs(_srtt - rtt_ms);
+        _srtt   = (1 - RTT_ALPHA) * _srtt + RTT_ALPHA * rtt_ms;
+    }
+    _ring[_next] = rtt_ms;
+    _next = (_next + 1) % RTT_SAMPLES;
+    if (_count < 1000000) ++_count;
+}
+
+void RttEstimator::seed(double rtt_ms) {
+    *this = RttEstimator();
+    for (int i = 0; i < RTT_MIN_SAMPLES; ++i) observe(rtt_ms);
+}
+
+double RttEstimator::p95_ms() const {
+    size_t n = std::min(static_cast<size_t>(_count), RTT_SAMPLES);
+    if (n == 0) return 0;
+    double sorted[RTT_SAMPLES];
+    std::copy(_ring, _ring + n, sorted);
+    std::sort(sorted, sorted + n);
+    size_t idx = static_cast<size_t>(std::ceil(0.95 * static_cast<double>(n))) - 1;
+    return sorted[idx];
+}
+
+// The larger of the RFC 6298 timeout and twice the 95th percentile: the
+// EWMA adapts quickly, the percentile keeps a burst of slow ACKs in view.
+unsigned int RttEstimator::deadline_ms() const {
+    if (!known()) return ACK_TIMEOUT_MS;
+    double d = std::max(_srtt + 4 * _rttvar, 2 * p95_ms());
+    d = std::max(d, static_cast<double>(RTT_MIN_DEADLINE_MS));
+    return static_cast<unsigned int>(std::min(std::ceil(d), static_cast<double>(ACK_TIMEOUT_MS)));
+}
+
+int RttEstimator::retries() const {
+    if (!known()) return 0;
+    int retries = 0;
+    unsigned int d = deadline_ms(), total = d;
+    while (retries < 3) {
+        d = std::min(d * 2, ACK_TIMEOUT_MS);
+        if (total + d > ACK_TIMEOUT_MS) break;
+        total += d;
+        ++retries;
+    }
+    return retries;
+}
+
+// ---- persistence ----
+//
+// One line per device and transport:
+//   <key> <srtt> <rttvar> <count> <sample>...
+// with the samples oldest first.
+
+void RttEstimator::load(const std::string& key) {
+    *this = RttEstimator();
+    std::string dir = runtime_cache_dir();
+    if (dir.empty()) return;
+
+    auto lines = load_cache_lines(dir + "/rtt");
+    auto it = lines.find(key);
+    if (it == lines.end()) return;
+
+    std::istringstream ls(it->second);
+    RttEstimator e;
+    if (!(ls >> e._srtt >> e._rttvar >> e._count)) return;
+    double v;
+    size_t n = 0;
+    while (n < RTT_SAMPLES && ls >> v) e._ring[n++] = v;
+    if (n != std::min(static_cast<size_t>(e._count), RTT_SAMPLES)) return;
+    e._next = n % RTT_SAMPLES;
+    *this = e;
+}
+
+void RttEstimator::save(const std::string& key) const {
+    std::string dir = runtime_cache_dir();
+    if (dir.empty() || key.empty() || _count == 0) return;
+
+    std::ostringstream ls;
+    ls << _srtt << " " << _rttvar << " " << _count;
+    size_t n = std::min(static_cast<size_t>(_count), RTT_SAMPLES);
+    size_t first = (_count >= static_cast<int>(RTT_SAMPLES)) ? _next : 0;
+    for (size_t i = 0; i < n; ++i)
+        ls << " " << _ring[(first + i) % RTT_SAMPLES];
+
+    std::string path = dir + "/rtt";
+    auto lines = load_cache_lines(path);
+    lines[key] = ls.str();
+    save_cache_lines(path, lines);
+}
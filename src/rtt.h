@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// -----------------------------------------------------------------------
+// ACK round-trip estimate
+//
+// Tracks send→ACK times for one device over one transport: a smoothed
+// mean and mean deviation (the EWMAs TCP uses for its retransmission
+// timeout, RFC 6298) plus the 95th percentile of the last RTT_SAMPLES
+// round trips.  ACK deadlines and retry counts are derived from it, so a
+// wired mouse answering in 20 ms is not given 1.5 s per packet.
+//
+// Estimates are kept in $XDG_RUNTIME_DIR/m913-ctl/rtt between runs.
+// -----------------------------------------------------------------------
+
+// How long to wait for the ACK of a config write before giving up on it,
+// while nothing is known about the link.  The mouse responds within ~20 ms
+// on native USB; WSL2/USB-IP is far slower.
+static constexpr unsigned int ACK_TIMEOUT_MS = 1500;
+
+// Round trips remembered for the percentile.
+static constexpr size_t RTT_SAMPLES = 32;
+
+// Samples needed before deadlines are derived from the estimate; until
+// then every write gets the fixed ACK_TIMEOUT_MS.
+static constexpr int RTT_MIN_SAMPLES = 8;
+
+// Floor for a derived deadline: scheduling jitter on an idle host.
+static constexpr unsigned int RTT_MIN_DEADLINE_MS = 25;
+
+class RttEstimator {
+public:
+    // Record one send→ACK time.
+    void observe(double rtt_ms);
+
+    // Start from a single measured round trip, as if RTT_MIN_SAMPLES writes
+    // had all taken it, so deadlines are derived at once.  For short runs
+    // with no stored estimate to load.
+    void seed(double rtt_ms);
+
+    // Enough samples to derive deadlines from.
+    bool known() const { return _count >= RTT_MIN_SAMPLES; }
+
+    // How long to wait for the ACK of the first attempt at a write.  Each
+    // resend doubles it, up to ACK_TIMEOUT_MS.
+    unsigned int deadline_ms() const;
+
+    // Resends of an unacknowledged write before giving up on it: as many
+    // as fit, with doubling deadlines, into the fixed ACK_TIMEOUT_MS budget.
+    int retries() const;
+
+    double srtt_ms() const { return _srtt; }
+    double p95_ms() const;
+    int    samples() const { return _count; }
+
+    // Load / store the estimate for `key` (device + transport).  load()
+    // leaves the estimator empty if nothing was stored.
+    void load(const std::string& key);
+    void save(const std::string& key) const;
+
+private:
+    double _srtt   = 0;  // smoothed round trip
+    double _rttvar = 0;  // smoothed mean deviation
+    int    _count  = 0;  // samples observed (saturates)
+    double _ring[RTT_SAMPLES] = {};
+    size_t _next   = 0;  // next slot in _ring
+};
@@ -0,0 +1,99 @@
+#include "shadow.h"
+
+#include <sstream>
+
+#include "discovery.h"
+
+static constexpr uint8_t CMD_WRITE = 0x07;
+
+static bool is_write(const Packet& p) {
+    return p[0] == 0x08 && p[1] == CMD_WRITE;
+}
+
+static uint16_t write_address(const Packet& p) {
+    return static_cast<uint16_t>((p[3] << 8) | p[4]);
+}
+
+bool ShadowImage::holds(const Packet& p) const {
+    if (!is_write(p)) return false;
+    auto it = _mem.find(write_address(p));
+    return it != _mem.end() && it->second == p;
+}
+
+void ShadowImage::record(const Packet& p) {
+    if (is_write(p)) _mem[write_address(p)] = p;
+}
+
+void ShadowImage::forget(const Packet& p) {
+    if (is_write(p)) _mem.erase(write_address(p));
+}
+
+void ShadowImage::forget(const PacketPlan& plan) {
+    for (auto& section : plan)
+        for (auto& p : section.packets)
+            forget(p);
+}
+
+// ---- persistence ----
+//
+// One line per device: <key> <packet>... with each packet as 34 hex digits.
+
+void ShadowImage::load(const std::string& key) {
+    _mem.clear();
+    std::string dir = runtime_cache_dir();
+    if (dir.empty()) return;
+
+    auto lines = load_cache_lines(dir + "/shadow");
+    auto it = lines.find(key);
+    if (it == lines.end()) return;
+
+    std::istringstream ls(it->second);
+    std::string hex;
+    Packet p;
+    while (ls >> hex)
+        // A damaged entry is dropped rather than trusted.
+        if (packet_from_hex(hex, p)) record(p);
+}
+
+void ShadowImage::save(const std::string& key) const {
+    std::string dir = runtime_cache_dir();
+    if (dir.empty() || key.empty()) return;
+
+    std::string path = dir + "/shadow";
+    auto lines = load_cache_lines(path);
+    if (_mem.empty()) {
+        lines.erase(key);
+    } else {
+        std::string v;
+        for (auto& [addr, p] : _mem) {
+            if (!v.empty()) v += ' ';
+            v += packet_hex(p);
+        }
+        lines[key] = v;
+    }
+    save_cache_lines(path, lines);
+}
+
+PacketPlan diff_plan(const PacketPlan& plan, const ShadowImage& shadow, size_t& skipped) {
+    PacketPlan out;
+    ShadowImage cur = shadow;
+    bool any_write = false;
+    skipped = 0;
+
+    for (auto& section : plan) {
+        PlanSection kept{section.heading, {}, section.lock_step};
+        for (auto& p : section.packets) {
+            if (cur.holds(p)) {
+                ++skipped;
+                continue;
+            }
+            cur.record(p);
+            if (is_write(p)) any_write = true;
+            kept.packets.push_back(p);
+        }
+        if (!kept.packets.empty())
+            out.push_back(std::move(kept));
+    }
+    if (!any_write) out.clear();  // only the commit would be left
+    return out;
+}
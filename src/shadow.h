@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "plan.h"
+#include "protocol.h"
+
+// -----------------------------------------------------------------------
+// Device shadow
+//
+// Config writes (sub-command 0x07) are memory writes: bytes [3],[4] are an
+// address.  The shadow remembers, per device, the last packet the mouse
+// acknowledged at each address, so re-applying a config only sends the
+// writes that change something.  It is kept in
+// $XDG_RUNTIME_DIR/m913-ctl/shadow (dropped at logout) under device_key(),
+// and only updated once a whole plan has been written; addresses whose
+// outcome is uncertain are forgotten.
+//
+// The shadow cannot see changes made elsewhere (another computer, the
+// Windows software); --no-shadow writes everything and refreshes it.
+// -----------------------------------------------------------------------
+
+class ShadowImage {
+public:
+    // True if `p` is a config write the device already holds byte for byte.
+    bool holds(const Packet& p) const;
+
+    // Note that the device acknowledged `p` / may not hold what the
+    // shadow says at p's address.  Non-write packets are ignored.
+    void record(const Packet& p);
+    void forget(const Packet& p);
+
+    // Forget every write in `plan`.
+    void forget(const PacketPlan& plan);
+
+    size_t size() const { return _mem.size(); }
+
+    // Persist per device key (see device_key()).  load() leaves the image
+    // empty if there is no entry or XDG_RUNTIME_DIR is unset.
+    void load(const std::string& key);
+    void save(const std::string& key) const;
+
+private:
+    std::map<uint16_t, Packet> _mem;  // address → last acknowledged write
+};
+
+// `plan` without the writes `shadow` says the device already holds.  The
+// plan is walked in order against a running copy of the shadow, so a
+// later write to an address an earlier one changed is kept.  The commit
+// stays if anything else does; a plan with nothing left comes back empty.
+// `skipped` receives the number of writes left out.
+PacketPlan diff_plan(const PacketPlan& plan, const ShadowImage& shadow, size_t& skipped);
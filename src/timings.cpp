@@ -0,0 +1,34 @@
+#include "timings.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+
+double Timings::now_ms() const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - _origin).count();
+}
+
+void Timings::span(const std::string& label, double start_ms, double end_ms) {
+    _spans.push_back({label, start_ms, end_ms});
+}
+
+void Timings::note(const std::string& label, const std::string& text) {
+    _notes.emplace_back(label, text);
+}
+
+void Timings::print(std::ostream& out) const {
+    out << "\n=== Timings (ms since start) ===\n";
+    out << std::fixed << std::setprecision(1);
+    // In start order, so spans that ran concurrently sit next to each other.
+    std::vector<Span> spans = _spans;
+    std::stable_sort(spans.begin(), spans.end(),
+                     [](const Span& a, const Span& b) { return a.start_ms < b.start_ms; });
+    for (auto& s : spans) {
+        out << "  " << std::left << std::setw(16) << s.label << std::right
+            << std::setw(8) << s.start_ms << " -> " << std::setw(8) << s.end_ms
+            << "  (" << (s.end_ms - s.start_ms) << ")\n";
+    }
+    for (auto& [label, text] : _notes)
+        out << "  " << std::left << std::setw(16) << label << std::right << text << "\n";
+    out << std::defaultfloat;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------
+// --timings
+//
+// Named spans on one monotonic clock that starts with the process, printed
+// as start/end offsets so phases can be compared (and, where they run
+// concurrently, seen to overlap).
+// -----------------------------------------------------------------------
+class Timings {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Timings() : _origin(Clock::now()) {}
+
+    // Milliseconds since the Timings object was created.
+    double now_ms() const;
+
+    // Record a span [start_ms, end_ms].
+    void span(const std::string& label, double start_ms, double end_ms);
+
+    // Record a span from start_ms to now.
+    void end(const std::string& label, double start_ms) { span(label, start_ms, now_ms()); }
+
+    // Extra line printed under the spans ("input stall  0.0 ms ...").
+    void note(const std::string& label, const std::string& text);
+
+    void print(std::ostream& out) const;
+
+private:
+    struct Span {
+        std::string label;
+        double      start_ms;
+        double      end_ms;
+    };
+
+    Clock::time_point _origin;
+    std::vector<Span> _spans;
+    std::vector<std::pair<std::string, std::string>> _notes;
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Redragon M913 USB identifiers — original hardware (Areson, VID 25a7)
+static constexpr uint16_t M913_VID       = 0x25a7;
+static constexpr uint16_t M913_PID       = 0xfa07;  // 2.4G wireless receiver
+static constexpr uint16_t M913_PID_WIRED = 0xfa08;  // wired / dual-mode USB
+
+// Redragon M913 newer hardware (Compx, VID 3554)
+static constexpr uint16_t COMPX_VID       = 0x3554;
+static constexpr uint16_t COMPX_PID       = 0xf55d;  // 2.4G wireless receiver
+static constexpr uint16_t COMPX_PID_WIRED = 0xf55e;  // wired / 3-mode USB
+
+// Every supported VID/PID pair, in the order they are tried.
+struct UsbId { uint16_t vid; uint16_t pid; };
+static constexpr UsbId M913_SUPPORTED_IDS[] = {
+    {M913_VID,  M913_PID},
+    {M913_VID,  M913_PID_WIRED},
+    {COMPX_VID, COMPX_PID},
+    {COMPX_VID, COMPX_PID_WIRED},
+};
+
+// One attached M913, as found by discover_devices().
+struct UsbDeviceId {
+    uint16_t    vid     = 0;
+    uint16_t    pid     = 0;
+    uint8_t     bus     = 0;
+    uint8_t     address = 0;
+    std::string port_path;  // sysfs-style bus path, e.g. "1-2.3"
+    std::string serial;     // iSerialNumber, "" if the device has none
+};
+
+// Packet size for all M913 control/interrupt transfers
+static constexpr int M913_PACKET_SIZE = 17;
+
+// Control transfer parameters (host → device)
+static constexpr uint8_t  CTRL_REQUEST_TYPE = 0x21;  // host-to-device, class, interface
+static constexpr uint8_t  CTRL_REQUEST      = 0x09;  // HID SET_REPORT
+static constexpr uint16_t CTRL_VALUE        = 0x0308;
+static constexpr uint16_t CTRL_INDEX        = 0x0001;
+
+// Interrupt IN endpoints (device → host)
+static constexpr uint8_t INTERRUPT_EP_IN    = 0x82;  // config ACKs (interface 1)
+static constexpr uint8_t INTERRUPT_EP_MOUSE = 0x81;  // mouse HID reports (interface 0)
+
+// Timeout for USB transfers in milliseconds
+static constexpr unsigned int USB_TIMEOUT_MS = 2000;
+
+// Which interfaces a USB-level backend claims on open.
+enum class ClaimScope : uint8_t {
+    Config,  // interface 1 only (control writes, EP 0x82); the pointer stays with the kernel
+    All,     // every interface, for --probe and --listen
+};
+
+// Completion status passed to TransferCallback.  The values match
+// libusb_transfer_status so the libusb backend can pass its own through.
+enum TransferStatus : int {
+    TRANSFER_OK        = 0,
+    TRANSFER_ERROR     = 1,
+    TRANSFER_TIMED_OUT = 2,
+    TRANSFER_CANCELLED = 3,
+    TRANSFER_STALL     = 4,
+    TRANSFER_NO_DEVICE = 5,
+    TRANSFER_OVERFLOW  = 6,
+};
+
+// Completion callback for asynchronous transfers.
+//   status: TransferStatus of the finished transfer
+//   data:   bytes actually transferred (the received report for IN transfers)
+//   len:    number of valid bytes at data
+using TransferCallback = std::function<void(int status, const uint8_t* data, int len)>;
+
+// A failed transfer, with its TransferStatus.  TRANSFER_STALL and
+// TRANSFER_NO_DEVICE are what a dropped or wedged receiver produces;
+// Transport::reset() may bring it back without closing the device.
+class TransferError : public std::runtime_error {
+public:
+    TransferError(const std::string& what, int status)
+        : std::runtime_error(what), status(status) {}
+
+    int status;
+
+    bool resettable() const { return status == TRANSFER_STALL || status == TRANSFER_NO_DEVICE; }
+};
+
+// -----------------------------------------------------------------------
+// Transport
+//
+// The packet layer only needs to send 17-byte SET_REPORT packets and read
+// reports from the interrupt-IN endpoints; every backend (libusb, usbfs,
+// hidraw) implements this interface.  Endpoints are named by their USB address
+// even when the backend does not talk to endpoints directly.
+// -----------------------------------------------------------------------
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    // Short backend name for messages ("libusb", "usbfs", "hidraw").
+    virtual const char* name() const = 0;
+
+    virtual bool is_open() const = 0;
+
+    // Release the device (reattaching kernel drivers where they were detached).
+    virtual void close() = 0;
+
+    // HID report type/ID used for config writes.
+    // Areson hardware: 0x0308 (feature report). Compx hardware: 0x0208 (output report).
+    virtual void set_ctrl_value(uint16_t v) = 0;
+
+    // Send a 17-byte configuration packet to the mouse.
+    // Throws std::runtime_error on failure.
+    virtual void send(const uint8_t data[M913_PACKET_SIZE]) = 0;
+
+    // Read one report from `endpoint`, waiting at most timeout_ms.
+    // Returns the number of bytes received (0 on timeout); timeout_ms == 0
+    // only returns a report that is already buffered.
+    // Throws std::runtime_error on failure.
+    virtual int try_recv(uint8_t* buf, int buf_size, uint8_t endpoint = INTERRUPT_EP_IN,
+                         unsigned int timeout_ms = 500) = 0;
+
+    // Start buffering reports from `endpoint` (no-op where reports are
+    // always buffered).
+    virtual void queue_interrupt_in(uint8_t /*endpoint*/, TransferCallback /*cb*/ = nullptr) {}
+
+    // Queue a config write without waiting for it.  Backends without
+    // asynchronous writes send immediately and run cb before returning.
+    virtual void submit_send(const uint8_t data[M913_PACKET_SIZE], TransferCallback cb = nullptr) {
+        send(data);
+        if (cb) cb(TRANSFER_OK, data, M913_PACKET_SIZE);
+    }
+
+    // Number of submitted writes that have not completed yet.
+    virtual int pending_sends() const { return 0; }
+
+    // Wait until a transfer completes or a report arrives, at most
+    // timeout_ms.  Returns false on timeout.
+    virtual bool poll_events(unsigned int timeout_ms) = 0;
+
+    // Cancel everything in flight.
+    virtual void cancel_all() {}
+
+    // Reset the USB port and keep using the same device: claims are kept
+    // and interrupt-IN transfers queued again; buffered reports are
+    // dropped.  Returns false if the backend cannot reset (hidraw) or the
+    // device did not come back as itself.
+    virtual bool reset() { return false; }
+
+    // Print the device's interfaces and endpoints to stdout.  Only the
+    // USB-level backends can read USB descriptors; hidraw prints nothing.
+    virtual void probe() {}
+
+    // How long the pointer interface (0) was detached from its kernel
+    // driver, i.e. how long the mouse could not move.  Measured from the
+    // detach to the reattach in close(), or to now while still detached.
+    double input_stall_ms() const {
+        if (!_stalling) return _stall_ms;
+        return _stall_ms + std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - _stall_start).count();
+    }
+
+protected:
+    // Called by backends around detaching/reattaching interface 0.
+    void _stall_begin() {
+        if (_stalling) return;
+        _stalling    = true;
+        _stall_start = std::chrono::steady_clock::now();
+    }
+    void _stall_end() {
+        if (!_stalling) return;
+        _stall_ms = input_stall_ms();
+        _stalling = false;
+    }
+
+private:
+    std::chrono::steady_clock::time_point _stall_start{};
+    double _stall_ms  = 0;
+    bool   _stalling  = false;
+};
+
+// -----------------------------------------------------------------------
+// SendTracker
+//
+// Config writes queued with submit_send() by one pipelined sender.  The
+// completion callbacks share the failure count through a shared_ptr
+// instead of pointing into the sender's frame, and the destructor waits
+// (at most USB_TIMEOUT_MS) for writes still in flight, so a return or an
+// exception never leaves completions behind for whoever uses the
+// transport next (a reset, close() or the next request).
+// -----------------------------------------------------------------------
+class SendTracker {
+public:
+    explicit SendTracker(Transport& mouse) : _mouse(mouse) {}
+    ~SendTracker() {
+        try {
+            drain();
+        } catch (const std::exception&) {
+            // Device gone: close()/cancel_all() completes the rest, and
+            // the callbacks only touch _errors.
+        }
+    }
+
+    SendTracker(const SendTracker&)            = delete;
+    SendTracker& operator=(const SendTracker&) = delete;
+
+    void submit(const uint8_t data[M913_PACKET_SIZE]) {
+        std::shared_ptr<int> errors = _errors;
+        _mouse.submit_send(data, [errors](int status, const uint8_t*, int) {
+            if (status != TRANSFER_OK) ++*errors;
+        });
+    }
+
+    // Writes that completed with an error so far.
+    int errors() const { return *_errors; }
+
+    // Wait until every submitted write has completed, at most USB_TIMEOUT_MS.
+    void drain() {
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(USB_TIMEOUT_MS);
+        while (_mouse.pending_sends() > 0 && std::chrono::steady_clock::now() < until)
+            _mouse.poll_events(100);
+    }
+
+private:
+    Transport&           _mouse;
+    std::shared_ptr<int> _errors = std::make_shared<int>(0);
+};
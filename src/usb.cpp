@@ -1,10 +1,60 @@
 #include "usb.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 
+// Reports buffered per queued endpoint before the oldest are dropped.
+// EP 0x81 streams a report for every mouse movement, so it must be bounded.
+static constexpr size_t IN_QUEUE_MAX_REPORTS = 64;
+
+// Size of the one-shot transfer buffer: control setup + largest report.
+static constexpr int ONE_SHOT_BUF_SIZE = LIBUSB_CONTROL_SETUP_SIZE + 64;
+
+static const char* transfer_status_str(int status) {
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED: return "Success";
+        case LIBUSB_TRANSFER_ERROR:     return "Input/Output Error";
+        case LIBUSB_TRANSFER_TIMED_OUT: return "Operation timed out";
+        case LIBUSB_TRANSFER_CANCELLED: return "Transfer cancelled";
+        case LIBUSB_TRANSFER_STALL:     return "Pipe error";
+        case LIBUSB_TRANSFER_NO_DEVICE: return "No such device (it may have been disconnected)";
+        case LIBUSB_TRANSFER_OVERFLOW:  return "Overflow";
+        default:                        return "Unknown transfer status";
+    }
+}
+
+[[noreturn]] static void throw_transfer(const std::string& what, int status) {
+    throw TransferError(what + ": " + transfer_status_str(status), status);
+}
+
+// TransferStatus for a libusb_error returned by a libusb call.
+static int error_status(int r) {
+    switch (r) {
+        case LIBUSB_ERROR_PIPE:      return LIBUSB_TRANSFER_STALL;
+        case LIBUSB_ERROR_NO_DEVICE: return LIBUSB_TRANSFER_NO_DEVICE;
+        case LIBUSB_ERROR_TIMEOUT:   return LIBUSB_TRANSFER_TIMED_OUT;
+        default:                     return LIBUSB_TRANSFER_ERROR;
+    }
+}
+
+static std::string ep_hex(uint8_t endpoint) {
+    std::ostringstream s;
+    s << std::hex << static_cast<int>(endpoint);
+    return s.str();
+}
+
+// State of a one-shot (control or interrupt) transfer, owned by the
+// transfer until its completion callback runs.
+struct UsbMouse::PendingTransfer {
+    UsbMouse*        owner = nullptr;
+    TransferCallback cb;
+    unsigned char    buf[ONE_SHOT_BUF_SIZE] = {};
+};
+
 UsbMouse::UsbMouse() {
     int r = libusb_init(&_ctx);
     if (r < 0) {
@@ -40,15 +90,21 @@ void UsbMouse::open(uint16_t vid, uint16_t pid) {
     //   Interface 1: keyboard/extra buttons (config channel lives here)
     _claim_interface(0, _detached_iface0);
     _claim_interface(1, _detached_iface1);
+    _queue_default_endpoints();
 }
 
 void UsbMouse::close() {
     if (!_handle) return;
 
-    _release_interface(0, _detached_iface0);
+    cancel_all();
+    _free_in_queues();
+
+    if (_scope == ClaimScope::All)
+        _release_interface(0, _detached_iface0);
     _release_interface(1, _detached_iface1);
-    if (_num_interfaces > 2)
+    if (_scope == ClaimScope::All && _num_interfaces > 2)
         _release_interface(2, _detached_iface2);
+    _scope = ClaimScope::All;
 
     libusb_close(_handle);
     _handle = nullptr;
@@ -68,57 +124,203 @@ void UsbMouse::open_all_interfaces(uint16_t vid, uint16_t pid) {
             " — is the mouse plugged in? Try running with sudo.");
     }
 
-    // Discover how many interfaces the device has, then claim all of them.
-    libusb_device* dev = libusb_get_device(_handle);
-    libusb_config_descriptor* cfg = nullptr;
-    if (libusb_get_active_config_descriptor(dev, &cfg) == 0) {
-        _num_interfaces = cfg->bNumInterfaces;
-        libusb_free_config_descriptor(cfg);
+    _claim_all_interfaces();
+}
+
+void UsbMouse::open_device(const UsbDeviceId& id, ClaimScope scope, int num_interfaces) {
+    libusb_device** list = nullptr;
+    ssize_t n = libusb_get_device_list(_ctx, &list);
+    int r = LIBUSB_ERROR_NOT_FOUND;
+    for (ssize_t i = 0; i < n; ++i) {
+        if (libusb_get_bus_number(list[i]) == id.bus &&
+            libusb_get_device_address(list[i]) == id.address) {
+            r = libusb_open(list[i], &_handle);
+            break;
+        }
     }
+    if (n >= 0) libusb_free_device_list(list, 1);
 
-    _claim_interface(0, _detached_iface0);
+    if (r < 0) {
+        _handle = nullptr;
+        throw std::runtime_error(
+            "Could not open device at " + id.port_path + ": " +
+            libusb_strerror(static_cast<libusb_error>(r)));
+    }
+
+    _scope = scope;
+    if (scope == ClaimScope::All) {
+        _claim_all_interfaces(num_interfaces);
+        return;
+    }
+    // Config traffic only uses the control endpoint and EP 0x82.
     _claim_interface(1, _detached_iface1);
-    if (_num_interfaces > 2)
-        _claim_interface(2, _detached_iface2);
+    queue_interrupt_in(INTERRUPT_EP_IN);
 }
 
-void UsbMouse::send(const uint8_t data[M913_PACKET_SIZE]) {
-    // libusb_control_transfer expects a non-const data pointer for OUT transfers
-    // (it won't modify it, but the API isn't const-correct)
-    uint8_t buf[M913_PACKET_SIZE];
-    std::memcpy(buf, data, M913_PACKET_SIZE);
-
-    int r = libusb_control_transfer(
-        _handle,
-        CTRL_REQUEST_TYPE,
-        CTRL_REQUEST,
-        _ctrl_value,
-        CTRL_INDEX,
-        buf,
-        M913_PACKET_SIZE,
-        USB_TIMEOUT_MS);
+// -----------------------------------------------------------------------
+// Asynchronous API
+// -----------------------------------------------------------------------
+
+void UsbMouse::submit_send(const uint8_t data[M913_PACKET_SIZE], TransferCallback cb) {
+    libusb_transfer* xfer = libusb_alloc_transfer(0);
+    if (!xfer)
+        throw std::runtime_error("libusb_alloc_transfer failed");
+
+    auto* pt  = new PendingTransfer;
+    pt->owner = this;
+    pt->cb    = std::move(cb);
+    libusb_fill_control_setup(pt->buf, CTRL_REQUEST_TYPE, CTRL_REQUEST,
+                              _ctrl_value, CTRL_INDEX, M913_PACKET_SIZE);
+    std::memcpy(pt->buf + LIBUSB_CONTROL_SETUP_SIZE, data, M913_PACKET_SIZE);
+    libusb_fill_control_transfer(xfer, _handle, pt->buf, _on_one_shot_done, pt,
+                                 USB_TIMEOUT_MS);
+    _submit_one_shot(xfer, pt);
+}
 
+void UsbMouse::queue_interrupt_in(uint8_t endpoint, TransferCallback cb) {
+    auto& q = _in_queues[endpoint];
+    if (q && q->active) return;
+    if (!q) {
+        q = std::make_unique<InQueue>();
+        q->owner = this;
+        q->buf.resize(static_cast<size_t>(_endpoint_max_packet(endpoint)));
+        q->xfer = libusb_alloc_transfer(0);
+        if (!q->xfer) {
+            _in_queues.erase(endpoint);
+            throw std::runtime_error("libusb_alloc_transfer failed");
+        }
+    }
+    if (cb) q->cb = std::move(cb);
+    q->error = 0;
+
+    // No libusb timeout: the transfer stays queued until data arrives or
+    // it is cancelled.
+    libusb_fill_interrupt_transfer(q->xfer, _handle, endpoint, q->buf.data(),
+                                   static_cast<int>(q->buf.size()),
+                                   _on_in_queue_done, q.get(), 0);
+    int r = libusb_submit_transfer(q->xfer);
     if (r < 0) {
         throw std::runtime_error(
-            std::string("Control transfer (send) failed: ") +
+            "Failed to queue interrupt transfer on EP 0x" + ep_hex(endpoint) + ": " +
             libusb_strerror(static_cast<libusb_error>(r)));
     }
+    q->active = true;
+}
+
+bool UsbMouse::poll_events(unsigned int timeout_ms) {
+    unsigned long before = _completions;
+    timeval tv{};
+    tv.tv_sec  = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    int completed = 0;
+    libusb_handle_events_timeout_completed(_ctx, &tv, &completed);
+    return _completions != before;
+}
+
+void UsbMouse::cancel_all() {
+    _cancelling = true;
+    for (libusb_transfer* xfer : _sends)
+        libusb_cancel_transfer(xfer);
+    for (auto& [ep, q] : _in_queues)
+        if (q->active) libusb_cancel_transfer(q->xfer);
+
+    auto busy = [this] {
+        if (!_sends.empty()) return true;
+        for (auto& [ep, q] : _in_queues)
+            if (q->active) return true;
+        return false;
+    };
+    // Cancellation is asynchronous; bound the wait in case the device is gone.
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(USB_TIMEOUT_MS);
+    while (busy() && std::chrono::steady_clock::now() < deadline)
+        poll_events(100);
+    _cancelling = false;
+}
+
+bool UsbMouse::reset() {
+    if (!_handle) return false;
+    cancel_all();
+    for (auto& [ep, q] : _in_queues)
+        if (q->active) return false;
+
+    // LIBUSB_ERROR_NOT_FOUND: it came back as a different device and has
+    // to be opened again.
+    if (libusb_reset_device(_handle) < 0) return false;
+
+    try {
+        for (auto& [ep, q] : _in_queues) {
+            q->reports.clear();
+            queue_interrupt_in(ep);
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+void LIBUSB_CALL UsbMouse::_on_one_shot_done(libusb_transfer* xfer) {
+    auto* pt = static_cast<PendingTransfer*>(xfer->user_data);
+    UsbMouse* self = pt->owner;
+    ++self->_completions;
+    self->_sends.erase(xfer);
+
+    const uint8_t* data = xfer->buffer;
+    if (xfer->type == LIBUSB_TRANSFER_TYPE_CONTROL)
+        data = libusb_control_transfer_get_data(xfer);
+    if (pt->cb)
+        pt->cb(xfer->status, data, xfer->actual_length);
+
+    delete pt;
+    libusb_free_transfer(xfer);
+}
+
+void LIBUSB_CALL UsbMouse::_on_in_queue_done(libusb_transfer* xfer) {
+    auto* q = static_cast<InQueue*>(xfer->user_data);
+    ++q->owner->_completions;
+    q->active = false;
+
+    if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        if (xfer->status != LIBUSB_TRANSFER_CANCELLED)
+            q->error = xfer->status;
+        if (q->cb) q->cb(xfer->status, nullptr, 0);
+        return;
+    }
+
+    if (q->reports.size() >= IN_QUEUE_MAX_REPORTS)
+        q->reports.pop_front();
+    q->reports.emplace_back(q->buf.begin(), q->buf.begin() + xfer->actual_length);
+    if (q->cb) q->cb(xfer->status, q->buf.data(), xfer->actual_length);
+
+    if (q->owner->_cancelling) return;
+    if (libusb_submit_transfer(xfer) == 0)
+        q->active = true;
+    else
+        q->error = LIBUSB_TRANSFER_ERROR;
+}
+
+// -----------------------------------------------------------------------
+// Synchronous wrappers
+// -----------------------------------------------------------------------
+
+void UsbMouse::send(const uint8_t data[M913_PACKET_SIZE]) {
+    bool done   = false;
+    int  status = LIBUSB_TRANSFER_ERROR;
+    submit_send(data, [&](int st, const uint8_t*, int) { done = true; status = st; });
+    // The transfer carries its own USB_TIMEOUT_MS, so it always completes.
+    _wait_for(done, 0);
+
+    if (status != LIBUSB_TRANSFER_COMPLETED)
+        throw_transfer("Control transfer (send) failed", status);
 }
 
 void UsbMouse::recv(uint8_t data[M913_PACKET_SIZE]) {
-    int transferred = 0;
-    int r = libusb_interrupt_transfer(
-        _handle,
-        INTERRUPT_EP_IN,
-        data,
-        M913_PACKET_SIZE,
-        &transferred,
-        USB_TIMEOUT_MS);
+    int transferred = try_recv(data, M913_PACKET_SIZE, INTERRUPT_EP_IN, USB_TIMEOUT_MS);
 
-    if (r < 0) {
+    if (transferred == 0) {
         throw std::runtime_error(
             std::string("Interrupt transfer (recv) failed: ") +
-            libusb_strerror(static_cast<libusb_error>(r)));
+            transfer_status_str(LIBUSB_TRANSFER_TIMED_OUT));
     }
     if (transferred != M913_PACKET_SIZE) {
         throw std::runtime_error(
@@ -134,23 +336,67 @@ void UsbMouse::send_recv(const uint8_t tx[M913_PACKET_SIZE], uint8_t rx[M913_PAC
 
 int UsbMouse::try_recv(uint8_t* buf, int buf_size, uint8_t endpoint,
                        unsigned int timeout_ms) {
-    int transferred = 0;
-    int r = libusb_interrupt_transfer(
-        _handle,
-        endpoint,
-        buf,
-        buf_size,
-        &transferred,
-        timeout_ms);
-
-    if (r == LIBUSB_ERROR_TIMEOUT) return 0;
-    if (r < 0) {
-        throw std::runtime_error(
-            std::string("Interrupt transfer failed on EP 0x") +
-            [endpoint]{ std::ostringstream s; s << std::hex << static_cast<int>(endpoint); return s.str(); }() +
-            ": " + libusb_strerror(static_cast<libusb_error>(r)));
+    auto it = _in_queues.find(endpoint);
+    if (it != _in_queues.end()) {
+        InQueue& q = *it->second;
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms);
+        if (q.reports.empty())
+            poll_events(0);
+        while (q.reports.empty() && q.active) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) break;
+            poll_events(static_cast<unsigned int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()));
+        }
+        if (q.reports.empty()) {
+            if (q.error)
+                throw_transfer("Interrupt transfer failed on EP 0x" + ep_hex(endpoint), q.error);
+            return 0;
+        }
+        const std::vector<uint8_t>& rep = q.reports.front();
+        int n = std::min(buf_size, static_cast<int>(rep.size()));
+        std::memcpy(buf, rep.data(), static_cast<size_t>(n));
+        q.reports.pop_front();
+        return n;
+    }
+
+    if (timeout_ms == 0) return 0;
+
+    // One-shot read on an endpoint without a permanent queue.  libusb's own
+    // timeout is not used; the transfer is cancelled when the deadline passes.
+    libusb_transfer* xfer = libusb_alloc_transfer(0);
+    if (!xfer)
+        throw std::runtime_error("libusb_alloc_transfer failed");
+
+    bool done   = false;
+    int  status = LIBUSB_TRANSFER_ERROR;
+    int  got    = 0;
+    auto* pt  = new PendingTransfer;
+    pt->owner = this;
+    pt->cb    = [&](int st, const uint8_t* data, int len) {
+        done   = true;
+        status = st;
+        got    = std::min(len, buf_size);
+        if (st == LIBUSB_TRANSFER_COMPLETED && got > 0)
+            std::memcpy(buf, data, static_cast<size_t>(got));
+    };
+    libusb_fill_interrupt_transfer(xfer, _handle, endpoint, pt->buf,
+                                   std::min(buf_size, ONE_SHOT_BUF_SIZE),
+                                   _on_one_shot_done, pt, 0);
+    _submit_one_shot(xfer, pt);
+
+    _wait_for(done, timeout_ms);
+    if (!done) {
+        libusb_cancel_transfer(xfer);
+        _wait_for(done, 0);
     }
-    return transferred;
+
+    if (status == LIBUSB_TRANSFER_CANCELLED || status == LIBUSB_TRANSFER_TIMED_OUT)
+        return 0;
+    if (status != LIBUSB_TRANSFER_COMPLETED)
+        throw_transfer("Interrupt transfer failed on EP 0x" + ep_hex(endpoint), status);
+    return got;
 }
 
 void UsbMouse::probe() {
@@ -212,6 +458,7 @@ void UsbMouse::_claim_interface(int iface, bool& detached_flag) {
                 libusb_strerror(static_cast<libusb_error>(r)));
         }
         detached_flag = true;
+        if (iface == 0) _stall_begin();
     }
 
     int r = libusb_claim_interface(_handle, iface);
@@ -222,9 +469,98 @@ void UsbMouse::_claim_interface(int iface, bool& detached_flag) {
     }
 }
 
+// Discover how many interfaces the device has (unless the caller already
+// knows), then claim all of them.
+void UsbMouse::_claim_all_interfaces(int num_interfaces) {
+    if (num_interfaces > 0) {
+        _num_interfaces = num_interfaces;
+    } else {
+        libusb_device* dev = libusb_get_device(_handle);
+        libusb_config_descriptor* cfg = nullptr;
+        if (libusb_get_active_config_descriptor(dev, &cfg) == 0) {
+            _num_interfaces = cfg->bNumInterfaces;
+            libusb_free_config_descriptor(cfg);
+        }
+    }
+
+    _claim_interface(0, _detached_iface0);
+    _claim_interface(1, _detached_iface1);
+    if (_num_interfaces > 2)
+        _claim_interface(2, _detached_iface2);
+    _queue_default_endpoints();
+}
+
+// Keep interrupt-IN transfers queued on the mouse and config endpoints so
+// ACKs, hello packets and button reports are captured as soon as they arrive.
+void UsbMouse::_queue_default_endpoints() {
+    queue_interrupt_in(INTERRUPT_EP_IN);
+    queue_interrupt_in(INTERRUPT_EP_MOUSE);
+}
+
+// wMaxPacketSize of an endpoint from the active configuration (64 if unknown).
+// Interrupt transfers are sized to exactly one packet: a full-size packet
+// would otherwise leave the transfer waiting for more data.
+int UsbMouse::_endpoint_max_packet(uint8_t endpoint) const {
+    int size = 64;
+    libusb_config_descriptor* cfg = nullptr;
+    if (libusb_get_active_config_descriptor(libusb_get_device(_handle), &cfg) < 0)
+        return size;
+    for (int i = 0; i < cfg->bNumInterfaces; ++i) {
+        const auto& iface = cfg->interface[i];
+        for (int a = 0; a < iface.num_altsetting; ++a) {
+            const auto& alt = iface.altsetting[a];
+            for (int e = 0; e < alt.bNumEndpoints; ++e)
+                if (alt.endpoint[e].bEndpointAddress == endpoint)
+                    size = alt.endpoint[e].wMaxPacketSize;
+        }
+    }
+    libusb_free_config_descriptor(cfg);
+    return size;
+}
+
+void UsbMouse::_submit_one_shot(libusb_transfer* xfer, PendingTransfer* pt) {
+    int r = libusb_submit_transfer(xfer);
+    if (r < 0) {
+        delete pt;
+        libusb_free_transfer(xfer);
+        throw TransferError(std::string("Failed to submit transfer: ") +
+                                libusb_strerror(static_cast<libusb_error>(r)),
+                            error_status(r));
+    }
+    _sends.insert(xfer);
+}
+
+// Run the event loop until `done` is set by a completion callback.
+// timeout_ms == 0 waits without a deadline.
+void UsbMouse::_wait_for(const bool& done, unsigned int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    while (!done) {
+        unsigned int slice = 100;
+        if (timeout_ms) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) return;
+            slice = static_cast<unsigned int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count());
+        }
+        poll_events(slice);
+    }
+}
+
+void UsbMouse::_free_in_queues() {
+    for (auto& [ep, q] : _in_queues) {
+        // A transfer still marked active could not be cancelled; leaking it
+        // is safer than freeing memory libusb may still write to.
+        if (!q->active) libusb_free_transfer(q->xfer);
+        else            q.release();
+    }
+    _in_queues.clear();
+}
+
 void UsbMouse::_release_interface(int iface, bool detached_flag) {
     libusb_release_interface(_handle, iface);
     if (detached_flag) {
         libusb_attach_kernel_driver(_handle, iface);
+        if (iface == 0) _stall_end();
     }
 }
\ No newline at end of file
@@ -1,40 +1,24 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <libusb.h>
 
-// Redragon M913 USB identifiers — original hardware (Areson, VID 25a7)
-static constexpr uint16_t M913_VID       = 0x25a7;
-static constexpr uint16_t M913_PID       = 0xfa07;  // 2.4G wireless receiver
-static constexpr uint16_t M913_PID_WIRED = 0xfa08;  // wired / dual-mode USB
+#include "transport.h"
 
-// Redragon M913 newer hardware (Compx, VID 3554)
-static constexpr uint16_t COMPX_VID       = 0x3554;
-static constexpr uint16_t COMPX_PID       = 0xf55d;  // 2.4G wireless receiver
-static constexpr uint16_t COMPX_PID_WIRED = 0xf55e;  // wired / 3-mode USB
-
-// Packet size for all M913 control/interrupt transfers
-static constexpr int M913_PACKET_SIZE = 17;
-
-// Control transfer parameters (host → device)
-static constexpr uint8_t  CTRL_REQUEST_TYPE = 0x21;  // host-to-device, class, interface
-static constexpr uint8_t  CTRL_REQUEST      = 0x09;  // HID SET_REPORT
-static constexpr uint16_t CTRL_VALUE        = 0x0308;
-static constexpr uint16_t CTRL_INDEX        = 0x0001;
-
-// Interrupt IN endpoint (device → host)
-static constexpr uint8_t INTERRUPT_EP_IN = 0x82;
-
-// Timeout for USB transfers in milliseconds
-static constexpr unsigned int USB_TIMEOUT_MS = 2000;
-
-class UsbMouse {
+class UsbMouse : public Transport {
 public:
     UsbMouse();
-    ~UsbMouse();
+    ~UsbMouse() override;
+
+    const char* name() const override { return "libusb"; }
 
     // Non-copyable
     UsbMouse(const UsbMouse&) = delete;
@@ -46,16 +30,58 @@ public:
     // Open and claim all interfaces found on the device (for debug/investigation)
     void open_all_interfaces(uint16_t vid, uint16_t pid);
 
+    // Open one device returned by discover_devices().  ClaimScope::All
+    // claims every interface (num_interfaces of them if known, else per the
+    // descriptors); ClaimScope::Config claims only interface 1 and leaves
+    // the pointer bound to the kernel.  Unlike open_all_interfaces() this
+    // can tell identical receivers apart.
+    // Throws std::runtime_error if it is gone or cannot be opened.
+    void open_device(const UsbDeviceId& id, ClaimScope scope = ClaimScope::All,
+                     int num_interfaces = 0);
+
     // Override the HID report type used in SET_REPORT control transfers.
     // Areson hardware: 0x0308 (feature report). Compx hardware: 0x0208 (output report).
-    void set_ctrl_value(uint16_t v) { _ctrl_value = v; }
+    void set_ctrl_value(uint16_t v) override { _ctrl_value = v; }
 
     // Close and reattach kernel driver
-    void close();
+    void close() override;
+
+    // ---- Asynchronous API (libusb_submit_transfer) ----
+    //
+    // All completions are delivered from poll_events(), on the caller's
+    // thread.  The synchronous methods below are thin wrappers that submit
+    // a transfer and run the event loop until it finishes.
+
+    // Queue a SET_REPORT control transfer without waiting for it.
+    // cb (optional) runs once the transfer completes, fails or is cancelled.
+    // Throws std::runtime_error if the transfer cannot be submitted.
+    void submit_send(const uint8_t data[M913_PACKET_SIZE], TransferCallback cb = nullptr) override;
+
+    // Keep an interrupt-IN transfer permanently queued on `endpoint`.
+    // Every completed report is buffered for try_recv() (and handed to cb,
+    // if given) and the transfer is resubmitted immediately, so nothing the
+    // device sends between two reads is lost.  No-op if already queued.
+    void queue_interrupt_in(uint8_t endpoint, TransferCallback cb = nullptr) override;
+
+    // Run the libusb event loop until at least one transfer completes or
+    // timeout_ms elapses.  Returns false on timeout.
+    bool poll_events(unsigned int timeout_ms) override;
+
+    // Cancel every in-flight transfer (pending sends and the queued
+    // interrupt-IN transfers) and wait for the cancellations to land.
+    void cancel_all() override;
+
+    // libusb_reset_device(); libusb restores the claimed interfaces.
+    bool reset() override;
+
+    // Number of submitted control transfers that have not completed yet.
+    int pending_sends() const override { return static_cast<int>(_sends.size()); }
+
+    // ---- Synchronous API ----
 
     // Send a 17-byte configuration packet to the mouse
     // Throws std::runtime_error on failure
-    void send(const uint8_t data[M913_PACKET_SIZE]);
+    void send(const uint8_t data[M913_PACKET_SIZE]) override;
 
     // Receive a 17-byte response from the mouse via interrupt transfer
     // Throws std::runtime_error on failure
@@ -67,15 +93,31 @@ public:
     // Like recv(), but returns false on timeout instead of throwing.
     // Returns the number of bytes actually received (0 on timeout).
     // buf must be at least buf_size bytes. Used by --listen mode.
+    // Reads from the permanent queue when `endpoint` has one; otherwise a
+    // one-shot transfer is submitted and cancelled when timeout_ms expires.
+    // timeout_ms == 0 only returns a report that is already buffered.
     int try_recv(uint8_t* buf, int buf_size, uint8_t endpoint = INTERRUPT_EP_IN,
-                 unsigned int timeout_ms = 500);
+                 unsigned int timeout_ms = 500) override;
 
     // Print all USB interfaces and endpoints for this device to stdout.
-    void probe();
+    void probe() override;
 
-    bool is_open() const { return _handle != nullptr; }
+    bool is_open() const override { return _handle != nullptr; }
 
 private:
+    struct PendingTransfer;  // one-shot transfer state, see usb.cpp
+
+    // A permanently queued interrupt-IN transfer and its receive buffer.
+    struct InQueue {
+        UsbMouse*                        owner  = nullptr;
+        libusb_transfer*                 xfer   = nullptr;
+        std::vector<uint8_t>             buf;
+        std::deque<std::vector<uint8_t>> reports;
+        TransferCallback                 cb;
+        bool                             active = false;  // transfer is submitted
+        int                              error  = 0;      // fatal libusb_transfer_status
+    };
+
     libusb_context*       _ctx    = nullptr;
     libusb_device_handle* _handle = nullptr;
 
@@ -84,7 +126,22 @@ private:
     bool     _detached_iface2 = false;
     int      _num_interfaces   = 2;
     uint16_t _ctrl_value       = CTRL_VALUE;
+    ClaimScope _scope          = ClaimScope::All;
+
+    std::set<libusb_transfer*>                _sends;      // in-flight one-shot transfers
+    std::map<uint8_t, std::unique_ptr<InQueue>> _in_queues;  // keyed by endpoint
+    unsigned long                             _completions = 0;
+    bool                                      _cancelling  = false;  // inside cancel_all()
 
+    void _claim_all_interfaces(int num_interfaces = 0);
     void _claim_interface(int iface, bool& detached_flag);
     void _release_interface(int iface, bool detached_flag);
+    void _queue_default_endpoints();
+    int  _endpoint_max_packet(uint8_t endpoint) const;
+    void _submit_one_shot(libusb_transfer* xfer, PendingTransfer* pt);
+    void _wait_for(const bool& done, unsigned int timeout_ms);
+    void _free_in_queues();
+
+    static void LIBUSB_CALL _on_one_shot_done(libusb_transfer* xfer);
+    static void LIBUSB_CALL _on_in_queue_done(libusb_transfer* xfer);
 };
\ No newline at end of file
@@ -0,0 +1,602 @@
+#include "usbfs.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <linux/usbdevice_fs.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// Reports buffered per queued endpoint before the oldest are dropped.
+// EP 0x81 streams a report for every mouse movement, so it must be bounded.
+static constexpr size_t IN_QUEUE_MAX_REPORTS = 64;
+
+static constexpr int CTRL_SETUP_SIZE = 8;
+static constexpr int URB_BUF_SIZE    = CTRL_SETUP_SIZE + 64;
+
+// Descriptor types found in the blob read from the device node.
+static constexpr uint8_t DESC_DEVICE    = 0x01;
+static constexpr uint8_t DESC_CONFIG    = 0x02;
+static constexpr uint8_t DESC_INTERFACE = 0x04;
+static constexpr uint8_t DESC_ENDPOINT  = 0x05;
+
+// A URB and the buffer it points at.  The kernel hands back the
+// usbdevfs_urb pointer on reap; usercontext leads back to this wrapper.
+// usbdevfs_urb ends in a flexible array (iso frames), so it must come last.
+struct UsbfsMouse::Urb {
+    TransferCallback cb;
+    InQueue*         queue = nullptr;   // set for permanently queued interrupt-IN URBs
+    std::chrono::steady_clock::time_point deadline{};  // one-shot URBs only
+    bool             has_deadline = false;
+    bool             expired      = false;  // discarded because the deadline passed
+    unsigned char    buf[URB_BUF_SIZE] = {};
+    usbdevfs_urb     urb{};
+};
+
+static const char* transfer_status_str(int status) {
+    switch (status) {
+        case TRANSFER_OK:        return "Success";
+        case TRANSFER_ERROR:     return "Input/Output Error";
+        case TRANSFER_TIMED_OUT: return "Operation timed out";
+        case TRANSFER_CANCELLED: return "Transfer cancelled";
+        case TRANSFER_STALL:     return "Pipe error";
+        case TRANSFER_NO_DEVICE: return "No such device (it may have been disconnected)";
+        case TRANSFER_OVERFLOW:  return "Overflow";
+        default:                 return "Unknown transfer status";
+    }
+}
+
+// Map a reaped URB's negative errno onto TransferStatus.
+static int urb_status(int st) {
+    switch (st) {
+        case 0:            return TRANSFER_OK;
+        case -ENOENT:
+        case -ECONNRESET:  return TRANSFER_CANCELLED;
+        case -ETIMEDOUT:   return TRANSFER_TIMED_OUT;
+        case -EPIPE:       return TRANSFER_STALL;
+        case -ENODEV:
+        case -ESHUTDOWN:   return TRANSFER_NO_DEVICE;
+        case -EOVERFLOW:   return TRANSFER_OVERFLOW;
+        default:           return TRANSFER_ERROR;
+    }
+}
+
+[[noreturn]] static void throw_transfer(const std::string& what, int status) {
+    throw TransferError(what + ": " + transfer_status_str(status), status);
+}
+
+static std::string ep_hex(uint8_t endpoint) {
+    std::ostringstream s;
+    s << std::hex << static_cast<int>(endpoint);
+    return s.str();
+}
+
+static void fill_control_setup(unsigned char* setup, uint16_t value) {
+    setup[0] = CTRL_REQUEST_TYPE;
+    setup[1] = CTRL_REQUEST;
+    setup[2] = static_cast<unsigned char>(value & 0xFF);
+    setup[3] = static_cast<unsigned char>(value >> 8);
+    setup[4] = static_cast<unsigned char>(CTRL_INDEX & 0xFF);
+    setup[5] = static_cast<unsigned char>(CTRL_INDEX >> 8);
+    setup[6] = M913_PACKET_SIZE;
+    setup[7] = 0;
+}
+
+UsbfsMouse::~UsbfsMouse() {
+    close();
+}
+
+// -----------------------------------------------------------------------
+// Open and close
+// -----------------------------------------------------------------------
+
+void UsbfsMouse::open_device(const UsbDeviceId& id, ClaimScope scope, int num_interfaces) {
+    char path[32];
+    std::snprintf(path, sizeof(path), "/dev/bus/usb/%03d/%03d", id.bus, id.address);
+    open_path(path, scope, num_interfaces);
+}
+
+void UsbfsMouse::open_path(const std::string& devnode, ClaimScope scope,
+                           int num_interfaces) {
+    int fd = ::open(devnode.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "Could not open " + devnode + ": " + std::strerror(errno) +
+            " — try running with sudo or install the udev rule.");
+    }
+
+    // Reading the node returns the device descriptor followed by the
+    // configuration descriptors, without any USB traffic.
+    _descriptors.clear();
+    unsigned char chunk[512];
+    ssize_t n;
+    while ((n = ::read(fd, chunk, sizeof(chunk))) > 0)
+        _descriptors.insert(_descriptors.end(), chunk, chunk + n);
+
+    _fd = fd;
+    try {
+        // Keep interrupt-IN URBs queued on the claimed endpoints so ACKs,
+        // hello packets and button reports are captured as they arrive.
+        // Config traffic only uses the control endpoint and EP 0x82.
+        if (scope == ClaimScope::All) {
+            _claim_all_interfaces(num_interfaces);
+            queue_interrupt_in(INTERRUPT_EP_IN);
+            queue_interrupt_in(INTERRUPT_EP_MOUSE);
+        } else {
+            _claim_interface(1);
+            queue_interrupt_in(INTERRUPT_EP_IN);
+        }
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+uint16_t UsbfsMouse::vendor_id() const {
+    if (_descriptors.size() < 18 || _descriptors[1] != DESC_DEVICE) return 0;
+    return static_cast<uint16_t>(_descriptors[8] | (_descriptors[9] << 8));
+}
+
+uint16_t UsbfsMouse::product_id() const {
+    if (_descriptors.size() < 18 || _descriptors[1] != DESC_DEVICE) return 0;
+    return static_cast<uint16_t>(_descriptors[10] | (_descriptors[11] << 8));
+}
+
+void UsbfsMouse::close() {
+    if (_fd < 0) return;
+
+    cancel_all();
+    for (auto& [ep, q] : _in_queues) {
+        // A URB still marked active could not be discarded; leaking it is
+        // safer than freeing memory the kernel may still write to.
+        if (!q.active) delete q.urb;
+    }
+    _in_queues.clear();
+
+    _release_all_interfaces();
+    ::close(_fd);
+    _fd = -1;
+}
+
+// -----------------------------------------------------------------------
+// Asynchronous API
+// -----------------------------------------------------------------------
+
+void UsbfsMouse::submit_send(const uint8_t data[M913_PACKET_SIZE], TransferCallback cb) {
+    auto* u = new Urb;
+    u->cb = std::move(cb);
+    u->has_deadline = true;
+    u->deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(USB_TIMEOUT_MS);
+    fill_control_setup(u->buf, _ctrl_value);
+    std::memcpy(u->buf + CTRL_SETUP_SIZE, data, M913_PACKET_SIZE);
+
+    u->urb.type          = USBDEVFS_URB_TYPE_CONTROL;
+    u->urb.endpoint      = 0;
+    u->urb.buffer        = u->buf;
+    u->urb.buffer_length = CTRL_SETUP_SIZE + M913_PACKET_SIZE;
+    _submit_one_shot(u);
+}
+
+void UsbfsMouse::queue_interrupt_in(uint8_t endpoint, TransferCallback cb) {
+    InQueue& q = _in_queues[endpoint];
+    if (q.active) return;
+    if (!q.urb) {
+        q.urb = new Urb;
+        q.urb->queue = &q;
+    }
+    if (cb) q.cb = std::move(cb);
+    q.error = 0;
+
+    Urb* u = q.urb;
+    u->urb = usbdevfs_urb{};
+    u->urb.type          = USBDEVFS_URB_TYPE_INTERRUPT;
+    u->urb.endpoint      = endpoint;
+    u->urb.buffer        = u->buf;
+    u->urb.buffer_length = std::min(_endpoint_max_packet(endpoint), URB_BUF_SIZE);
+    u->urb.usercontext   = u;
+    if (ioctl(_fd, USBDEVFS_SUBMITURB, &u->urb) < 0) {
+        throw std::runtime_error(
+            "Failed to queue interrupt transfer on EP 0x" + ep_hex(endpoint) + ": " +
+            std::strerror(errno));
+    }
+    q.active = true;
+}
+
+// usbfs raises POLLOUT on the device fd while reaped-ready URBs are waiting.
+bool UsbfsMouse::poll_events(unsigned int timeout_ms) {
+    unsigned long before = _completions;
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+
+    for (;;) {
+        bool gone = !_reap_all();
+        _expire_sends();
+        if (_completions != before || gone) break;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) break;
+        auto wait = deadline;
+        for (Urb* u : _sends)
+            if (u->has_deadline && !u->expired) wait = std::min(wait, u->deadline);
+
+        pollfd p{_fd, POLLOUT, 0};
+        int ms = static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(wait - now).count());
+        if (::poll(&p, 1, std::max(ms, 0)) < 0 && errno != EINTR) break;
+    }
+    return _completions != before;
+}
+
+void UsbfsMouse::cancel_all() {
+    if (_fd < 0) return;
+    _cancelling = true;
+    for (Urb* u : _sends)
+        ioctl(_fd, USBDEVFS_DISCARDURB, &u->urb);
+    for (auto& [ep, q] : _in_queues)
+        if (q.active) ioctl(_fd, USBDEVFS_DISCARDURB, &q.urb->urb);
+
+    auto busy = [this] {
+        if (!_sends.empty()) return true;
+        for (auto& [ep, q] : _in_queues)
+            if (q.active) return true;
+        return false;
+    };
+    // Discarded URBs still have to be reaped; bound the wait in case the
+    // device is gone.
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(USB_TIMEOUT_MS);
+    while (busy() && std::chrono::steady_clock::now() < deadline)
+        poll_events(100);
+    _cancelling = false;
+}
+
+bool UsbfsMouse::reset() {
+    if (_fd < 0) return false;
+    cancel_all();
+    // A URB the kernel still owns would complete into the reset device,
+    // and a one-shot one into a caller that has moved on.
+    if (!_sends.empty()) return false;
+    for (auto& [ep, q] : _in_queues)
+        if (q.active) return false;
+
+    int r;
+    do {
+        r = ioctl(_fd, USBDEVFS_RESET, 0);
+    } while (r < 0 && errno == EINTR);
+    // ENODEV: it re-enumerated as a new device node, which needs a new open.
+    if (r < 0) return false;
+
+    // Claims survive the reset; the queued URBs do not.
+    try {
+        for (auto& [ep, q] : _in_queues) {
+            q.reports.clear();
+            queue_interrupt_in(ep);
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// Reap every completed URB without blocking.  Returns false once the
+// device has disappeared.
+bool UsbfsMouse::_reap_all() {
+    for (;;) {
+        usbdevfs_urb* done = nullptr;
+        if (ioctl(_fd, USBDEVFS_REAPURBNDELAY, &done) < 0) {
+            if (errno == EAGAIN) return true;
+            if (errno == EINTR) continue;
+            // ENODEV: the device is gone and every URB has been reaped.
+            // One-shot URBs the kernel never handed back are finished here
+            // too, so cancel_all() does not wait out its bound for them
+            // and close() does not leak them.
+            for (auto& [ep, q] : _in_queues)
+                if (q.active) { q.active = false; q.error = TRANSFER_NO_DEVICE; }
+            std::vector<Urb*> orphans(_sends.begin(), _sends.end());
+            for (Urb* u : orphans) {
+                u->urb.status = -ENODEV;
+                u->expired    = false;
+                _complete(u);
+            }
+            return false;
+        }
+        _complete(static_cast<Urb*>(done->usercontext));
+    }
+}
+
+void UsbfsMouse::_complete(Urb* u) {
+    ++_completions;
+    int status = urb_status(u->urb.status);
+
+    if (InQueue* q = u->queue) {
+        q->active = false;
+        if (status != TRANSFER_OK) {
+            if (status != TRANSFER_CANCELLED)
+                q->error = status;
+            if (q->cb) q->cb(status, nullptr, 0);
+            return;
+        }
+
+        int len = u->urb.actual_length;
+        if (q->reports.size() >= IN_QUEUE_MAX_REPORTS)
+            q->reports.pop_front();
+        q->reports.emplace_back(u->buf, u->buf + len);
+        if (q->cb) q->cb(status, u->buf, len);
+
+        if (_cancelling) return;
+        u->urb.status        = 0;
+        u->urb.actual_length = 0;
+        if (ioctl(_fd, USBDEVFS_SUBMITURB, &u->urb) == 0)
+            q->active = true;
+        else
+            q->error = TRANSFER_ERROR;
+        return;
+    }
+
+    _sends.erase(u);
+    if (u->expired && status == TRANSFER_CANCELLED)
+        status = TRANSFER_TIMED_OUT;
+    const uint8_t* data = u->buf;
+    int len = u->urb.actual_length;
+    if (u->urb.type == USBDEVFS_URB_TYPE_CONTROL)
+        data += CTRL_SETUP_SIZE;
+    if (u->cb) u->cb(status, data, len);
+    delete u;
+}
+
+// usbfs URBs carry no timeout of their own: discard the ones past their
+// deadline, they are reported as TRANSFER_TIMED_OUT when reaped.
+void UsbfsMouse::_expire_sends() {
+    auto now = std::chrono::steady_clock::now();
+    for (Urb* u : _sends) {
+        if (u->has_deadline && !u->expired && now >= u->deadline) {
+            u->expired = true;
+            ioctl(_fd, USBDEVFS_DISCARDURB, &u->urb);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+// Synchronous API
+// -----------------------------------------------------------------------
+
+void UsbfsMouse::send(const uint8_t data[M913_PACKET_SIZE]) {
+    uint8_t buf[M913_PACKET_SIZE];
+    std::memcpy(buf, data, M913_PACKET_SIZE);
+
+    usbdevfs_ctrltransfer ctrl{};
+    ctrl.bRequestType = CTRL_REQUEST_TYPE;
+    ctrl.bRequest     = CTRL_REQUEST;
+    ctrl.wValue       = _ctrl_value;
+    ctrl.wIndex       = CTRL_INDEX;
+    ctrl.wLength      = M913_PACKET_SIZE;
+    ctrl.timeout      = USB_TIMEOUT_MS;
+    ctrl.data         = buf;
+
+    int r;
+    do {
+        r = ioctl(_fd, USBDEVFS_CONTROL, &ctrl);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0)
+        throw_transfer("Control transfer (send) failed", urb_status(-errno));
+}
+
+int UsbfsMouse::try_recv(uint8_t* buf, int buf_size, uint8_t endpoint,
+                         unsigned int timeout_ms) {
+    auto it = _in_queues.find(endpoint);
+    if (it != _in_queues.end()) {
+        InQueue& q = it->second;
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms);
+        if (q.reports.empty())
+            poll_events(0);
+        while (q.reports.empty() && q.active) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) break;
+            poll_events(static_cast<unsigned int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()));
+        }
+        if (q.reports.empty()) {
+            if (q.error)
+                throw_transfer("Interrupt transfer failed on EP 0x" + ep_hex(endpoint), q.error);
+            return 0;
+        }
+        const std::vector<uint8_t>& rep = q.reports.front();
+        int n = std::min(buf_size, static_cast<int>(rep.size()));
+        std::memcpy(buf, rep.data(), static_cast<size_t>(n));
+        q.reports.pop_front();
+        return n;
+    }
+
+    if (timeout_ms == 0) return 0;
+
+    // One-shot read on an endpoint without a permanent queue, discarded
+    // when the deadline passes.
+    bool done   = false;
+    int  status = TRANSFER_ERROR;
+    int  got    = 0;
+    auto* u = new Urb;
+    u->cb = [&](int st, const uint8_t* data, int len) {
+        done   = true;
+        status = st;
+        got    = std::min(len, buf_size);
+        if (st == TRANSFER_OK && got > 0)
+            std::memcpy(buf, data, static_cast<size_t>(got));
+    };
+    u->has_deadline = true;
+    u->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    u->urb.type          = USBDEVFS_URB_TYPE_INTERRUPT;
+    u->urb.endpoint      = endpoint;
+    u->urb.buffer        = u->buf;
+    u->urb.buffer_length = std::min(buf_size, URB_BUF_SIZE);
+    _submit_one_shot(u);
+    _wait_for(done, 0);
+    if (!done) {
+        // The device went away (or was closed) before the URB came back.
+        // It must not call back into this frame later.
+        if (_sends.count(u)) u->cb = nullptr;
+        status = TRANSFER_NO_DEVICE;
+    }
+
+    if (status == TRANSFER_CANCELLED || status == TRANSFER_TIMED_OUT)
+        return 0;
+    if (status != TRANSFER_OK)
+        throw_transfer("Interrupt transfer failed on EP 0x" + ep_hex(endpoint), status);
+    return got;
+}
+
+void UsbfsMouse::probe() {
+    int num_ifaces = 0;
+    std::ostringstream out;
+
+    // Walk the first configuration descriptor and everything it contains.
+    bool in_config = false;
+    for (size_t off = 0; off + 2 <= _descriptors.size();) {
+        const uint8_t* d = _descriptors.data() + off;
+        uint8_t len = d[0], type = d[1];
+        if (len < 2 || off + len > _descriptors.size()) break;
+        if (type == DESC_CONFIG) {
+            if (in_config) break;
+            in_config  = true;
+            num_ifaces = d[4];
+        } else if (in_config && type == DESC_INTERFACE && len >= 9) {
+            out << "  Interface " << static_cast<int>(d[2])
+                << " (class " << static_cast<int>(d[5])
+                << ", subclass " << static_cast<int>(d[6])
+                << ", protocol " << static_cast<int>(d[7])
+                << ")  endpoints: " << static_cast<int>(d[4]) << "\n";
+        } else if (in_config && type == DESC_ENDPOINT && len >= 7) {
+            uint8_t addr  = d[2];
+            uint8_t attrs = d[3];
+            std::string dir  = (addr & 0x80) ? "IN " : "OUT";
+            std::string kind;
+            switch (attrs & 0x03) {
+                case 0: kind = "Control";     break;
+                case 1: kind = "Isochronous"; break;
+                case 2: kind = "Bulk";        break;
+                case 3: kind = "Interrupt";   break;
+            }
+            out << std::hex << std::setfill('0');
+            out << "    EP 0x" << std::setw(2) << static_cast<int>(addr)
+                << "  " << dir << "  " << kind
+                << "  maxPacket=" << std::dec << (d[4] | (d[5] << 8))
+                << "  interval=" << static_cast<int>(d[6]) << "ms\n";
+        }
+        off += len;
+    }
+
+    if (!in_config) {
+        std::cout << "Could not get config descriptor\n";
+        return;
+    }
+    std::cout << "USB descriptor: " << num_ifaces << " interface(s)\n" << out.str();
+}
+
+// --- private helpers ---
+
+// Claim every interface of the first configuration (num_ifaces of them
+// when the caller already knows).  DISCONNECT_CLAIM unbinds the kernel
+// driver and claims in one step, so no other process can grab the
+// interface in between; interfaces that had a driver are reconnected on
+// close.
+void UsbfsMouse::_claim_all_interfaces(int num_ifaces) {
+    for (size_t off = 0; num_ifaces <= 0 && off + 5 <= _descriptors.size();
+         off += _descriptors[off]) {
+        if (_descriptors[off] < 2) break;
+        if (_descriptors[off + 1] == DESC_CONFIG) {
+            num_ifaces = _descriptors[off + 4];
+            break;
+        }
+    }
+    if (num_ifaces <= 0) num_ifaces = 2;
+
+    for (int iface = 0; iface < num_ifaces; ++iface)
+        _claim_interface(iface);
+}
+
+void UsbfsMouse::_claim_interface(int iface) {
+    usbdevfs_getdriver gd{};
+    gd.interface = static_cast<unsigned int>(iface);
+    bool had_driver = ioctl(_fd, USBDEVFS_GETDRIVER, &gd) == 0 &&
+                      std::strcmp(gd.driver, "usbfs") != 0;
+
+    usbdevfs_disconnect_claim dc{};
+    dc.interface = static_cast<unsigned int>(iface);
+    dc.flags     = USBDEVFS_DISCONNECT_CLAIM_EXCEPT_DRIVER;
+    std::strcpy(dc.driver, "usbfs");
+    if (ioctl(_fd, USBDEVFS_DISCONNECT_CLAIM, &dc) < 0) {
+        throw std::runtime_error(
+            "Failed to claim interface " + std::to_string(iface) + ": " +
+            std::strerror(errno));
+    }
+    _claimed.push_back(iface);
+    if (had_driver) {
+        _disconnected.push_back(iface);
+        if (iface == 0) _stall_begin();
+    }
+}
+
+void UsbfsMouse::_release_all_interfaces() {
+    for (int iface : _claimed) {
+        unsigned int n = static_cast<unsigned int>(iface);
+        ioctl(_fd, USBDEVFS_RELEASEINTERFACE, &n);
+    }
+    for (int iface : _disconnected) {
+        usbdevfs_ioctl cmd{};
+        cmd.ifno       = iface;
+        cmd.ioctl_code = USBDEVFS_CONNECT;
+        ioctl(_fd, USBDEVFS_IOCTL, &cmd);
+        if (iface == 0) _stall_end();
+    }
+    _claimed.clear();
+    _disconnected.clear();
+}
+
+// wMaxPacketSize of an endpoint from the first configuration (64 if unknown).
+// Interrupt URBs are sized to exactly one packet: a full-size packet
+// would otherwise leave the URB waiting for more data.
+int UsbfsMouse::_endpoint_max_packet(uint8_t endpoint) const {
+    for (size_t off = 0; off + 7 <= _descriptors.size(); off += _descriptors[off]) {
+        const uint8_t* d = _descriptors.data() + off;
+        if (d[0] < 2) break;
+        if (d[1] == DESC_ENDPOINT && d[2] == endpoint)
+            return d[4] | (d[5] << 8);
+    }
+    return 64;
+}
+
+void UsbfsMouse::_submit_one_shot(Urb* u) {
+    u->urb.usercontext = u;
+    if (ioctl(_fd, USBDEVFS_SUBMITURB, &u->urb) < 0) {
+        int err = errno;
+        delete u;
+        throw_transfer("Failed to submit transfer", urb_status(-err));
+    }
+    _sends.insert(u);
+}
+
+// Run the event loop until `done` is set by a completion callback.
+// timeout_ms == 0 waits without a deadline.
+void UsbfsMouse::_wait_for(const bool& done, unsigned int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    while (!done) {
+        unsigned int slice = 100;
+        if (timeout_ms) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) return;
+            slice = static_cast<unsigned int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count());
+        }
+        if (!poll_events(slice) && _fd >= 0 && !_reap_all()) return;
+    }
+}
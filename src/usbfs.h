@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "transport.h"
+
+// -----------------------------------------------------------------------
+// usbfs transport
+//
+// Talks to /dev/bus/usb/BBB/DDD directly through the usbfs ioctls, without
+// libusb: USBDEVFS_DISCONNECT_CLAIM to take the interfaces, USBDEVFS_CONTROL
+// for synchronous writes and USBDEVFS_SUBMITURB/REAPURBNDELAY for
+// asynchronous ones and for the permanently queued interrupt-IN URBs.
+// Each URB's buffer is filled in place once and handed to the kernel as is.
+// Devices come from discover_devices(), so there is no per-process library
+// initialisation or bus enumeration.
+// -----------------------------------------------------------------------
+class UsbfsMouse : public Transport {
+public:
+    UsbfsMouse() = default;
+    ~UsbfsMouse() override;
+
+    // Non-copyable
+    UsbfsMouse(const UsbfsMouse&) = delete;
+    UsbfsMouse& operator=(const UsbfsMouse&) = delete;
+
+    const char* name() const override { return "usbfs"; }
+
+    // Open one device returned by discover_devices().  ClaimScope::All
+    // claims every interface (num_interfaces of them if known, else per the
+    // descriptors); ClaimScope::Config claims only interface 1 and leaves
+    // the pointer bound to the kernel.
+    // Throws std::runtime_error on failure.
+    void open_device(const UsbDeviceId& id, ClaimScope scope = ClaimScope::All,
+                     int num_interfaces = 0);
+
+    // Same for a usbfs device node (/dev/bus/usb/BBB/DDD).
+    void open_path(const std::string& devnode, ClaimScope scope = ClaimScope::All,
+                   int num_interfaces = 0);
+
+    // idVendor/idProduct from the device descriptor; 0 when not open.
+    uint16_t vendor_id() const;
+    uint16_t product_id() const;
+
+    void close() override;
+    bool is_open() const override { return _fd >= 0; }
+    void set_ctrl_value(uint16_t v) override { _ctrl_value = v; }
+
+    void send(const uint8_t data[M913_PACKET_SIZE]) override;
+    int  try_recv(uint8_t* buf, int buf_size, uint8_t endpoint = INTERRUPT_EP_IN,
+                  unsigned int timeout_ms = 500) override;
+
+    void submit_send(const uint8_t data[M913_PACKET_SIZE], TransferCallback cb = nullptr) override;
+    void queue_interrupt_in(uint8_t endpoint, TransferCallback cb = nullptr) override;
+    int  pending_sends() const override { return static_cast<int>(_sends.size()); }
+    bool poll_events(unsigned int timeout_ms) override;
+    void cancel_all() override;
+    bool reset() override;
+
+    // Print interfaces and endpoints, parsed from the descriptors usbfs
+    // returns when the device node is read.
+    void probe() override;
+
+private:
+    struct Urb;  // URB plus bookkeeping, see usbfs.cpp
+
+    // A permanently queued interrupt-IN URB and its receive buffer.
+    struct InQueue {
+        Urb*                             urb    = nullptr;
+        std::deque<std::vector<uint8_t>> reports;
+        TransferCallback                 cb;
+        bool                             active = false;  // URB is submitted
+        int                              error  = 0;      // fatal TransferStatus
+    };
+
+    int         _fd         = -1;
+    uint16_t    _ctrl_value = CTRL_VALUE;
+    std::vector<uint8_t> _descriptors;    // raw device + config descriptors
+    std::vector<int> _claimed;            // interfaces we claimed
+    std::vector<int> _disconnected;       // interfaces a kernel driver was bound to
+    std::set<Urb*>   _sends;              // in-flight one-shot URBs
+    std::map<uint8_t, InQueue> _in_queues;
+    unsigned long    _completions = 0;
+    bool             _cancelling  = false;
+
+    void _claim_all_interfaces(int num_interfaces);
+    void _claim_interface(int iface);
+    void _release_all_interfaces();
+    int  _endpoint_max_packet(uint8_t endpoint) const;
+    void _submit_one_shot(Urb* u);
+    bool _reap_all();
+    void _complete(Urb* u);
+    void _expire_sends();
+    void _wait_for(const bool& done, unsigned int timeout_ms);
+};
@@ -0,0 +1,66 @@
+// Checks that building packets into a PacketBatch allocates nothing once
+// warmed up (see src/alloc.h).  Built with M913_COUNT_ALLOCATIONS.
+
+#include <cstdio>
+#include <map>
+
+#include "alloc.h"
+#include "data.h"
+#include "protocol.h"
+
+static void build_all(PacketBatch& batch, const std::map<uint8_t, ButtonAction>& buttons,
+                      const DpiSettings& dpi, const uint32_t colors[5]) {
+    batch.clear();
+    batch.extend(build_button_mapping(buttons, nullptr, batch.tail(), batch.room()));
+    batch.clear();
+    batch.extend(build_button_mapping(buttons, COMPX_LAYOUT, batch.tail(), batch.room()));
+    batch.clear();
+    batch.extend(build_dpi_packets(dpi, batch.tail(), batch.room()));
+    batch.clear();
+    batch.extend(build_compx_dpi_packets(dpi, batch.tail(), batch.room()));
+    batch.clear();
+    batch.extend(build_compx_color_packets(colors, 5, batch.tail(), batch.room()));
+    for (LedMode mode : {LedMode::Off, LedMode::Steady, LedMode::Respiration, LedMode::Rainbow}) {
+        batch.clear();
+        batch.extend(build_led_packets(mode, 0x123456, LED_DEFAULT_BRIGHTNESS, LED_DEFAULT_SPEED,
+                                       batch.tail(), batch.room()));
+    }
+    batch.clear();
+    batch.push_back(build_polling_rate_packet(1000));
+}
+
+int main() {
+    if (!allocation_counting()) {
+        std::fprintf(stderr, "built without M913_COUNT_ALLOCATIONS\n");
+        return 1;
+    }
+
+    std::map<uint8_t, ButtonAction> buttons;
+    const char* actions[] = {"left", "fire:10:2", "media_play", "a", "super",
+                             "ctrl_l+shift_l+z", "a+b+c+d+e"};
+    uint8_t btn = 0;
+    for (const char* a : actions) {
+        if (!parse_action(a, buttons[btn++])) {
+            std::fprintf(stderr, "cannot parse action %s\n", a);
+            return 1;
+        }
+    }
+    DpiSettings dpi;
+    dpi.values     = {800, 1600, 3200, 6400, 7200};
+    dpi.enabled[4] = false;
+    const uint32_t colors[5] = {0xff0000, 0x00ff00, 0x0000ff, 0xffff00, 0xffffff};
+
+    PacketBatch batch;
+    build_all(batch, buttons, dpi, colors);  // warm-up
+
+    size_t before = allocation_count();
+    for (int i = 0; i < 1000; ++i)
+        build_all(batch, buttons, dpi, colors);
+    size_t allocated = allocation_count() - before;
+
+    if (allocated != 0) {
+        std::fprintf(stderr, "%zu allocations in 1000 warmed-up builds\n", allocated);
+        return 1;
+    }
+    return 0;
+}